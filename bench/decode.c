@@ -0,0 +1,672 @@
+/* Measures the loader on a synthetic corpus of JPEG, PNG, WEBP, GIF and PTF images at a few sizes.
+   Every set is loaded one image at a time and then all at once, the way the viewer's loading
+   threads overlap, and the results are written as JSON. Built and run with "make bench" */
+
+#include <stdio.h>    // printf, fprintf, fopen, fclose, fwrite, fgets, fputs, snprintf, stderr
+#include <stdlib.h>   // malloc, realloc, free, abs, atol, getenv, mkdtemp, EXIT_FAILURE
+#include <string.h>   // memset, memcpy, strlen, strncmp
+#include <math.h>     // sin, cos, cosf, sqrtf, M_PI
+#include <time.h>     // clock_gettime, nanosleep, CLOCK_MONOTONIC
+#include <unistd.h>   // sysconf, unlink, rmdir
+#include <sys/stat.h> // mkdir
+
+#include <webp/encode.h>
+#include <lz4/lz4frame.h>
+
+#include "loader.h"
+
+#ifndef VERSION
+#define VERSION "unknown" // Passed by the makefile
+#endif
+
+#define BENCHFILES 8 // Copies of every image, enough to keep a few cores busy when loading all at once
+#define BENCHRUNS  3 // The fastest run is kept
+
+static uint32_t seed = 1;
+
+static uint8_t randomByte(void) {
+	return (seed = seed*1103515245 + 12345) >> 24;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+// Smooth gradients with a bit of grain, closer to a photo than noise, which no codec compresses
+static uint8_t *makePixels(int w, int h) {
+	uint8_t *pxs = malloc((size_t)w*h*3);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			for (int c = 0; c < 3; ++c) {
+				double u = (double)x/w*6.28, v = (double)y/h*6.28;
+				int    p = 128 + 70*sin(u*(c + 1) + v) + 40*cos(v*(3 - c) - u*0.5) + randomByte()%8 - 4;
+				pxs[((size_t)y*w + x)*3 + c] = p < 0? 0 : p > 255? 255 : p;
+			}
+		}
+	}
+	return pxs;
+}
+
+// Growing output buffer shared by the encoders
+typedef struct {
+	uint8_t *data;
+	size_t   sz, cap;
+	uint32_t bits;  // Pending bits, for the bit-level writers
+	int      nbits;
+} Buf;
+
+static void putBytes(Buf *b, const void *data, size_t sz) {
+	if (b->sz + sz > b->cap) {
+		while (b->sz + sz > b->cap) b->cap = b->cap? b->cap*2 : 4096;
+		b->data = realloc(b->data, b->cap);
+	}
+	memcpy(b->data + b->sz, data, sz);
+	b->sz += sz;
+}
+
+static void putByte(Buf *b, uint8_t byte) {
+	putBytes(b, &byte, 1);
+}
+
+static void putBe16(Buf *b, int v) {
+	putByte(b, v >> 8);
+	putByte(b, v);
+}
+
+static void putBe32(Buf *b, uint32_t v) {
+	putBe16(b, v >> 16);
+	putBe16(b, v & 0xFFFF);
+}
+
+static void putLe16(Buf *b, int v) {
+	putByte(b, v);
+	putByte(b, v >> 8);
+}
+
+/* PNG, filtered like encoders do and compressed with fixed Huffman codes after a single-probe LZ77.
+   Worse ratios than zlib, but the decoder does the same kind of work */
+
+// Deflate writes bits starting from the least significant one
+static void putBitsLsb(Buf *b, uint32_t bits, int n) {
+	b->bits  |= bits << b->nbits;
+	b->nbits += n;
+	for (; b->nbits >= 8; b->nbits -= 8, b->bits >>= 8) putByte(b, b->bits);
+}
+
+// Huffman codes go out from the most significant bit
+static void putHuffman(Buf *b, uint32_t code, int n) {
+	uint32_t rev = 0;
+	for (int i = 0; i < n; ++i) rev |= ((code >> i) & 1) << (n - 1 - i);
+	putBitsLsb(b, rev, n);
+}
+
+static void putLiteral(Buf *b, int lit) {
+	if      (lit < 144) putHuffman(b, 0x30 + lit, 8);
+	else if (lit < 256) putHuffman(b, 0x190 + lit - 144, 9);
+	else if (lit < 280) putHuffman(b, lit - 256, 7);
+	else                putHuffman(b, 0xC0 + lit - 280, 8);
+}
+
+static const uint16_t lenBase[]  = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                    67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t  lenExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+                                    5, 5, 5, 5, 0};
+static const uint16_t distBase[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+                                    513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385,
+                                    24577};
+
+static void putMatch(Buf *b, int len, int dist) {
+	int l = 28, d = 29;
+	while (lenBase[l] > len)   --l;
+	while (distBase[d] > dist) --d;
+	putLiteral(b, 257 + l);
+	putBitsLsb(b, len - lenBase[l], lenExtra[l]);
+	putHuffman(b, d, 5);
+	putBitsLsb(b, dist - distBase[d], d < 4? 0 : d/2 - 1);
+}
+
+#define HASHBITS 15
+
+static void deflate(Buf *b, const uint8_t *src, size_t sz) {
+	int32_t *head = malloc(sizeof(*head) << HASHBITS);
+	for (size_t i = 0; i < (size_t)1 << HASHBITS; ++i) head[i] = -1;
+	putBitsLsb(b, 3, 3); // The last block, with fixed codes
+	for (size_t i = 0; i < sz;) {
+		int len = 0, dist = 0;
+		if (i + 3 <= sz) {
+			uint32_t h    = ((src[i] << 16 | src[i + 1] << 8 | src[i + 2])*2654435761u) >> (32 - HASHBITS);
+			int32_t  prev = head[h];
+			head[h] = i;
+			if (prev >= 0 && i - prev <= 32768) {
+				while (len < 258 && i + len < sz && src[prev + len] == src[i + len]) ++len;
+				dist = i - prev;
+			}
+		}
+		if (len >= 3) {
+			putMatch(b, len, dist);
+			i += len;
+		} else putLiteral(b, src[i++]);
+	}
+	putLiteral(b, 256);
+	if (b->nbits > 0) putBitsLsb(b, 0, 8 - b->nbits);
+	free(head);
+}
+
+static uint32_t crc32(const uint8_t *data, size_t sz) {
+	static uint32_t table[256];
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) c = c & 1? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	uint32_t c = 0xFFFFFFFF;
+	for (size_t i = 0; i < sz; ++i) c = table[(c ^ data[i]) & 0xFF] ^ (c >> 8);
+	return c ^ 0xFFFFFFFF;
+}
+
+static void putPngChunk(Buf *b, const char *type, const uint8_t *data, size_t sz) {
+	putBe32(b, sz);
+	size_t start = b->sz;
+	putBytes(b, type, 4);
+	if (sz > 0) putBytes(b, data, sz);
+	putBe32(b, crc32(b->data + start, sz + 4));
+}
+
+static int paeth(int a, int b, int c) {
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc? a : pb <= pc? b : c;
+}
+
+// Every row takes the filter with the smallest sum of absolute differences
+static uint8_t *filterPng(const uint8_t *pxs, int w, int h, size_t *sz) {
+	size_t   stride = (size_t)w*3;
+	uint8_t *out    = malloc((stride + 1)*h), *cand = malloc(stride*5);
+	for (int y = 0; y < h; ++y) {
+		const uint8_t *row = pxs + y*stride, *up = y > 0? row - stride : NULL;
+		long best = -1;
+		int  pick = 0;
+		for (int f = 0; f < 5; ++f) {
+			long sum = 0;
+			for (size_t i = 0; i < stride; ++i) {
+				int a = i >= 3? row[i - 3] : 0, b = up? up[i] : 0, c = i >= 3 && up? up[i - 3] : 0;
+				int pred = f == 0? 0 : f == 1? a : f == 2? b : f == 3? (a + b)/2 : paeth(a, b, c);
+				uint8_t v = row[i] - pred;
+				cand[f*stride + i] = v;
+				sum += v < 128? v : 256 - v;
+			}
+			if (best < 0 || sum < best) {
+				best = sum;
+				pick = f;
+			}
+		}
+		out[y*(stride + 1)] = pick;
+		memcpy(out + y*(stride + 1) + 1, cand + pick*stride, stride);
+	}
+	free(cand);
+	*sz = (stride + 1)*h;
+	return out;
+}
+
+static void encodePng(Buf *out, const uint8_t *pxs, int w, int h) {
+	size_t   sz;
+	uint8_t *filtered = filterPng(pxs, w, h, &sz);
+	Buf      z        = {0};
+	putByte(&z, 0x78);
+	putByte(&z, 0x01);
+	deflate(&z, filtered, sz);
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < sz; ++i) {
+		a = (a + filtered[i])%65521;
+		b = (b + a)%65521;
+	}
+	putBe32(&z, b << 16 | a);
+
+	uint8_t ihdr[13] = {w >> 24, w >> 16, w >> 8, w, h >> 24, h >> 16, h >> 8, h, 8, 2, 0, 0, 0};
+	putBytes(out, "\x89PNG\r\n\x1A\n", 8);
+	putPngChunk(out, "IHDR", ihdr, sizeof(ihdr));
+	putPngChunk(out, "IDAT", z.data, z.sz);
+	putPngChunk(out, "IEND", NULL, 0);
+	free(z.data);
+	free(filtered);
+}
+
+/* Baseline JPEG with 4:2:0 chroma, the layout most cameras write. All components share the
+   standard luminance Huffman tables */
+
+static const uint8_t zigzag[64] = {
+	0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6,
+	7, 14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58, 59, 52, 45, 38, 31,
+	39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+static const uint8_t lumaQuant[64] = {
+	16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56,
+	14, 17, 22, 29, 51, 87, 80, 62, 18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+	49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t chromaQuant[64] = {
+	17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99,
+	47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+static const uint8_t dcBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dcVals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t acBits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+static const uint8_t acVals[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+	0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+	0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+	0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+	0xF9, 0xFA,
+};
+
+typedef struct {
+	uint16_t code[256];
+	uint8_t  len[256];
+} HuffTable;
+
+// Canonical codes, in order of length
+static void buildHuffTable(HuffTable *t, const uint8_t *bits, const uint8_t *vals) {
+	int code = 0, k = 0;
+	for (int len = 1; len <= 16; ++len, code <<= 1) {
+		for (int i = 0; i < bits[len - 1]; ++i, ++code, ++k) {
+			t->code[vals[k]] = code;
+			t->len[vals[k]]  = len;
+		}
+	}
+}
+
+// Entropy coded data escapes every 0xFF byte with a zero
+static void putBitsMsb(Buf *b, uint32_t bits, int n) {
+	b->bits   = b->bits << n | (bits & ((1u << n) - 1));
+	b->nbits += n;
+	for (; b->nbits >= 8; b->nbits -= 8) {
+		uint8_t byte = b->bits >> (b->nbits - 8);
+		putByte(b, byte);
+		if (byte == 0xFF) putByte(b, 0);
+	}
+}
+
+// Bits needed for v, and the way JPEG writes negative values in them
+static int magnitude(int v, int *bits) {
+	int a = v < 0? -v : v, n = 0;
+	while (a >> n) ++n;
+	*bits = v < 0? v + (1 << n) - 1 : v;
+	return n;
+}
+
+static void encodeBlock(Buf *b, const float *block, const float *quant, int *dc, const HuffTable *dct,
+                        const HuffTable *act) {
+	// Separable DCT, rows and then columns
+	static float cosines[8][8];
+	if (cosines[0][0] == 0)
+		for (int u = 0; u < 8; ++u)
+			for (int x = 0; x < 8; ++x)
+				cosines[u][x] = cosf((2*x + 1)*u*M_PI/16)*(u == 0? sqrtf(0.125f) : 0.5f);
+	float tmp[64], coefs[64];
+	for (int y = 0; y < 8; ++y)
+		for (int u = 0; u < 8; ++u) {
+			float s = 0;
+			for (int x = 0; x < 8; ++x) s += block[y*8 + x]*cosines[u][x];
+			tmp[y*8 + u] = s;
+		}
+	for (int v = 0; v < 8; ++v)
+		for (int u = 0; u < 8; ++u) {
+			float s = 0;
+			for (int y = 0; y < 8; ++y) s += tmp[y*8 + u]*cosines[v][y];
+			coefs[v*8 + u] = s;
+		}
+
+	int q[64], bits, n;
+	for (int i = 0; i < 64; ++i) {
+		float c = coefs[zigzag[i]]/quant[zigzag[i]];
+		q[i] = c < 0? (int)(c - 0.5f) : (int)(c + 0.5f);
+	}
+	n = magnitude(q[0] - *dc, &bits);
+	*dc = q[0];
+	putBitsMsb(b, dct->code[n], dct->len[n]);
+	putBitsMsb(b, bits, n);
+
+	int run = 0;
+	for (int i = 1; i < 64; ++i) {
+		if (q[i] == 0) {
+			++run;
+			continue;
+		}
+		for (; run >= 16; run -= 16) putBitsMsb(b, act->code[0xF0], act->len[0xF0]);
+		n = magnitude(q[i], &bits);
+		putBitsMsb(b, act->code[run << 4 | n], act->len[run << 4 | n]);
+		putBitsMsb(b, bits, n);
+		run = 0;
+	}
+	if (run > 0) putBitsMsb(b, act->code[0], act->len[0]);
+}
+
+static void putJpegTable(Buf *out, int marker, const uint8_t *head, int headSz, const uint8_t *data,
+                         int sz) {
+	putBe16(out, marker);
+	putBe16(out, 2 + headSz + sz);
+	putBytes(out, head, headSz);
+	putBytes(out, data, sz);
+}
+
+#define JPEGQUALITY 90
+
+static void encodeJpeg(Buf *out, const uint8_t *pxs, int w, int h) {
+	// Quantization tables are scaled like libjpeg does for the quality
+	uint8_t qtables[2][64];
+	float   quant[2][64];
+	for (int i = 0; i < 64; ++i) {
+		for (int t = 0; t < 2; ++t) {
+			int q = ((t? chromaQuant : lumaQuant)[i]*(200 - 2*JPEGQUALITY) + 50)/100;
+			q = q < 1? 1 : q > 255? 255 : q;
+			quant[t][i] = q;
+		}
+	}
+	for (int t = 0; t < 2; ++t)
+		for (int i = 0; i < 64; ++i) qtables[t][i] = quant[t][zigzag[i]];
+	HuffTable dct, act;
+	buildHuffTable(&dct, dcBits, dcVals);
+	buildHuffTable(&act, acBits, acVals);
+
+	putBe16(out, 0xFFD8);
+	for (int t = 0; t < 2; ++t) putJpegTable(out, 0xFFDB, &(uint8_t){t}, 1, qtables[t], 64);
+	uint8_t sof[] = {8, h >> 8, h, w >> 8, w, 3, 1, 0x22, 0, 2, 0x11, 1, 3, 0x11, 1};
+	putJpegTable(out, 0xFFC0, sof, sizeof(sof), NULL, 0);
+	uint8_t dcHead[17] = {0x00}, acHead[17] = {0x10};
+	memcpy(dcHead + 1, dcBits, 16);
+	memcpy(acHead + 1, acBits, 16);
+	putJpegTable(out, 0xFFC4, dcHead, sizeof(dcHead), dcVals, sizeof(dcVals));
+	putJpegTable(out, 0xFFC4, acHead, sizeof(acHead), acVals, sizeof(acVals));
+	uint8_t sos[] = {3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0};
+	putJpegTable(out, 0xFFDA, sos, sizeof(sos), NULL, 0);
+
+	int dc[3] = {0};
+	for (int my = 0; my < h; my += 16) {
+		for (int mx = 0; mx < w; mx += 16) {
+			// Edges are repeated to fill partial MCUs
+			float ycc[3][16][16], block[64];
+			for (int y = 0; y < 16; ++y) {
+				for (int x = 0; x < 16; ++x) {
+					int sx = mx + x < w? mx + x : w - 1, sy = my + y < h? my + y : h - 1;
+					const uint8_t *p = pxs + ((size_t)sy*w + sx)*3;
+					ycc[0][y][x] =  0.299f*p[0] + 0.587f*p[1] + 0.114f*p[2] - 128;
+					ycc[1][y][x] = -0.1687f*p[0] - 0.3313f*p[1] + 0.5f*p[2];
+					ycc[2][y][x] =  0.5f*p[0] - 0.4187f*p[1] - 0.0813f*p[2];
+				}
+			}
+			for (int by = 0; by < 16; by += 8) {
+				for (int bx = 0; bx < 16; bx += 8) {
+					for (int i = 0; i < 64; ++i) block[i] = ycc[0][by + i/8][bx + i%8];
+					encodeBlock(out, block, quant[0], &dc[0], &dct, &act);
+				}
+			}
+			for (int c = 1; c < 3; ++c) {
+				for (int i = 0; i < 64; ++i) {
+					int y = i/8*2, x = i%8*2;
+					block[i] = (ycc[c][y][x] + ycc[c][y][x + 1] + ycc[c][y + 1][x] + ycc[c][y + 1][x + 1])/4;
+				}
+				encodeBlock(out, block, quant[1], &dc[c], &dct, &act);
+			}
+		}
+	}
+	putBitsMsb(out, 0x7F, 7); // Pads the last byte with ones
+	out->nbits = 0;
+	putBe16(out, 0xFFD9);
+}
+
+// GIF with a 3-3-2 palette, LZW codes grow from 9 to 12 bits and the table is cleared when it's full
+static void encodeGif(Buf *out, const uint8_t *pxs, int w, int h) {
+	putBytes(out, "GIF89a", 6);
+	putLe16(out, w);
+	putLe16(out, h);
+	putBytes(out, "\xF7\x00\x00", 3);
+	for (int i = 0; i < 256; ++i) {
+		putByte(out, (i >> 5)*255/7);
+		putByte(out, (i >> 2 & 7)*255/7);
+		putByte(out, (i & 3)*255/3);
+	}
+	putByte(out, 0x2C);
+	putLe16(out, 0);
+	putLe16(out, 0);
+	putLe16(out, w);
+	putLe16(out, h);
+	putByte(out, 0);
+	putByte(out, 8);
+
+	uint16_t *dict = malloc(4096*256*sizeof(*dict)); // Code of a code followed by a byte, 0 if none
+	Buf       lzw  = {0};
+	int       size = 9, next = 258, code = -1;
+	memset(dict, 0, 4096*256*sizeof(*dict));
+	putBitsLsb(&lzw, 256, size);
+	for (size_t i = 0; i < (size_t)w*h; ++i) {
+		const uint8_t *p = pxs + i*3;
+		uint8_t idx = (p[0] & 0xE0) | (p[1] >> 3 & 0x1C) | p[2] >> 6;
+		if (code < 0) {
+			code = idx;
+			continue;
+		}
+		if (dict[code*256 + idx]) {
+			code = dict[code*256 + idx];
+			continue;
+		}
+		putBitsLsb(&lzw, code, size);
+		dict[code*256 + idx] = next++;
+		if (next > 1 << size && size < 12) ++size;
+		if (next == 4096) {
+			putBitsLsb(&lzw, 256, size);
+			memset(dict, 0, 4096*256*sizeof(*dict));
+			size = 9;
+			next = 258;
+		}
+		code = idx;
+	}
+	putBitsLsb(&lzw, code, size);
+	putBitsLsb(&lzw, 257, size);
+	if (lzw.nbits > 0) putBitsLsb(&lzw, 0, 8 - lzw.nbits);
+	for (size_t i = 0; i < lzw.sz; i += 255) {
+		size_t n = lzw.sz - i < 255? lzw.sz - i : 255;
+		putByte(out, n);
+		putBytes(out, lzw.data + i, n);
+	}
+	putByte(out, 0);
+	putByte(out, 0x3B);
+	free(lzw.data);
+	free(dict);
+}
+
+/* The bundled libwebp.a is built without libsharpyuv, which its encoder links against. Sharp YUV
+   conversion is never asked for, so these only have to exist */
+void SharpYuvInit(void *cpuInfo) {
+	unused(cpuInfo);
+}
+
+const void *SharpYuvGetConversionMatrix(int type) {
+	die("Sharp YUV conversion %i isn't available", type);
+}
+
+int SharpYuvConvert(void) {
+	die("Sharp YUV conversion isn't available");
+}
+
+static void encodeWebp(Buf *out, const uint8_t *pxs, int w, int h) {
+	uint8_t *data;
+	size_t   sz = WebPEncodeRGB(pxs, w, h, w*3, 85, &data);
+	if (sz == 0) die("Failed to encode WEBP");
+	putBytes(out, data, sz);
+	WebPFree(data);
+}
+
+// PTF sizes are powers of two, RGB in an lz4 frame of independent blocks like its tools write
+static void encodePtf(Buf *out, const uint8_t *pxs, int w, int h) {
+	int lw = 0, lh = 0;
+	while (1 << lw < w) ++lw;
+	while (1 << lh < h) ++lh;
+	putBytes(out, "PTF\0", 4);
+	putByte(out, 0);
+	putByte(out, lw | lh << 4);
+
+	LZ4F_preferences_t prefs = {0};
+	prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+	prefs.frameInfo.blockMode   = LZ4F_blockIndependent;
+	size_t   sz   = (size_t)w*h*3, bound = LZ4F_compressFrameBound(sz, &prefs);
+	uint8_t *data = malloc(bound);
+	if (LZ4F_isError(sz = LZ4F_compressFrame(data, bound, pxs, sz, &prefs))) die("Failed to encode PTF");
+	putBytes(out, data, sz);
+	free(data);
+}
+
+typedef struct {
+	const char *name, *ext;
+	void (*encode)(Buf *out, const uint8_t *pxs, int w, int h);
+	int sizes[3][2];
+} Format;
+
+static const Format formats[] = {
+	{"jpeg", "jpg",  encodeJpeg, {{640, 480}, {1920, 1080}, {4000, 3000}}},
+	{"png",  "png",  encodePng,  {{640, 480}, {1920, 1080}, {4000, 3000}}},
+	{"webp", "webp", encodeWebp, {{640, 480}, {1920, 1080}, {4000, 3000}}},
+	{"gif",  "gif",  encodeGif,  {{320, 240}, {640, 480},   {1280, 720}}},
+	{"ptf",  "ptf",  encodePtf,  {{512, 512}, {2048, 1024}, {4096, 4096}}},
+};
+
+// A field of /proc/self/status in kilobytes, VmRSS is the current resident memory and VmHWM its peak
+static long readStatus(const char *field) {
+	FILE  *f = fopen("/proc/self/status", "r");
+	char   line[256];
+	long   kb = -1;
+	size_t n  = strlen(field);
+	while (f != NULL && fgets(line, sizeof(line), f) != NULL)
+		if (strncmp(line, field, n) == 0 && line[n] == ':') kb = atol(line + n + 1);
+	if (f != NULL) fclose(f);
+	return kb;
+}
+
+static void resetPeakRss(void) {
+	FILE *f = fopen("/proc/self/clear_refs", "w");
+	if (f == NULL) return;
+	fputs("5", f);
+	fclose(f);
+}
+
+static void waitForImage(Image *img) {
+	while (isImageLoading(img)) nanosleep(&(struct timespec){0, 20000}, NULL);
+	if (img->err != NULL) die("Failed to load %s: %s", img->path, img->err);
+}
+
+/* Loads all images of a set, one at a time or all at once, and returns the fastest run in
+   milliseconds. Memory freed by earlier sets can stay resident, so the peak comes with what was
+   resident when the run started */
+static double loadSet(Images *imgs, bool parallel, long *peakRss, long *baseRss) {
+	double best = 1e9;
+	*peakRss = *baseRss = 0;
+	for (int r = 0; r < BENCHRUNS; ++r) {
+		resetPeakRss();
+		long   base  = readStatus("VmRSS");
+		double start = now();
+		for (size_t i = 0; i < imgs->sz; ++i) {
+			loadImage(imgs, getImage(imgs, i));
+			if (!parallel) waitForImage(getImage(imgs, i));
+		}
+		for (size_t i = 0; i < imgs->sz; ++i) waitForImage(getImage(imgs, i));
+		double ms   = now() - start;
+		long   peak = readStatus("VmHWM");
+		for (size_t i = 0; i < imgs->sz; ++i) unloadImage(getImage(imgs, i));
+		if (ms < best) best = ms;
+		if (peak - base > *peakRss - *baseRss) {
+			*peakRss = peak;
+			*baseRss = base;
+		}
+	}
+	return best;
+}
+
+static void writeFile(const char *path, const Buf *b) {
+	FILE *f = fopen(path, "wb");
+	if (f == NULL || fwrite(b->data, 1, b->sz, f) != b->sz) die("Failed to write %s", path);
+	fclose(f);
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: decodebench OUT.json\n");
+		return EXIT_FAILURE;
+	}
+	initKernels();
+	FILE *json = fopen(argv[1], "w");
+	if (json == NULL) die("Failed to open %s: %s", argv[1], strerror(errno));
+
+	const char *tmp = getenv("TMPDIR");
+	char        corpus[PATH_MAX];
+	snprintf(corpus, sizeof(corpus), "%s/tinview-bench-XXXXXX", tmp != NULL? tmp : "/tmp");
+	if (mkdtemp(corpus) == NULL) die("Failed to create %s: %s", corpus, strerror(errno));
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	fprintf(json, "{\n\t\"version\": \"%s\",\n\t\"kernels\": \"%s\",\n\t\"cpus\": %ld,\n\t\"images\": %d,\n"
+	        "\t\"results\": [", VERSION, kernels.name, cpus, BENCHFILES);
+	printf("%-5s %-10s %-8s %10s %10s %8s %12s\n", "", "size", "loading", "ms", "ms/image", "MP/s",
+	       "added RSS");
+	bool first = true;
+	for (size_t f = 0; f < lenOf(formats); ++f) {
+		const Format *fmt = &formats[f];
+		for (size_t s = 0; s < lenOf(fmt->sizes); ++s) {
+			int      w = fmt->sizes[s][0], h = fmt->sizes[s][1];
+			uint8_t *pxs = makePixels(w, h);
+			Buf      enc = {0};
+			fmt->encode(&enc, pxs, w, h);
+			free(pxs);
+
+			// Every set gets its own directory, so the images list holds only its copies
+			char dir[PATH_MAX + 64], path[PATH_MAX + 96];
+			snprintf(dir, sizeof(dir), "%s/%s-%ix%i", corpus, fmt->name, w, h);
+			if (mkdir(dir, 0700) != 0) die("Failed to create %s: %s", dir, strerror(errno));
+			for (int i = 0; i < BENCHFILES; ++i) {
+				snprintf(path, sizeof(path), "%s/%i.%s", dir, i, fmt->ext);
+				writeFile(path, &enc);
+			}
+			free(enc.data);
+
+			Images imgs;
+			Error  err = initImages(&imgs, dir);
+			if (err != NULL) die("Failed to list %s: %s", dir, err);
+			if (imgs.sz != BENCHFILES) die("Only %zu images found in %s", imgs.sz, dir);
+			for (int parallel = 0; parallel < 2; ++parallel) {
+				long   peak, base;
+				double ms  = loadSet(&imgs, parallel, &peak, &base);
+				double mps = (double)w*h*BENCHFILES/1e3/ms;
+				const char *mode = parallel? "parallel" : "serial";
+				printf("%-5s %4ix%-5i %-8s %10.2f %10.2f %8.1f %9ld kB\n", fmt->name, w, h, mode, ms,
+				       ms/BENCHFILES, mps, peak - base);
+				fprintf(json, "%s\n\t\t{\"format\": \"%s\", \"width\": %i, \"height\": %i, \"loading\": \"%s\", "
+				        "\"ms\": %.3f, \"msPerImage\": %.3f, \"mpPerSecond\": %.2f, \"peakRssKb\": %ld, "
+				        "\"baseRssKb\": %ld}", first? "" : ",", fmt->name, w, h, mode, ms, ms/BENCHFILES, mps,
+				        peak, base);
+				first = false;
+			}
+			freeImages(&imgs);
+
+			for (int i = 0; i < BENCHFILES; ++i) {
+				snprintf(path, sizeof(path), "%s/%i.%s", dir, i, fmt->ext);
+				unlink(path);
+			}
+			rmdir(dir);
+		}
+	}
+	fprintf(json, "\n\t]\n}\n");
+	fclose(json);
+	rmdir(corpus);
+	printf("Results written to %s\n", argv[1]);
+	return 0;
+}
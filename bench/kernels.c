@@ -0,0 +1,157 @@
+/* Checks every pixel kernel set the CPU supports against the scalar one, then measures them.
+   Built and run with "make bench" */
+
+#include <stdio.h>  // printf, fprintf, stderr
+#include <stdlib.h> // malloc, free, EXIT_FAILURE
+#include <string.h> // memcmp, memcpy
+#include <time.h>   // clock_gettime, CLOCK_MONOTONIC
+
+#include "kernels.h"
+
+#define BENCHW    4096
+#define BENCHH    4096
+#define BENCHRUNS 10
+
+static uint32_t seed = 1;
+
+static void fillRandom(uint8_t *buf, size_t sz) {
+	for (size_t i = 0; i < sz; ++i) buf[i] = (seed = seed*1103515245 + 12345) >> 24;
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+// Runs every kernel of both sets on the same input, returns the name of the first one that differs
+static const char *check(const Kernels *k, int w, int h, bool opaque) {
+	const Kernels *ref = getKernels(KERNELSSCALAR);
+	size_t   n   = (size_t)w*h;
+	uint8_t *src = malloc(n*4), *a = malloc(n*4), *b = malloc(n*4);
+	const char *bad = NULL;
+	fillRandom(src, n*4);
+	if (opaque) for (size_t i = 0; i < n; ++i) src[i*4 + 3] = 0xFF;
+
+	ref->rgbToRgba(a, src, n);
+	k->rgbToRgba(b, src, n);
+	if (memcmp(a, b, n*4) != 0) bad = "rgbToRgba";
+
+	ref->swapRb(a, src, n);
+	k->swapRb(b, src, n);
+	if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "swapRb";
+
+	memcpy(a, src, n*4);
+	memcpy(b, src, n*4);
+	ref->premultiply(a, n);
+	k->premultiply(b, n);
+	if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "premultiply";
+
+	ref->downscale2x(a, src, w, h);
+	k->downscale2x(b, src, w, h);
+	if (bad == NULL && memcmp(a, b, (size_t)(w/2)*(h/2)*4) != 0) bad = "downscale2x";
+
+	for (int cw = 0; cw < 2; ++cw) {
+		ref->rotate90(a, h*4, src, w, h, cw);
+		k->rotate90(b, h*4, src, w, h, cw);
+		if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "rotate90";
+	}
+
+	ref->mirror(a, src, n);
+	k->mirror(b, src, n);
+	if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "mirror";
+
+	if (bad == NULL && ref->isOpaque(src, n) != k->isOpaque(src, n)) bad = "isOpaque";
+
+	fillRandom(a, n*4);
+	memcpy(b, a, n*4);
+	ref->over(a, src, n);
+	k->over(b, src, n);
+	if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "over";
+
+	// Samples anywhere in the image, between it and itself shifted by a pixel
+	int32_t  *xs  = malloc(n*sizeof(*xs));
+	uint16_t *fxs = malloc(n*sizeof(*fxs));
+	for (size_t i = 0; i < n; ++i) {
+		fillRandom((uint8_t*)&xs[i], sizeof(*xs));
+		fillRandom((uint8_t*)&fxs[i], sizeof(*fxs));
+		xs[i]  = n > 2? (uint32_t)xs[i]%(n - 2) : 0;
+		fxs[i] = fxs[i]%257;
+	}
+	static const int fys[] = {0, 1, 128, 255, 256};
+	for (size_t i = 0; n > 2 && i < sizeof(fys)/sizeof(*fys); ++i) {
+		ref->scaleRow(a, src, src + 4, xs, fxs, fys[i], n);
+		k->scaleRow(b, src, src + 4, xs, fxs, fys[i], n);
+		if (bad == NULL && memcmp(a, b, n*4) != 0) bad = "scaleRow";
+	}
+	free(xs);
+	free(fxs);
+	free(src);
+	free(a);
+	free(b);
+	return bad;
+}
+
+#define bench(NAME, CALL) do { \
+	double best = 1e9; \
+	for (int r = 0; r < BENCHRUNS; ++r) { \
+		double start = now(); \
+		CALL; \
+		if (now() - start < best) best = now() - start; \
+	} \
+	printf("  %-12s %8.2f ms %8.0f MP/s\n", NAME, best, (double)n/1e3/best); \
+} while (0)
+
+int main(void) {
+	initKernels();
+	printf("Selected: %s\n", kernels.name);
+
+	// Odd sizes exercise the leftovers after the vector loops
+	static const int sizes[][2] = {{1, 1}, {3, 5}, {4, 4}, {7, 9}, {17, 33}, {64, 3}, {129, 67}};
+	int failed = 0;
+	for (int set = 0; set < KERNELSCOUNT; ++set) {
+		const Kernels *k = getKernels(set);
+		if (k == NULL) continue;
+		for (size_t i = 0; i < sizeof(sizes)/sizeof(*sizes); ++i)
+			for (int opaque = 0; opaque < 2; ++opaque) {
+				const char *bad = check(k, sizes[i][0], sizes[i][1], opaque);
+				if (bad == NULL) continue;
+				fprintf(stderr, "Error: %s %s differs from scalar at %ix%i\n", k->name, bad,
+				        sizes[i][0], sizes[i][1]);
+				++failed;
+			}
+	}
+	if (failed) return EXIT_FAILURE;
+	printf("All kernels match the scalar ones\n");
+
+	size_t   n   = (size_t)BENCHW*BENCHH;
+	uint8_t *src = malloc(n*4), *dest = malloc(n*4);
+	fillRandom(src, n*4);
+	for (size_t i = 0; i < n; ++i) src[i*4 + 3] = 0xFF; // So the opacity scan doesn't stop early
+	// Upscaling every row by 4/3, the second source row is the next one
+	int32_t  *xs  = malloc(n*sizeof(*xs));
+	uint16_t *fxs = malloc(n*sizeof(*fxs));
+	for (size_t i = 0; i < n; ++i) {
+		xs[i]  = i/BENCHW*BENCHW + i%BENCHW*3/4;
+		fxs[i] = i%BENCHW*3%4*64;
+	}
+	for (int set = 0; set < KERNELSCOUNT; ++set) {
+		const Kernels *k = getKernels(set);
+		if (k == NULL) continue;
+		printf("%s (%ix%i):\n", k->name, BENCHW, BENCHH);
+		bench("rgbToRgba",   k->rgbToRgba(dest, src, n));
+		bench("swapRb",      k->swapRb(dest, src, n));
+		bench("premultiply", (memcpy(dest, src, n*4), k->premultiply(dest, n)));
+		bench("downscale2x", k->downscale2x(dest, src, BENCHW, BENCHH));
+		bench("rotate90",    k->rotate90(dest, BENCHH*4, src, BENCHW, BENCHH, true));
+		bench("mirror",      k->mirror(dest, src, n));
+		bench("isOpaque",    k->isOpaque(src, n));
+		bench("over",        k->over(dest, src, n));
+		bench("scaleRow",    k->scaleRow(dest, src, src + BENCHW*4, xs, fxs, 96, n - BENCHW));
+	}
+	free(xs);
+	free(fxs);
+	free(src);
+	free(dest);
+	return 0;
+}
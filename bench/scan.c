@@ -0,0 +1,319 @@
+/* Measures how the images list scales with the size of the browsing directory. Directories of 1k
+   up to 1M entries, mostly images and some other files, are built on tmpfs and then scanned,
+   sorted, searched and watched while a burst of files is written into them. Nothing is decoded
+   and no window is opened. Built and run with "make bench" */
+
+// The sort is static, so the loader is built into the benchmark to time it on its own
+#include "loader.c"
+
+#include <malloc.h>      // mallinfo2
+#include <sys/vfs.h>     // statfs
+#include <linux/magic.h> // TMPFS_MAGIC
+#include <poll.h>        // poll
+#include <signal.h>      // kill, SIGKILL
+#include <sys/wait.h>    // waitpid
+
+#ifndef VERSION
+#define VERSION "unknown" // Passed by the makefile
+#endif
+
+#define SCANSETS     4
+#define LOOKUPS      100000 // Most names searched for, half of them missing
+#define BURSTSHARE   10     // A tenth of the directory is written again while watching
+#define WATCHCHUNK   1024   // Files written between watchImages calls, inotify queues 16384 events by default
+#define SORTBUDGET   10000  // Milliseconds the sort of already sorted names gets before it's given up on
+
+static const size_t setSizes[SCANSETS] = {1000, 10000, 100000, 1000000};
+
+/* Only headers are read while scanning, so each kind of file is the header of a 1x1 image, or text
+   that isn't an image at all */
+static const uint8_t jpegHeader[] = {
+	0xFF, 0xD8, 0xFF, 0xC0, 0x00, 0x11, 0x08, 0x00, 0x01, 0x00, 0x01, 0x03, 0x01, 0x22, 0x00, 0x02,
+	0x11, 0x01, 0x03, 0x11, 0x01,
+};
+static const uint8_t pngHeader[] = { // stb_image reads up to the first IDAT, so this one is whole
+	0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A, 0x00, 0x00, 0x00, 0x0D, 'I', 'H', 'D', 'R', 0x00, 0x00,
+	0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x08, 0x06, 0x00, 0x00, 0x00, 0x1F, 0x15, 0xC4, 0x89, 0x00, 0x00,
+	0x00, 0x0B, 'I', 'D', 'A', 'T', 0x78, 0x9C, 0x63, 0x60, 0x00, 0x02, 0x00, 0x00, 0x05, 0x00, 0x01, 0x7A,
+	0x5E, 0xAB, 0x3F, 0x00, 0x00, 0x00, 0x00, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82,
+};
+static const uint8_t gifHeader[] = {'G', 'I', 'F', '8', '9', 'a', 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t ptfHeader[] = {'P', 'T', 'F', 0x00, 0x00, 0x00};
+static const char    xmpText[]   = "<x:xmpmeta xmlns:x=\"adobe:ns:meta/\"></x:xmpmeta>\n";
+static const char    notesText[] = "Shot on a tripod, 1/250 at f/8\n";
+
+typedef struct {
+	const char *name; // printf format of the file name, given the number of the entry
+	const void *data;
+	size_t      sz;
+	bool        isImg;
+} Kind;
+
+// Entries cycle through the kinds, so three quarters of a directory are images
+static const Kind kinds[] = {
+	{"IMG_%07zu.jpg",        jpegHeader, sizeof(jpegHeader),    true},
+	{"DSC%07zu.JPG",         jpegHeader, sizeof(jpegHeader),    true},
+	{"photo %zu.jpeg",       jpegHeader, sizeof(jpegHeader),    true},
+	{"Screenshot_%07zu.png", pngHeader,  sizeof(pngHeader),     true},
+	{"anim-%zu.gif",         gifHeader,  sizeof(gifHeader),     true},
+	{"tile_%zu.ptf",         ptfHeader,  sizeof(ptfHeader),     true},
+	{"IMG_%07zu.xmp",        xmpText,    sizeof(xmpText) - 1,   false},
+	{"notes %zu.txt",        notesText,  sizeof(notesText) - 1, false},
+};
+
+static uint32_t seed = 1;
+
+static size_t randomIndex(size_t n) {
+	seed = seed*1103515245 + 12345;
+	uint32_t hi = seed >> 16;
+	seed = seed*1103515245 + 12345;
+	return (hi << 16 | seed >> 16)%n;
+}
+
+static void shuffle(size_t *arr, size_t n) {
+	for (size_t i = n; i > 1; --i) {
+		size_t j = randomIndex(i), tmp = arr[i - 1];
+		arr[i - 1] = arr[j];
+		arr[j]     = tmp;
+	}
+}
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+static void entryName(size_t i, char *buf) {
+	sprintf(buf, kinds[i%lenOf(kinds)].name, i);
+}
+
+static size_t countImages(size_t from, size_t to) {
+	size_t n = 0;
+	for (size_t i = from; i < to; ++i) n += kinds[i%lenOf(kinds)].isImg;
+	return n;
+}
+
+// Bytes the allocator has handed out and not gotten back
+static size_t heapInUse(void) {
+	return mallinfo2().uordblks;
+}
+
+static void writeFileAt(int dirfd, const char *name, const void *data, size_t sz) {
+	int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1 || write(fd, data, sz) != (ssize_t)sz) die("Failed to write %s: %s", name, strerror(errno));
+	close(fd);
+}
+
+/* Entries are hard links to one file per kind, so a million of them cost no more than their
+   directory entries. They're created in random order, tmpfs lists them in creation order */
+static void buildSet(const char *corpus, const char *dir, size_t n) {
+	if (mkdir(dir, 0700) != 0) die("Failed to create %s: %s", dir, strerror(errno));
+	size_t *order = alloc(size_t, n);
+	for (size_t i = 0; i < n; ++i) order[i] = i;
+	shuffle(order, n);
+
+	char src[PATH_MAX + 32], dest[PATH_MAX + 128], name[64];
+	for (size_t i = 0; i < n; ++i) {
+		entryName(order[i], name);
+		snprintf(src, sizeof(src), "%s/kind%zu", corpus, order[i]%lenOf(kinds));
+		snprintf(dest, sizeof(dest), "%s/%s", dir, name);
+		if (link(src, dest) != 0) die("Failed to link %s: %s", dest, strerror(errno));
+	}
+	free(order);
+}
+
+static void removeSet(const char *dir, size_t n) {
+	char path[PATH_MAX + 128], name[64];
+	for (size_t i = 0; i < n; ++i) {
+		entryName(i, name);
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		unlink(path);
+	}
+	rmdir(dir);
+}
+
+/* Writes or deletes entries from to to, letting the images list catch up every WATCHCHUNK files
+   the way the viewer does once a frame. Only the time spent in watchImages is returned */
+static double burst(Images *imgs, size_t from, size_t to, bool write) {
+	double ms = 0;
+	char   name[64];
+	for (size_t i = from; i < to; ) {
+		for (size_t end = i + WATCHCHUNK; i < to && i < end; ++i) {
+			const Kind *kind = &kinds[i%lenOf(kinds)];
+			entryName(i, name);
+			if (write) writeFileAt(imgs->dirfd, name, kind->data, kind->sz);
+			else if (unlinkat(imgs->dirfd, name, 0) != 0) die("Failed to delete %s: %s", name, strerror(errno));
+		}
+		double start = now();
+		Error  err   = watchImages(imgs);
+		ms += now() - start;
+		if (err != NULL) die("Failed to watch images: %s", err);
+	}
+	return ms;
+}
+
+typedef struct {
+	size_t entries, images, burst;
+	double scanMs, sortMs, sortedMs, lookupUs, missUs, treeLookupUs, ingestUs, removeUs;
+	size_t bytesPerImage;
+} Result;
+
+/* Sorts the already sorted names in a child process, which is killed once it runs over SORTBUDGET,
+   so a sort that got quadratic shows up as timed out instead of holding up the benchmark. Returns -1
+   if it timed out */
+static double sortSortedInChild(Images *imgs, Image **arr) {
+	int fds[2];
+	if (pipe(fds) != 0) die("Failed to create a pipe: %s", strerror(errno));
+	pid_t pid = fork();
+	if (pid == -1) die("Failed to fork: %s", strerror(errno));
+	if (pid == 0) {
+		close(fds[0]);
+		double start = now();
+		quicksortImages(imgs, arr, 0, imgs->sz - 1);
+		double ms = now() - start;
+		_exit(write(fds[1], &ms, sizeof(ms)) == sizeof(ms)? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(fds[1]);
+	double        ms = -1;
+	struct pollfd p  = {.fd = fds[0], .events = POLLIN};
+	if (poll(&p, 1, SORTBUDGET) != 1 || read(fds[0], &ms, sizeof(ms)) != sizeof(ms)) {
+		kill(pid, SIGKILL);
+		ms = -1;
+	}
+	waitpid(pid, NULL, 0);
+	close(fds[0]);
+	return ms;
+}
+
+static Result benchSet(const char *dir, size_t n) {
+	Result res = {.entries = n, .images = countImages(0, n), .burst = n/BURSTSHARE};
+
+	// tmpfs keeps everything in memory, so the first scan of a fresh directory is as cold as it gets
+	Images imgs;
+	size_t heap  = heapInUse();
+	double start = now();
+	Error  err   = initImages(&imgs, dir);
+	res.scanMs   = now() - start;
+	if (err != NULL) die("Failed to list %s: %s", dir, err);
+	if (imgs.sz != res.images) die("%zu images found in %s instead of %zu", imgs.sz, dir, res.images);
+	res.bytesPerImage = (heapInUse() - heap)/imgs.sz;
+
+	// The scan sorts in directory order, which is random here, the second run is on sorted names
+	Image **arr = alloc(Image*, imgs.sz);
+	for (size_t i = 0; i < imgs.sz; ++i) arr[i] = getImage(&imgs, i);
+	for (size_t i = imgs.sz; i > 1; --i) swapImages(arr, i - 1, randomIndex(i));
+	start      = now();
+	quicksortImages(&imgs, arr, 0, imgs.sz - 1);
+	res.sortMs   = now() - start;
+	res.sortedMs = sortSortedInChild(&imgs, arr);
+
+	// Searching by name takes paths like the command line gives them and normalizes them first
+	size_t lookups = imgs.sz < LOOKUPS/2? imgs.sz : LOOKUPS/2;
+	size_t *order  = alloc(size_t, imgs.sz);
+	for (size_t i = 0; i < imgs.sz; ++i) order[i] = i;
+	shuffle(order, imgs.sz);
+	char   path[PATH_MAX + 64];
+	int    idx;
+	start = now();
+	for (size_t i = 0; i < lookups; ++i) {
+		snprintf(path, sizeof(path), "%s%s", imgs.dir, arr[order[i]]->path);
+		if (!searchImageByName(&imgs, path, &idx)) die("%s wasn't found", path);
+	}
+	res.lookupUs = (now() - start)*1e3/lookups;
+	start = now();
+	for (size_t i = 0; i < lookups; ++i) {
+		snprintf(path, sizeof(path), "%smissing %zu.jpg", imgs.dir, order[i]);
+		if (searchImageByName(&imgs, path, &idx)) die("%s was found", path);
+	}
+	res.missUs = (now() - start)*1e3/lookups;
+	// The inotify events give names relative to the directory, those go straight to the tree
+	start = now();
+	for (size_t i = 0; i < lookups; ++i) searchNormalizedImage(&imgs, arr[order[i]]->path, &idx);
+	res.treeLookupUs = (now() - start)*1e3/lookups;
+	free(order);
+	free(arr);
+
+	// The burst gets the numbers after the directory's, its names land all over the sorted list
+	res.ingestUs = burst(&imgs, n, n + res.burst, true)*1e3/res.burst;
+	size_t added = countImages(n, n + res.burst);
+	if (imgs.sz != res.images + added)
+		die("%zu of %zu written images were picked up", imgs.sz - res.images, added);
+	res.removeUs = burst(&imgs, n, n + res.burst, false)*1e3/res.burst;
+	if (imgs.sz != res.images) die("%zu deleted images are still listed", imgs.sz - res.images);
+
+	freeImages(&imgs);
+	return res;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Usage: scanbench OUT.json [MAXENTRIES]\n");
+		return EXIT_FAILURE;
+	}
+	size_t maxEntries = argc == 3? strtoull(argv[2], NULL, 10) : setSizes[SCANSETS - 1];
+	FILE  *json       = fopen(argv[1], "w");
+	if (json == NULL) die("Failed to open %s: %s", argv[1], strerror(errno));
+
+	/* /dev/shm is tmpfs wherever it exists, but every link takes one of its inodes and it usually has
+	   fewer than a million, so TMPDIR goes first to point at a larger one */
+	const char *tmp = getenv("TMPDIR");
+	char        corpus[PATH_MAX];
+	struct stat st;
+	snprintf(corpus, sizeof(corpus), "%s/tinview-scan-XXXXXX", tmp != NULL? tmp :
+	         stat("/dev/shm", &st) == 0 && S_ISDIR(st.st_mode)? "/dev/shm" : "/tmp");
+	if (mkdtemp(corpus) == NULL) die("Failed to create %s: %s", corpus, strerror(errno));
+	struct statfs fs;
+	bool tmpfs = statfs(corpus, &fs) == 0 && fs.f_type == TMPFS_MAGIC;
+	if (!tmpfs) fprintf(stderr, "%s isn't on tmpfs, the scans measure its filesystem too\n", corpus);
+
+	char path[PATH_MAX + 32];
+	for (size_t k = 0; k < lenOf(kinds); ++k) {
+		snprintf(path, sizeof(path), "%s/kind%zu", corpus, k);
+		int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (fd == -1 || write(fd, kinds[k].data, kinds[k].sz) != (ssize_t)kinds[k].sz)
+			die("Failed to write %s: %s", path, strerror(errno));
+		close(fd);
+	}
+
+	fprintf(json, "{\n\t\"version\": \"%s\",\n\t\"tmpfs\": %s,\n\t\"results\": [", VERSION,
+	        tmpfs? "true" : "false");
+	printf("%8s %8s %10s %8s %10s %10s %8s %8s %8s %7s %8s %8s %8s\n", "entries", "images", "scan ms",
+	       "us/entry", "sort ms", "sorted ms", "find us", "miss us", "tree us", "burst", "add us", "del us",
+	       "B/image");
+	for (size_t s = 0; s < SCANSETS && setSizes[s] <= maxEntries; ++s) {
+		size_t n = setSizes[s];
+		if (statfs(corpus, &fs) == 0 && fs.f_files > 0 && fs.f_ffree < n + n/BURSTSHARE) {
+			fprintf(stderr, "Skipping %zu entries, %s has %zu free inodes\n", n, corpus, (size_t)fs.f_ffree);
+			break;
+		}
+		char   dir[PATH_MAX + 32];
+		snprintf(dir, sizeof(dir), "%s/%zu", corpus, n);
+		buildSet(corpus, dir, n);
+		Result r = benchSet(dir, n);
+		removeSet(dir, n);
+
+		char sorted[32] = "null";
+		if (r.sortedMs >= 0) snprintf(sorted, sizeof(sorted), "%.3f", r.sortedMs);
+		printf("%8zu %8zu %10.2f %8.3f %10.2f %10s %8.3f %8.3f %8.3f %7zu %8.3f %8.3f %8zu\n", r.entries,
+		       r.images, r.scanMs, r.scanMs*1e3/r.entries, r.sortMs, r.sortedMs >= 0? sorted : "timed out",
+		       r.lookupUs, r.missUs, r.treeLookupUs, r.burst, r.ingestUs, r.removeUs, r.bytesPerImage);
+		fprintf(json, "%s\n\t\t{\"entries\": %zu, \"images\": %zu, \"scanMs\": %.3f, \"scanUsPerEntry\": %.3f, "
+		        "\"sortMs\": %.3f, \"sortedSortMs\": %s, \"sortedTimedOut\": %s, \"lookupUs\": %.3f, "
+		        "\"missUs\": %.3f, \"treeLookupUs\": %.3f, \"burstFiles\": %zu, \"ingestUsPerFile\": %.3f, "
+		        "\"removeUsPerFile\": %.3f, \"bytesPerImage\": %zu}", s == 0? "" : ",", r.entries, r.images,
+		        r.scanMs, r.scanMs*1e3/r.entries, r.sortMs, sorted, r.sortedMs >= 0? "false" : "true",
+		        r.lookupUs, r.missUs, r.treeLookupUs, r.burst, r.ingestUs, r.removeUs, r.bytesPerImage);
+	}
+	fprintf(json, "\n\t]\n}\n");
+	fclose(json);
+
+	for (size_t k = 0; k < lenOf(kinds); ++k) {
+		snprintf(path, sizeof(path), "%s/kind%zu", corpus, k);
+		unlink(path);
+	}
+	rmdir(corpus);
+	printf("Results written to %s\n", argv[1]);
+	return 0;
+}
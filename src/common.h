@@ -30,6 +30,13 @@ void error_(bool msgBox, const char *type, const char *fn, const char *fmt, ...)
 void *alloc_(size_t sz);
 void *resize_(void *ptr, size_t sz);
 
+// C99 has no stdatomic.h, so use the GCC builtins
+#define atomicLoad(PTR)          __atomic_load_n(PTR, __ATOMIC_ACQUIRE)
+#define atomicStore(PTR, VAL)    __atomic_store_n(PTR, VAL, __ATOMIC_RELEASE)
+#define atomicAdd(PTR, VAL)      __atomic_fetch_add(PTR, VAL, __ATOMIC_ACQ_REL) // Returns the old value
+#define atomicCas(PTR, EXP, VAL) \
+	__atomic_compare_exchange_n(PTR, EXP, VAL, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
 const char *home(void);
 
 #endif
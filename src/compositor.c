@@ -0,0 +1,468 @@
+#include "render.h"
+
+/* Composites frames on the CPU straight into the window surface, for when SDL only has its software
+   renderer. Drawing is only recorded, present splits the window into bands of rows and draws them on
+   all cores at once, every band running the whole list clipped to its rows. Pixels are premultiplied
+   BGRA, the layout window surfaces almost always have, so drawing is copying and blending rows */
+
+#define BANDTHREADS 64 // Most threads drawing besides the presenting one
+#define BANDROWS    32 // Rows are handed out this many at a time
+
+enum {
+	CMDFILL = 0,
+	CMDCHECKERBOARD,
+	CMDCOPY,
+};
+
+typedef struct {
+	int      type;
+	SDL_Rect src, dest;
+	uint8_t  color[2][4]; // Premultiplied BGRA, the checkerboard uses both
+	bool     blend;
+	// Copies only, the texture can change after it's drawn
+	Texture *tex;
+	Rgba     mod;
+	bool     filtering, flip;
+	double   angle;
+	int      tile;
+} Command;
+
+typedef struct {
+	uint8_t *pxs;     // Premultiplied BGRA and a spare pixel, bilinear sampling reads past the last one
+	uint8_t *staging; // RGBA pixels given out by lockTexture
+	SDL_Rect locked;
+} CpuTexture;
+
+// Rows and tables a thread draws a band with, sized for the width of the window
+typedef struct {
+	uint8_t  *row, *color, *tiles[2];
+	int32_t  *xs;
+	uint16_t *fxs;
+} Scratch;
+
+static SDL_Window *win;
+
+static struct {
+	Command     *cmds;
+	int          count, cap;
+	uint8_t     *pxs; // Where bands are drawn
+	int          pitch, w, h;
+	SDL_Surface *aside; // Drawn into when the window surface has a layout other than BGRA
+	Scratch      scratch[BANDTHREADS + 1];
+	int          scratchw;
+	int          bands, nextBand;
+	uint64_t     presented;
+	bool         vsync;
+} frame;
+
+static struct {
+	pthread_t       ids[BANDTHREADS];
+	int             count;
+	pthread_mutex_t mutex;
+	pthread_cond_t  wake, done;
+	unsigned        generation;
+	int             busy;
+	bool            quit;
+} pool = {.mutex = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+          .done = PTHREAD_COND_INITIALIZER};
+
+static uint8_t mul255(int c, int a) {
+	return (c*a + 127)/255;
+}
+
+static void premultiplyColor(uint8_t *dest, Rgba color) {
+	dest[0] = mul255(color.b, color.a);
+	dest[1] = mul255(color.g, color.a);
+	dest[2] = mul255(color.r, color.a);
+	dest[3] = color.a;
+}
+
+static void fillPixels(uint8_t *dest, const uint8_t *px, int n) {
+	for (int i = 0; i < n; ++i) memcpy(dest + i*4, px, 4);
+}
+
+static Command *addCommand(int type) {
+	if (frame.count == frame.cap) resize(frame.cmds, frame.cap = frame.cap? frame.cap*2 : 64);
+	Command *cmd = &frame.cmds[frame.count++];
+	zeroMem(cmd);
+	cmd->type = type;
+	return cmd;
+}
+
+// Clips r to the columns of the frame and the rows from y0 to y1, returns false if nothing is left
+static bool clipRect(SDL_Rect r, int y0, int y1, int *x0, int *x1, int *ry0, int *ry1) {
+	*x0  = r.x > 0? r.x : 0;
+	*x1  = r.x + r.w < frame.w? r.x + r.w : frame.w;
+	*ry0 = r.y > y0? r.y : y0;
+	*ry1 = r.y + r.h < y1? r.y + r.h : y1;
+	return *x0 < *x1 && *ry0 < *ry1;
+}
+
+static void drawFillBand(const Command *cmd, Scratch *s, int y0, int y1) {
+	int x0, x1, ry0, ry1;
+	if (!clipRect(cmd->dest, y0, y1, &x0, &x1, &ry0, &ry1)) return;
+	int  n      = x1 - x0;
+	bool opaque = !cmd->blend || cmd->color[0][3] == 0xFF;
+	fillPixels(s->color, cmd->color[0], n);
+	for (int y = ry0; y < ry1; ++y) {
+		uint8_t *dest = frame.pxs + (size_t)y*frame.pitch + x0*4;
+		if (opaque) memcpy(dest, s->color, n*4);
+		else kernels.over(dest, s->color, n);
+	}
+}
+
+static void drawCheckerboardBand(const Command *cmd, Scratch *s, int y0, int y1) {
+	// Rows of tiles starting with either color
+	for (int t = 0; t < 2; ++t)
+		for (int x = 0; x < frame.w; x += cmd->tile) {
+			int n = x + cmd->tile < frame.w? cmd->tile : frame.w - x;
+			fillPixels(s->tiles[t] + x*4, cmd->color[(t + x/cmd->tile)%2], n);
+		}
+	for (int y = y0; y < y1; ++y)
+		memcpy(frame.pxs + (size_t)y*frame.pitch, s->tiles[y/cmd->tile%2], frame.w*4);
+}
+
+// Color and alpha modulation, like SDL does it
+static void modulateRow(uint8_t *pxs, int n, Rgba mod) {
+	uint8_t b = mod.b, g = mod.g, r = mod.r, a = mod.a;
+	for (int i = 0; i < n; ++i, pxs += 4) {
+		pxs[0] = mul255(mul255(pxs[0], b), a);
+		pxs[1] = mul255(mul255(pxs[1], g), a);
+		pxs[2] = mul255(mul255(pxs[2], r), a);
+		pxs[3] = mul255(pxs[3], a);
+	}
+}
+
+// Puts n pixels of a row of a copy on the frame, row can be changed if it's in the scratch
+static void putRow(const Command *cmd, Scratch *s, const uint8_t *row, int x, int y, int n) {
+	if (cmd->mod.r != 0xFF || cmd->mod.g != 0xFF || cmd->mod.b != 0xFF || cmd->mod.a != 0xFF) {
+		if (row != s->row) memcpy(s->row, row, n*4);
+		modulateRow(s->row, n, cmd->mod);
+		row = s->row;
+	}
+	uint8_t *dest = frame.pxs + (size_t)y*frame.pitch + x*4;
+	if (cmd->blend) kernels.over(dest, row, n);
+	else memcpy(dest, row, n*4);
+}
+
+/* Where a sample at t falls between texels, with the weight of the second one out of 256. Samples
+   outside of the first and last texel centers stick to them */
+static int sampleAt(double t, int len, uint16_t *f) {
+	double i = floor(t);
+	int    w = (t - i)*256 + 0.5;
+	if (i < 0)        i = 0,       w = 0;
+	if (i >= len - 1) i = len - 1, w = 0;
+	if (w == 256) ++i, w = 0;
+	*f = w;
+	return i;
+}
+
+// Copies without rotation or flips, scaled rows go through the kernels
+static void drawScaledBand(const Command *cmd, Scratch *s, int y0, int y1) {
+	int x0, x1, ry0, ry1;
+	if (!clipRect(cmd->dest, y0, y1, &x0, &x1, &ry0, &ry1)) return;
+	const Texture *tex = cmd->tex;
+	const uint8_t *pxs = ((CpuTexture*)tex->data)->pxs;
+	SDL_Rect src = cmd->src, dest = cmd->dest;
+	double   sx  = (double)src.w/dest.w, sy = (double)src.h/dest.h;
+	int      n   = x1 - x0;
+	// Without scaling, sampling between texels never happens
+	bool linear = cmd->filtering && (src.w != dest.w || src.h != dest.h);
+
+	for (int i = 0; i < n; ++i) {
+		double u = (x0 + i - dest.x + 0.5)*sx;
+		if (linear) s->xs[i] = src.x + sampleAt(u - 0.5, src.w, &s->fxs[i]);
+		else s->xs[i] = src.x + (u < src.w? (int)u : src.w - 1);
+	}
+	for (int y = ry0; y < ry1; ++y) {
+		double v = (y - dest.y + 0.5)*sy;
+		if (linear) {
+			uint16_t fy;
+			int      row = sampleAt(v - 0.5, src.h, &fy);
+			const uint8_t *a = pxs + (size_t)(src.y + row)*tex->w*4;
+			const uint8_t *b = row + 1 < src.h? a + (size_t)tex->w*4 : a;
+			kernels.scaleRow(s->row, a, b, s->xs, s->fxs, fy, n);
+			putRow(cmd, s, s->row, x0, y, n);
+			continue;
+		}
+		const uint8_t *a = pxs + (size_t)(src.y + (v < src.h? (int)v : src.h - 1))*tex->w*4;
+		if (src.w == dest.w) {
+			putRow(cmd, s, a + (size_t)s->xs[0]*4, x0, y, n);
+			continue;
+		}
+		for (int i = 0; i < n; ++i) memcpy(s->row + i*4, a + (size_t)s->xs[i]*4, 4);
+		putRow(cmd, s, s->row, x0, y, n);
+	}
+}
+
+/* Rotated or flipped copies map every pixel of the frame back onto the texture. The covered pixels
+   of a row are always one span, since the rotated rectangle is convex */
+static void drawTransformedBand(const Command *cmd, Scratch *s, int y0, int y1) {
+	const Texture *tex = cmd->tex;
+	const uint8_t *pxs = ((CpuTexture*)tex->data)->pxs;
+	SDL_Rect src = cmd->src, dest = cmd->dest;
+	double   rad = cmd->angle*M_PI/180, c = cos(rad), sn = sin(rad);
+	// Quarter turns are exact, so pixels don't land a hair outside of the rectangle
+	if (fabs(c)  < 1e-9) c  = 0;
+	if (fabs(sn) < 1e-9) sn = 0;
+	double cx = dest.x + dest.w/2.0, cy = dest.y + dest.h/2.0;
+	double ex = (fabs(dest.w*c) + fabs(dest.h*sn))/2, ey = (fabs(dest.w*sn) + fabs(dest.h*c))/2;
+	SDL_Rect box = {floor(cx - ex), floor(cy - ey), 0, 0};
+	box.w = ceil(cx + ex) - box.x;
+	box.h = ceil(cy + ey) - box.y;
+	int x0, x1, ry0, ry1;
+	if (!clipRect(box, y0, y1, &x0, &x1, &ry0, &ry1)) return;
+	double sx = (double)src.w/dest.w, sy = (double)src.h/dest.h;
+
+	for (int y = ry0; y < ry1; ++y) {
+		// Position in the unrotated rectangle, stepping along the row turns it back by the angle
+		double px = x0 + 0.5 - cx, py = y + 0.5 - cy;
+		double lx = px*c + py*sn + dest.w/2.0, ly = -px*sn + py*c + dest.h/2.0;
+		int    first = -1, last = -1;
+		for (int x = x0; x < x1; ++x, lx += c, ly -= sn) {
+			if (lx < 0 || ly < 0 || lx >= dest.w || ly >= dest.h) {
+				if (first >= 0) break;
+				continue;
+			}
+			if (first < 0) first = x;
+			last = x;
+			double   u = (cmd->flip? dest.w - lx : lx)*sx, v = ly*sy;
+			uint8_t *to = s->row + (x - first)*4;
+			if (cmd->filtering) {
+				uint16_t fy;
+				int      row = sampleAt(v - 0.5, src.h, &fy);
+				const uint8_t *a = pxs + (size_t)(src.y + row)*tex->w*4;
+				const uint8_t *b = row + 1 < src.h? a + (size_t)tex->w*4 : a;
+				int32_t xs = src.x + sampleAt(u - 0.5, src.w, &s->fxs[0]);
+				kernels.scaleRow(to, a, b, &xs, s->fxs, fy, 1);
+			} else {
+				int tx = u < src.w? (int)u : src.w - 1, ty = v < src.h? (int)v : src.h - 1;
+				memcpy(to, pxs + ((size_t)(src.y + ty)*tex->w + src.x + tx)*4, 4);
+			}
+		}
+		if (first >= 0) putRow(cmd, s, s->row, first, y, last - first + 1);
+	}
+}
+
+static void drawBand(Scratch *s, int y0, int y1) {
+	for (int i = 0; i < frame.count; ++i) {
+		const Command *cmd = &frame.cmds[i];
+		switch (cmd->type) {
+		case CMDFILL:         drawFillBand(cmd, s, y0, y1);         break;
+		case CMDCHECKERBOARD: drawCheckerboardBand(cmd, s, y0, y1); break;
+		case CMDCOPY:
+			if (cmd->angle == 0 && !cmd->flip) drawScaledBand(cmd, s, y0, y1);
+			else drawTransformedBand(cmd, s, y0, y1);
+			break;
+		}
+	}
+}
+
+static void drawBands(int thread) {
+	for (int band; (band = atomicAdd(&frame.nextBand, 1)) < frame.bands;) {
+		int y0 = band*BANDROWS, y1 = y0 + BANDROWS < frame.h? y0 + BANDROWS : frame.h;
+		drawBand(&frame.scratch[thread], y0, y1);
+	}
+}
+
+static void *bandThread(void *data) {
+	int      thread = (intptr_t)data;
+	unsigned seen   = 0;
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (pool.generation == seen && !pool.quit) pthread_cond_wait(&pool.wake, &pool.mutex);
+		if (pool.quit) break;
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.mutex);
+		drawBands(thread);
+		pthread_mutex_lock(&pool.mutex);
+		if (--pool.busy == 0) pthread_cond_signal(&pool.done);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	return NULL;
+}
+
+static void resizeScratch(int w) {
+	if (w <= frame.scratchw) return;
+	frame.scratchw = w;
+	for (int i = 0; i <= pool.count; ++i) {
+		Scratch *s = &frame.scratch[i];
+		resize(s->row,      (size_t)w*4);
+		resize(s->color,    (size_t)w*4);
+		resize(s->tiles[0], (size_t)w*4);
+		resize(s->tiles[1], (size_t)w*4);
+		resize(s->xs,       w);
+		resize(s->fxs,      w);
+	}
+}
+
+// Draws the recorded frame on every thread, the presenting one included
+static void drawFrame(uint8_t *pxs, int pitch, int w, int h) {
+	frame.pxs      = pxs;
+	frame.pitch    = pitch;
+	frame.w        = w;
+	frame.h        = h;
+	frame.bands    = (h + BANDROWS - 1)/BANDROWS;
+	frame.nextBand = 0;
+	resizeScratch(w);
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.busy = pool.count;
+	++pool.generation;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.mutex);
+	drawBands(0);
+	pthread_mutex_lock(&pool.mutex);
+	while (pool.busy > 0) pthread_cond_wait(&pool.done, &pool.mutex);
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/* The window surface has no vsync, so frames are held back to the refresh rate of the display.
+   The viewer draws continuously and would spin otherwise */
+static void waitForRefresh(void) {
+	if (!frame.vsync) return;
+	SDL_DisplayMode mode;
+	int hz = SDL_GetWindowDisplayMode(win, &mode) == 0 && mode.refresh_rate > 0? mode.refresh_rate : 60;
+	uint64_t interval = SDL_GetPerformanceFrequency()/hz, now = SDL_GetPerformanceCounter();
+	if (frame.presented != 0 && now - frame.presented < interval)
+		SDL_Delay((interval - (now - frame.presented))*1000/SDL_GetPerformanceFrequency());
+	frame.presented = SDL_GetPerformanceCounter();
+}
+
+static bool initCpu(SDL_Window *window, bool fallback, bool vsync) {
+	unused(fallback);
+	win         = window;
+	frame.vsync = vsync;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (threads > BANDTHREADS) threads = BANDTHREADS;
+	for (; pool.count < threads; ++pool.count)
+		if (pthread_create(&pool.ids[pool.count], NULL, bandThread, (void*)(intptr_t)(pool.count + 1)) != 0)
+			break;
+	return true;
+}
+
+// Textures are plain memory
+static int maxCpuTextureSize(void) {
+	return INT32_MAX;
+}
+
+static void quitCpu(void) {
+	pthread_mutex_lock(&pool.mutex);
+	pool.quit = true;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.mutex);
+	for (int i = 0; i < pool.count; ++i) pthread_join(pool.ids[i], NULL);
+	for (int i = 0; i <= pool.count; ++i) {
+		Scratch *s = &frame.scratch[i];
+		free(s->row);
+		free(s->color);
+		free(s->tiles[0]);
+		free(s->tiles[1]);
+		free(s->xs);
+		free(s->fxs);
+	}
+	if (frame.aside != NULL) SDL_FreeSurface(frame.aside);
+	free(frame.cmds);
+}
+
+static void createCpuTexture(Texture *tex) {
+	CpuTexture *ct = alloc(CpuTexture, 1);
+	zeroMem(ct);
+	size_t n = (size_t)tex->w*tex->h;
+	ct->pxs = alloc(uint8_t, (n + 1)*4);
+	memset(ct->pxs + n*4, 0, 4);
+	tex->data = ct;
+}
+
+static void destroyCpuTexture(Texture *tex) {
+	CpuTexture *ct = tex->data;
+	free(ct->pxs);
+	free(ct->staging);
+	free(ct);
+}
+
+static void updateCpuTexture(Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch) {
+	CpuTexture *ct = tex->data;
+	for (int y = 0; y < r->h; ++y) {
+		uint8_t *dest = ct->pxs + ((size_t)(r->y + y)*tex->w + r->x)*4;
+		kernels.swapRb(dest, pxs + (size_t)y*pitch, r->w);
+		kernels.premultiply(dest, r->w);
+	}
+}
+
+static bool lockCpuTexture(Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch) {
+	CpuTexture *ct = tex->data;
+	resize(ct->staging, (size_t)r->w*r->h*4);
+	ct->locked = *r;
+	*pxs       = ct->staging;
+	*pitch     = r->w*4;
+	return true;
+}
+
+static void unlockCpuTexture(Texture *tex) {
+	CpuTexture *ct = tex->data;
+	updateCpuTexture(tex, &ct->locked, ct->staging, ct->locked.w*4);
+}
+
+static void fillCpu(const SDL_Rect *r, Rgba color, bool blend) {
+	Command *cmd = addCommand(CMDFILL);
+	cmd->dest  = r != NULL? *r : (SDL_Rect){0, 0, INT32_MAX/2, INT32_MAX/2};
+	cmd->blend = blend;
+	premultiplyColor(cmd->color[0], color);
+}
+
+static void checkerboardCpu(int tile, Rgba even, Rgba odd) {
+	Command *cmd = addCommand(CMDCHECKERBOARD);
+	cmd->tile = tile;
+	even.a = odd.a = 0xFF;
+	premultiplyColor(cmd->color[0], even);
+	premultiplyColor(cmd->color[1], odd);
+}
+
+static void copyCpu(Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle, bool flip) {
+	if (src->w <= 0 || src->h <= 0 || dest->w <= 0 || dest->h <= 0) return;
+	Command *cmd = addCommand(CMDCOPY);
+	cmd->src       = *src;
+	cmd->dest      = *dest;
+	cmd->tex       = tex;
+	cmd->blend     = tex->blend;
+	cmd->mod       = tex->mod;
+	cmd->filtering = tex->filtering;
+	cmd->angle     = angle;
+	cmd->flip      = flip;
+}
+
+static void presentCpu(void) {
+	SDL_Surface *surf = SDL_GetWindowSurface(win);
+	if (surf == NULL) {
+		error("Failed to get window surface: %s", SDL_GetError());
+		frame.count = 0;
+		return;
+	}
+
+	// Little-endian ARGB is BGRA in memory, anything else is drawn aside and converted by SDL
+	Uint32 format = surf->format->format;
+	if (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888) {
+		if (SDL_MUSTLOCK(surf)) SDL_LockSurface(surf);
+		drawFrame(surf->pixels, surf->pitch, surf->w, surf->h);
+		if (SDL_MUSTLOCK(surf)) SDL_UnlockSurface(surf);
+	} else {
+		if (frame.aside == NULL || frame.aside->w != surf->w || frame.aside->h != surf->h) {
+			if (frame.aside != NULL) SDL_FreeSurface(frame.aside);
+			if ((frame.aside = SDL_CreateRGBSurfaceWithFormat(0, surf->w, surf->h, 32,
+			                                                 SDL_PIXELFORMAT_ARGB8888)) == NULL)
+				die("Failed to create surface: %s", SDL_GetError());
+		}
+		drawFrame(frame.aside->pixels, frame.aside->pitch, frame.aside->w, frame.aside->h);
+		SDL_BlitSurface(frame.aside, NULL, surf, NULL);
+	}
+	frame.count = 0;
+
+	if (SDL_UpdateWindowSurface(win) != 0) error("Failed to update window surface: %s", SDL_GetError());
+	waitForRefresh();
+}
+
+const RenderBackend cpuBackend = {
+	"cpu", initCpu, quitCpu, maxCpuTextureSize, createCpuTexture, destroyCpuTexture, updateCpuTexture,
+	lockCpuTexture, unlockCpuTexture, fillCpu, checkerboardCpu, copyCpu, presentCpu,
+};
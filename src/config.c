@@ -1,42 +1,47 @@
 #include "config.h"
 
 #define DEFAULTCONF \
-	"[window]\n"                                       \
-	"fullscreen   = false # false/true\n"              \
-	"size.startup = 640x480\n"                         \
-	"size.min     = 64x64\n"                           \
-	"\n"                                               \
-	"[camera]\n"                                       \
-	"damping  = 0.02 # Per millisecond\n"              \
-	"zoom.max = 200\n"                                 \
-	"zoom.min = 0.01\n"                                \
-	"zoom.in  = 0.2\n"                                 \
-	"zoom.out = 0.2\n"                                 \
-	"\n"                                               \
-	"[image]\n"                                        \
-	"anim-time     = 200     # In milliseconds\n"      \
-	"filtering     = auto    # auto/linear/nearest\n"  \
-	"border        = shadow  # shadow/outline/none\n"  \
-	"fit-on-resize = default # default/integer/none\n" \
-	"\n"                                               \
-	"[colors]\n"                                       \
-	"checkerboard.a = 363636FF # Opacity ignored\n"    \
-	"checkerboard.b = 424242FF # Opacity ignored\n"    \
-	"icons          = FFFFFFFF\n"                      \
-	"darkening      = 00000050\n"                      \
-	"outline        = 00000080\n"                      \
-	"\n"                                               \
-	"[controls]\n"                                     \
+	"[window]\n"                                        \
+	"fullscreen      = false # false/true\n"            \
+	"size.startup    = 640x480\n"                       \
+	"size.min        = 64x64\n"                         \
+	"single-instance = false # false/true\n"            \
+	"renderer        = auto  # auto/sdl/cpu/opengl\n"   \
+	"\n"                                                \
+	"[camera]\n"                                        \
+	"damping  = 0.02 # Per millisecond\n"               \
+	"zoom.max = 200\n"                                  \
+	"zoom.min = 0.01\n"                                 \
+	"zoom.in  = 0.2\n"                                  \
+	"zoom.out = 0.2\n"                                  \
+	"\n"                                                \
+	"[image]\n"                                         \
+	"anim-time     = 200      # In milliseconds\n"      \
+	"filtering     = auto     # auto/linear/nearest\n"  \
+	"border        = shadow   # shadow/outline/none\n"  \
+	"fit-on-resize = default  # default/integer/none\n" \
+	"reload        = animated # animated/watch\n"       \
+	"\n"                                                \
+	"[colors]\n"                                        \
+	"checkerboard.a = 363636FF # Opacity ignored\n"     \
+	"checkerboard.b = 424242FF # Opacity ignored\n"     \
+	"icons          = FFFFFFFF\n"                       \
+	"darkening      = 00000050\n"                       \
+	"outline        = 00000080\n"                       \
+	"\n"                                                \
+	"[controls]\n"                                      \
 	"double-click-time = 300 # In milliseconds\n"
 
 
 Config conf = {
 	.win = {
-		.fullscr = false,
-		.startw  = 640,
-		.starth  = 480,
-		.minw    = 128,
-		.minh    = 128,
+		.fullscr        = false,
+		.singleInstance = false,
+		.startw         = 640,
+		.starth         = 480,
+		.minw           = 128,
+		.minh           = 128,
+		.renderer       = RENDERERAUTO,
 	},
 	.cam = {
 		.damping = 0.02,
@@ -50,6 +55,7 @@ Config conf = {
 		.filter      = FILTERAUTO,
 		.border      = BORDERSHADOW,
 		.fitOnResize = FITDEFAULT,
+		.reload      = RELOADANIMATED,
 	},
 	.colors = {
 		.checkerboard = {{0x36, 0x36, 0x36, 0xFF}, {0x42, 0x42, 0x42, 0xFF}},
@@ -77,6 +83,14 @@ static const char *boolStrs[] = {
 	[FITDEFAULT] = "default",
 	[FITINT]     = "integer",
 	[FITNONE]    = "none",
+}, *reloadStrs[RELOADCOUNT] = {
+	[RELOADANIMATED] = "animated",
+	[RELOADWATCH]    = "watch",
+}, *rendererStrs[RENDERERCOUNT] = {
+	[RENDERERAUTO]   = "auto",
+	[RENDERERSDL]    = "sdl",
+	[RENDERERCPU]    = "cpu",
+	[RENDEREROPENGL] = "opengl",
 };
 
 #define parseEnum(VAL, RES, ARR) parseEnum_(VAL, RES, ARR, lenOf(ARR))
@@ -143,9 +157,11 @@ static Error hook(char *sect, char *key, char *val, void *data) {
 
 #define parseRule(KEY, FN, ...) if (strcmp(key, KEY) == 0) return FN(val, __VA_ARGS__)
 	if (strcmp(sect, "window") == 0) {
-		parseRule("fullscreen",   parseBool, &conf.win.fullscr);
-		parseRule("size.startup", parseSize, &conf.win.startw, &conf.win.starth);
-		parseRule("size.min",     parseSize, &conf.win.minw,   &conf.win.minh);
+		parseRule("fullscreen",      parseBool, &conf.win.fullscr);
+		parseRule("size.startup",    parseSize, &conf.win.startw, &conf.win.starth);
+		parseRule("size.min",        parseSize, &conf.win.minw,   &conf.win.minh);
+		parseRule("single-instance", parseBool, &conf.win.singleInstance);
+		parseRule("renderer",        parseEnum, &conf.win.renderer, rendererStrs);
 	} else if (strcmp(sect, "camera") == 0) {
 		parseRule("damping",  parseNumber, &conf.cam.damping);
 		parseRule("zoom.max", parseNumber, &conf.cam.zoomMax);
@@ -157,6 +173,7 @@ static Error hook(char *sect, char *key, char *val, void *data) {
 		parseRule("filtering",     parseEnum,   &conf.img.filter,      filterStrs);
 		parseRule("border",        parseEnum,   &conf.img.border,      borderStrs);
 		parseRule("fit-on-resize", parseEnum,   &conf.img.fitOnResize, fitStrs);
+		parseRule("reload",        parseEnum,   &conf.img.reload,      reloadStrs);
 	} else if (strcmp(sect, "colors") == 0) {
 		parseRule("checkerboard.a", parseRgba, &conf.colors.checkerboard[0]);
 		parseRule("checkerboard.b", parseRgba, &conf.colors.checkerboard[1]);
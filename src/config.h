@@ -15,6 +15,14 @@ typedef struct {
 	int r, g, b, a;
 } Rgba;
 
+enum {
+	RENDERERAUTO = 0,
+	RENDERERSDL,
+	RENDERERCPU,
+	RENDEREROPENGL,
+	RENDERERCOUNT,
+};
+
 enum {
 	FILTERAUTO = 0,
 	FILTERLINEAR,
@@ -36,17 +44,23 @@ enum {
 	FITCOUNT,
 };
 
+enum {
+	RELOADANIMATED = 0,
+	RELOADWATCH,
+	RELOADCOUNT,
+};
+
 typedef struct {
 	struct { // [window]
-		bool fullscr;
-		int  startw, starth, minw, minh;
+		bool fullscr, singleInstance;
+		int  startw, starth, minw, minh, renderer;
 	} win;
 	struct { // [camera]
 		double damping, zoomMax, zoomMin, zoomIn, zoomOut;
 	} cam;
 	struct { // [image]
 		double animTime;
-		int    filter, border, fitOnResize;
+		int    filter, border, fitOnResize, reload;
 	} img;
 	struct { // [colors]
 		Rgba checkerboard[2], icons, darken, outline;
@@ -0,0 +1,158 @@
+#include "instance.h"
+
+#define INSTANCETIMEOUT 50 // In milliseconds, the longest a connected invocation can hold up a frame
+
+static Error getSocketAddr(struct sockaddr_un *addr) {
+	zeroMem(addr);
+	addr->sun_family = AF_UNIX;
+
+	/* The runtime directory belongs to the user and no one else can get in, a shared directory like
+	   /tmp would let other users take the socket's name or send paths to it */
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	if (dir == NULL || !*dir) return "XDG_RUNTIME_DIR isn't set, so single-instance mode is unavailable";
+	int cap = sizeof(addr->sun_path);
+	if (snprintf(addr->sun_path, cap, "%s/tinview.sock", dir) >= cap) return "Socket path is too long";
+	return NULL;
+}
+
+static int connectToInstance(struct sockaddr_un *addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) return -1;
+	if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Same as the images list does it, only the parent directory gets resolved and the name is kept
+static bool absolutePath(const char *path, char *buf) {
+	char        dirPath[PATH_MAX];
+	const char *name = strrchr(path, '/');
+	if (name == NULL) {
+		strcpy(dirPath, ".");
+		name = path;
+	} else {
+		size_t len = name == path? 1 : (size_t)(name - path);
+		memcpy(dirPath, path, len);
+		dirPath[len] = 0;
+		++name;
+	}
+
+	if (realpath(dirPath, buf) == NULL) return false;
+	size_t len = strlen(buf);
+	if (len + strlen(name) + 2 > PATH_MAX) return false;
+	if (buf[len - 1] != '/') strcat(buf, "/");
+	strcat(buf, name);
+	return true;
+}
+
+static bool writeAll(int fd, const char *buf, size_t sz) {
+	while (sz > 0) {
+		ssize_t n = write(fd, buf, sz);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR) continue;
+			return false;
+		}
+		buf += n;
+		sz  -= n;
+	}
+	return true;
+}
+
+bool sendToInstance(const char **paths, int count) {
+	// Paths that can't be resolved are left for this process to report
+	char *absPaths = alloc(char, count*PATH_MAX);
+	for (int i = 0; i < count; ++i) {
+		if (!absolutePath(paths[i], absPaths + i*PATH_MAX)) {
+			free(absPaths);
+			return false;
+		}
+	}
+
+	struct sockaddr_un addr;
+	int                fd = -1;
+	if (getSocketAddr(&addr) == NULL) fd = connectToInstance(&addr);
+	bool sent = fd != -1;
+	for (int i = 0; i < count && sent; ++i)
+		sent = writeAll(fd, absPaths + i*PATH_MAX, strlen(absPaths + i*PATH_MAX) + 1);
+	if (fd != -1) close(fd);
+	free(absPaths);
+	return sent;
+}
+
+Error listenInstance(Instance *inst) {
+	inst->fd = -1;
+	Error err = getSocketAddr(&inst->addr);
+	if (err != NULL) return err;
+
+	/* Launches that aren't handed over, like browsing a directory or playing, still get here while
+	   another viewer listens. They run as plain viewers then */
+	int fd = connectToInstance(&inst->addr);
+	if (fd != -1) {
+		close(fd);
+		return NULL;
+	}
+	// A socket nobody is listening on was left behind by a viewer that crashed
+	unlink(inst->addr.sun_path);
+
+	if ((inst->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+		return strerror(errno);
+	if (bind(inst->fd, (struct sockaddr*)&inst->addr, sizeof(inst->addr)) != 0 ||
+	    listen(inst->fd, 8) != 0) {
+		err = strerror(errno);
+		close(inst->fd);
+		inst->fd = -1;
+		return err;
+	}
+	return NULL;
+}
+
+void closeInstance(Instance *inst) {
+	if (inst->fd == -1) return;
+	close(inst->fd);
+	unlink(inst->addr.sun_path);
+	inst->fd = -1;
+}
+
+static int64_t getMilliseconds(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
+
+char *acceptInstance(Instance *inst) {
+	if (inst->fd == -1) return NULL;
+	int fd = accept(inst->fd, NULL, NULL);
+	if (fd == -1) return NULL;
+
+	/* The invocation writes everything and quits right away, a client that doesn't is cut off once
+	   INSTANCETIMEOUT has passed since the connection, no matter how it trickles its data in */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	int64_t deadline = getMilliseconds() + INSTANCETIMEOUT;
+	size_t  sz = 0, cap = PATH_MAX;
+	char   *buf = alloc(char, cap + 1);
+	for (;;) {
+		if (sz == cap) resize(buf, (cap *= 2) + 1);
+		ssize_t n = read(fd, buf + sz, cap - sz);
+		if (n > 0) {
+			sz += n;
+			continue;
+		}
+		if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) break;
+		int64_t left = deadline - getMilliseconds();
+		if (left <= 0) break;
+		struct pollfd p = {.fd = fd, .events = POLLIN};
+		poll(&p, 1, (int)left);
+	}
+	close(fd);
+
+	// A path cut off by the timeout is dropped
+	while (sz > 0 && buf[sz - 1] != 0) --sz;
+	if (sz == 0) {
+		free(buf);
+		return NULL;
+	}
+	buf[sz] = 0;
+	return buf;
+}
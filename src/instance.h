@@ -0,0 +1,34 @@
+#ifndef INSTANCE_H_HEADER_GUARD
+#define INSTANCE_H_HEADER_GUARD
+
+#include <stdio.h>        // snprintf
+#include <stdlib.h>       // getenv, realpath
+#include <stdbool.h>      // bool, true, false
+#include <stdint.h>       // int64_t
+#include <string.h>       // strerror, strlen, strrchr, strcpy, strcat, memcpy
+#include <errno.h>        // errno
+#include <unistd.h>       // close, unlink, read, write
+#include <fcntl.h>        // fcntl, F_GETFL, F_SETFL, O_NONBLOCK
+#include <poll.h>         // poll
+#include <time.h>         // clock_gettime, CLOCK_MONOTONIC
+#include <sys/socket.h>   // socket, connect, bind, listen, accept
+#include <sys/un.h>       // sockaddr_un
+#include <linux/limits.h> // PATH_MAX
+
+#include "common.h"
+
+/* Single-instance mode, a running viewer listens on a Unix socket and later invocations hand their
+   image paths to it instead of starting up. Paths are sent as absolute, null terminated strings */
+typedef struct {
+	int                fd; // -1 if not listening
+	struct sockaddr_un addr;
+} Instance;
+
+// Returns true if a running viewer took the images, so this process can exit
+bool  sendToInstance(const char **paths, int count);
+Error listenInstance(Instance *inst); // Doesn't listen if another viewer already does
+void  closeInstance (Instance *inst);
+// Returns the paths sent by another invocation, ended by an empty string, or NULL if there are none
+char *acceptInstance(Instance *inst);
+
+#endif
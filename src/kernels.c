@@ -0,0 +1,626 @@
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNELSX86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define KERNELSARM
+#include <arm_neon.h>
+#endif
+
+/* Scalar kernels, also used for whatever the vector versions leave over at the end of a row */
+
+static uint32_t loadPixel(const uint8_t *src) {
+	uint32_t px;
+	memcpy(&px, src, 4);
+	return px;
+}
+
+static void storePixel(uint8_t *dest, uint32_t px) {
+	memcpy(dest, &px, 4);
+}
+
+static void rgbToRgbaScalar(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// 4 pixels are 3 words, which only need to be shifted into place
+	for (; i + 4 <= n; i += 4, src += 12, dest += 16) {
+		uint32_t a = loadPixel(src), b = loadPixel(src + 4), c = loadPixel(src + 8);
+		storePixel(dest,      a                 | 0xFF000000);
+		storePixel(dest + 4,  a >> 24 | b <<  8 | 0xFF000000);
+		storePixel(dest + 8,  b >> 16 | c << 16 | 0xFF000000);
+		storePixel(dest + 12, c >>  8           | 0xFF000000);
+	}
+#endif
+	for (; i < n; ++i, src += 3, dest += 4) {
+		dest[0] = src[0];
+		dest[1] = src[1];
+		dest[2] = src[2];
+		dest[3] = 0xFF;
+	}
+}
+
+static void swapRbScalar(uint8_t *dest, const uint8_t *src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 4, dest += 4) {
+		uint8_t r = src[0], g = src[1], b = src[2], a = src[3];
+		dest[0] = b;
+		dest[1] = g;
+		dest[2] = r;
+		dest[3] = a;
+	}
+}
+
+// round(c*a/255) without a division
+#define mulDiv255(C, A) ((((C)*(A) + 128) + (((C)*(A) + 128) >> 8)) >> 8)
+
+static void premultiplyScalar(uint8_t *pxs, size_t n) {
+	for (size_t i = 0; i < n; ++i, pxs += 4) {
+		unsigned a = pxs[3];
+		pxs[0] = mulDiv255(pxs[0], a);
+		pxs[1] = mulDiv255(pxs[1], a);
+		pxs[2] = mulDiv255(pxs[2], a);
+	}
+}
+
+static void downscale2xRow(uint8_t *dest, const uint8_t *a, const uint8_t *b, int from, int to) {
+	for (int x = from; x < to; ++x)
+		for (int c = 0; c < 4; ++c)
+			dest[x*4 + c] = (a[x*8 + c] + a[x*8 + 4 + c] + b[x*8 + c] + b[x*8 + 4 + c] + 2) >> 2;
+}
+
+static void downscale2xScalar(uint8_t *dest, const uint8_t *src, int w, int h) {
+	for (int y = 0; y < h/2; ++y) {
+		const uint8_t *a = src + (size_t)y*2*w*4;
+		downscale2xRow(dest + (size_t)y*(w/2)*4, a, a + (size_t)w*4, 0, w/2);
+	}
+}
+
+// Where the source pixel at x, y ends up in the rotated image
+#define rotatedAt(DEST, PITCH, W, H, CW, X, Y)                  \
+	((CW)? (DEST) + (size_t)(X)*(PITCH) + ((H) - 1 - (Y))*4 \
+	     : (DEST) + (size_t)((W) - 1 - (X))*(PITCH) + (Y)*4)
+
+static void rotate90Block(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw,
+                          int x0, int x1, int y0, int y1) {
+	for (int y = y0; y < y1; ++y)
+		for (int x = x0; x < x1; ++x)
+			memcpy(rotatedAt(dest, pitch, w, h, cw, x, y), src + ((size_t)y*w + x)*4, 4);
+}
+
+#define ROTATETILE 64 // A 64x64 tile of the source and of the destination both fit in the L1 cache
+
+typedef void RotateTile(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw,
+                        int x0, int x1, int y0, int y1);
+
+/* Columns of the source become rows of the destination, so going over the image tile by tile keeps
+   the destination rows cached until they're filled. Tiles only get whole 4x4 blocks, the edges
+   that are left over go through rotate90Block */
+static void rotate90Tiled(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw,
+                          RotateTile *tile) {
+	int bw = w/4*4, bh = h/4*4;
+	for (int y = 0; y < bh; y += ROTATETILE)
+		for (int x = 0; x < bw; x += ROTATETILE)
+			tile(dest, pitch, src, w, h, cw, x, x + ROTATETILE < bw? x + ROTATETILE : bw,
+			     y, y + ROTATETILE < bh? y + ROTATETILE : bh);
+	rotate90Block(dest, pitch, src, w, h, cw, bw, w, 0, h);
+	rotate90Block(dest, pitch, src, w, h, cw, 0, bw, bh, h);
+}
+
+static void rotate90Scalar(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw) {
+	rotate90Tiled(dest, pitch, src, w, h, cw, rotate90Block);
+}
+
+static void mirrorScalar(uint8_t *dest, const uint8_t *src, size_t n) {
+	for (size_t i = 0; i < n; ++i) memcpy(dest + i*4, src + (n - 1 - i)*4, 4);
+}
+
+static bool isOpaqueScalar(const uint8_t *pxs, size_t n) {
+	uint8_t alpha = 0xFF;
+	for (size_t i = 0; i < n; ++i) alpha &= pxs[i*4 + 3];
+	return alpha == 0xFF;
+}
+
+static void overScalar(uint8_t *dest, const uint8_t *src, size_t n) {
+	for (size_t i = 0; i < n; ++i, src += 4, dest += 4) {
+		unsigned inv = 255 - src[3];
+		for (int c = 0; c < 4; ++c) {
+			unsigned v = src[c] + mulDiv255(dest[c], inv);
+			dest[c] = v > 255? 255 : v;
+		}
+	}
+}
+
+// Each pass rounds back to 8 bits, so the vector versions never need more than 16
+static void scaleRowScalar(uint8_t *dest, const uint8_t *a, const uint8_t *b, const int32_t *xs,
+                           const uint16_t *fxs, int fy, size_t n) {
+	for (size_t i = 0; i < n; ++i, dest += 4) {
+		const uint8_t *pa = a + (size_t)xs[i]*4, *pb = b + (size_t)xs[i]*4;
+		unsigned       fx = fxs[i];
+		for (int c = 0; c < 4; ++c) {
+			unsigned top = (pa[c]*(256 - fx) + pa[c + 4]*fx + 128) >> 8;
+			unsigned bot = (pb[c]*(256 - fx) + pb[c + 4]*fx + 128) >> 8;
+			dest[c] = (top*(256 - fy) + bot*fy + 128) >> 8;
+		}
+	}
+}
+
+static const Kernels scalarKernels = {
+	"scalar", rgbToRgbaScalar, swapRbScalar, premultiplyScalar, downscale2xScalar, rotate90Scalar,
+	mirrorScalar, isOpaqueScalar, overScalar, scaleRowScalar,
+};
+
+#ifdef KERNELSX86
+
+/* SSE2. It has no byte shuffle, so channel expansion stays scalar */
+
+__attribute__((target("sse2")))
+static void swapRbSse2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m128i ga = _mm_set1_epi32(0xFF00FF00), rb = _mm_set1_epi32(0x00FF00FF);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + i*4)), c = _mm_and_si128(v, rb);
+		c = _mm_or_si128(_mm_slli_epi32(c, 16), _mm_srli_epi32(c, 16));
+		_mm_storeu_si128((__m128i*)(dest + i*4), _mm_or_si128(_mm_and_si128(v, ga), c));
+	}
+	swapRbScalar(dest + i*4, src + i*4, n - i);
+}
+
+// Premultiplies 2 pixels widened to 16 bits, alpha is multiplied by 255 so it stays the same
+__attribute__((target("sse2")))
+static __m128i premultiply16Sse2(__m128i v) {
+	const __m128i rgb = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	const __m128i one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xFF), 0xFF);
+	a = _mm_or_si128(_mm_and_si128(a, rgb), one);
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(v, a), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void premultiplySse2(uint8_t *pxs, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i v  = _mm_loadu_si128((const __m128i*)(pxs + i*4));
+		__m128i lo = premultiply16Sse2(_mm_unpacklo_epi8(v, zero));
+		__m128i hi = premultiply16Sse2(_mm_unpackhi_epi8(v, zero));
+		_mm_storeu_si128((__m128i*)(pxs + i*4), _mm_packus_epi16(lo, hi));
+	}
+	premultiplyScalar(pxs + i*4, n - i);
+}
+
+__attribute__((target("sse2")))
+static void downscale2xSse2(uint8_t *dest, const uint8_t *src, int w, int h) {
+	const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+	for (int y = 0; y < h/2; ++y) {
+		const uint8_t *a = src + (size_t)y*2*w*4, *b = a + (size_t)w*4;
+		uint8_t       *d = dest + (size_t)y*(w/2)*4;
+		int x = 0;
+		// 4 pixels of both rows make 2
+		for (; x + 2 <= w/2; x += 2) {
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + x*8));
+			__m128i vb = _mm_loadu_si128((const __m128i*)(b + x*8));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+			__m128i s  = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+			_mm_storel_epi64((__m128i*)(d + x*4), _mm_packus_epi16(s, s));
+		}
+		downscale2xRow(d, a, b, x, w/2);
+	}
+}
+
+// Rotates 4x4 pixel blocks, transposed with unpacks and reversed for clockwise
+__attribute__((target("sse2")))
+static void rotate90TileSse2(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw,
+                             int x0, int x1, int y0, int y1) {
+	for (int y = y0; y < y1; y += 4)
+		for (int x = x0; x < x1; x += 4) {
+			const uint8_t *s = src + ((size_t)y*w + x)*4;
+			__m128i r0 = _mm_loadu_si128((const __m128i*)s);
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(s + (size_t)w*4));
+			__m128i r2 = _mm_loadu_si128((const __m128i*)(s + (size_t)w*8));
+			__m128i r3 = _mm_loadu_si128((const __m128i*)(s + (size_t)w*12));
+			__m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpackhi_epi32(r0, r1);
+			__m128i t2 = _mm_unpacklo_epi32(r2, r3), t3 = _mm_unpackhi_epi32(r2, r3);
+			__m128i cols[4] = {
+				_mm_unpacklo_epi64(t0, t2), _mm_unpackhi_epi64(t0, t2),
+				_mm_unpacklo_epi64(t1, t3), _mm_unpackhi_epi64(t1, t3),
+			};
+			// Clockwise, the last of the 4 rows ends up first
+			for (int i = 0; i < 4; ++i) {
+				uint8_t *to  = rotatedAt(dest, pitch, w, h, cw, x + i, cw? y + 3 : y);
+				__m128i  col = cw? _mm_shuffle_epi32(cols[i], _MM_SHUFFLE(0, 1, 2, 3)) : cols[i];
+				_mm_storeu_si128((__m128i*)to, col);
+			}
+		}
+}
+
+__attribute__((target("sse2")))
+static void rotate90Sse2(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw) {
+	rotate90Tiled(dest, pitch, src, w, h, cw, rotate90TileSse2);
+}
+
+__attribute__((target("sse2")))
+static void mirrorSse2(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + (n - 4 - i)*4));
+		_mm_storeu_si128((__m128i*)(dest + i*4), _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3)));
+	}
+	mirrorScalar(dest + i*4, src, n - i);
+}
+
+__attribute__((target("sse2")))
+static bool isOpaqueSse2(const uint8_t *pxs, size_t n) {
+	__m128i acc = _mm_set1_epi8(-1);
+	size_t  i   = 0;
+	for (; i + 4 <= n; i += 4) acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i*)(pxs + i*4)));
+	acc = _mm_or_si128(acc, _mm_set1_epi32(0x00FFFFFF));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_set1_epi8(-1))) != 0xFFFF) return false;
+	return isOpaqueScalar(pxs + i*4, n - i);
+}
+
+// dest*(255 - alpha of src) for 2 pixels widened to 16 bits
+__attribute__((target("sse2")))
+static __m128i under16Sse2(__m128i d, __m128i s) {
+	__m128i inv = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	inv = _mm_sub_epi16(_mm_set1_epi16(255), inv);
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(d, inv), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void overSse2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m128i s  = _mm_loadu_si128((const __m128i*)(src + i*4));
+		__m128i d  = _mm_loadu_si128((const __m128i*)(dest + i*4));
+		__m128i lo = under16Sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+		__m128i hi = under16Sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+		_mm_storeu_si128((__m128i*)(dest + i*4), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+	}
+	overScalar(dest + i*4, src + i*4, n - i);
+}
+
+// Both source pixels of a sample weighted and added, in the low 4 lanes
+__attribute__((target("sse2")))
+static __m128i lerp16Sse2(const uint8_t *px, unsigned fx) {
+	__m128i v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)px), _mm_setzero_si128());
+	__m128i w = _mm_unpacklo_epi64(_mm_set1_epi16(256 - fx), _mm_set1_epi16(fx));
+	v = _mm_mullo_epi16(v, w);
+	return _mm_add_epi16(v, _mm_srli_si128(v, 8));
+}
+
+// Gathering the samples is what takes the time, AVX2 uses this too
+__attribute__((target("sse2")))
+static void scaleRowSse2(uint8_t *dest, const uint8_t *a, const uint8_t *b, const int32_t *xs,
+                         const uint16_t *fxs, int fy, size_t n) {
+	const __m128i half = _mm_set1_epi16(128), wb = _mm_set1_epi16(fy), wa = _mm_set1_epi16(256 - fy);
+	size_t i = 0;
+	for (; i + 2 <= n; i += 2) {
+		size_t  x0 = (size_t)xs[i]*4, x1 = (size_t)xs[i + 1]*4;
+		__m128i ta = _mm_unpacklo_epi64(lerp16Sse2(a + x0, fxs[i]), lerp16Sse2(a + x1, fxs[i + 1]));
+		__m128i tb = _mm_unpacklo_epi64(lerp16Sse2(b + x0, fxs[i]), lerp16Sse2(b + x1, fxs[i + 1]));
+		ta = _mm_srli_epi16(_mm_add_epi16(ta, half), 8);
+		tb = _mm_srli_epi16(_mm_add_epi16(tb, half), 8);
+		__m128i v = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(ta, wa), _mm_mullo_epi16(tb, wb)), half);
+		v = _mm_srli_epi16(v, 8);
+		_mm_storel_epi64((__m128i*)(dest + i*4), _mm_packus_epi16(v, v));
+	}
+	scaleRowScalar(dest + i*4, a, b, xs + i, fxs + i, fy, n - i);
+}
+
+static const Kernels sse2Kernels = {
+	"sse2", rgbToRgbaScalar, swapRbSse2, premultiplySse2, downscale2xSse2, rotate90Sse2,
+	mirrorSse2, isOpaqueSse2, overSse2, scaleRowSse2,
+};
+
+/* AVX2. Shuffles only work within 128-bit lanes, so data is laid out lane by lane. Rotation uses
+   the SSE2 blocks, wider ones don't pay off for the extra shuffling */
+
+__attribute__((target("avx2")))
+static void rgbToRgbaAvx2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+	                                      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	size_t i = 0;
+	// Each lane loads 16 bytes for 4 pixels, so stop early enough not to read past the end
+	for (; i + 10 <= n; i += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + i*3));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + i*3 + 12));
+		__m256i v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuf), alpha);
+		_mm256_storeu_si256((__m256i*)(dest + i*4), v);
+	}
+	rgbToRgbaScalar(dest + i*4, src + i*3, n - i);
+}
+
+__attribute__((target("avx2")))
+static void swapRbAvx2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+	                                      2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + i*4));
+		_mm256_storeu_si256((__m256i*)(dest + i*4), _mm256_shuffle_epi8(v, shuf));
+	}
+	swapRbScalar(dest + i*4, src + i*4, n - i);
+}
+
+__attribute__((target("avx2")))
+static __m256i premultiply16Avx2(__m256i v) {
+	const __m256i rgb = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+	const __m256i one = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(v, 0xFF), 0xFF);
+	a = _mm256_or_si256(_mm256_and_si256(a, rgb), one);
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(v, a), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void premultiplyAvx2(uint8_t *pxs, size_t n) {
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v  = _mm256_loadu_si256((const __m256i*)(pxs + i*4));
+		__m256i lo = premultiply16Avx2(_mm256_unpacklo_epi8(v, zero));
+		__m256i hi = premultiply16Avx2(_mm256_unpackhi_epi8(v, zero));
+		_mm256_storeu_si256((__m256i*)(pxs + i*4), _mm256_packus_epi16(lo, hi));
+	}
+	premultiplyScalar(pxs + i*4, n - i);
+}
+
+__attribute__((target("avx2")))
+static void downscale2xAvx2(uint8_t *dest, const uint8_t *src, int w, int h) {
+	const __m256i zero = _mm256_setzero_si256(), two = _mm256_set1_epi16(2);
+	for (int y = 0; y < h/2; ++y) {
+		const uint8_t *a = src + (size_t)y*2*w*4, *b = a + (size_t)w*4;
+		uint8_t       *d = dest + (size_t)y*(w/2)*4;
+		int x = 0;
+		// 8 pixels of both rows make 4
+		for (; x + 4 <= w/2; x += 4) {
+			__m256i va = _mm256_loadu_si256((const __m256i*)(a + x*8));
+			__m256i vb = _mm256_loadu_si256((const __m256i*)(b + x*8));
+			__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(va, zero), _mm256_unpacklo_epi8(vb, zero));
+			__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(va, zero), _mm256_unpackhi_epi8(vb, zero));
+			__m256i s  = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+			s = _mm256_srli_epi16(_mm256_add_epi16(s, two), 2);
+			// Each lane packed its 2 pixels into its low half
+			s = _mm256_permute4x64_epi64(_mm256_packus_epi16(s, s), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i*)(d + x*4), _mm256_castsi256_si128(s));
+		}
+		downscale2xRow(d, a, b, x, w/2);
+	}
+}
+
+__attribute__((target("avx2")))
+static bool isOpaqueAvx2(const uint8_t *pxs, size_t n) {
+	__m256i acc = _mm256_set1_epi8(-1);
+	size_t  i   = 0;
+	for (; i + 8 <= n; i += 8)
+		acc = _mm256_and_si256(acc, _mm256_loadu_si256((const __m256i*)(pxs + i*4)));
+	acc = _mm256_or_si256(acc, _mm256_set1_epi32(0x00FFFFFF));
+	if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(acc, _mm256_set1_epi8(-1))) != 0xFFFFFFFF)
+		return false;
+	return isOpaqueScalar(pxs + i*4, n - i);
+}
+
+__attribute__((target("avx2")))
+static void mirrorAvx2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(src + (n - 8 - i)*4));
+		_mm256_storeu_si256((__m256i*)(dest + i*4), _mm256_permutevar8x32_epi32(v, reverse));
+	}
+	mirrorScalar(dest + i*4, src, n - i);
+}
+
+__attribute__((target("avx2")))
+static __m256i under16Avx2(__m256i d, __m256i s) {
+	__m256i inv = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+	inv = _mm256_sub_epi16(_mm256_set1_epi16(255), inv);
+	__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(d, inv), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void overAvx2(uint8_t *dest, const uint8_t *src, size_t n) {
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i s  = _mm256_loadu_si256((const __m256i*)(src + i*4));
+		__m256i d  = _mm256_loadu_si256((const __m256i*)(dest + i*4));
+		__m256i lo = under16Avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(s, zero));
+		__m256i hi = under16Avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(s, zero));
+		_mm256_storeu_si256((__m256i*)(dest + i*4), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+	}
+	overScalar(dest + i*4, src + i*4, n - i);
+}
+
+static const Kernels avx2Kernels = {
+	"avx2", rgbToRgbaAvx2, swapRbAvx2, premultiplyAvx2, downscale2xAvx2, rotate90Sse2,
+	mirrorAvx2, isOpaqueAvx2, overAvx2, scaleRowSse2,
+};
+
+#endif
+
+#ifdef KERNELSARM
+
+/* NEON, always there on 64-bit ARM. Interleaved loads and stores split the channels for free */
+
+static void rgbToRgbaNeon(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x3_t rgb = vld3q_u8(src + i*3);
+		uint8x16x4_t rgba = {{rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(0xFF)}};
+		vst4q_u8(dest + i*4, rgba);
+	}
+	rgbToRgbaScalar(dest + i*4, src + i*3, n - i);
+}
+
+static void swapRbNeon(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x4_t v = vld4q_u8(src + i*4);
+		uint8x16_t   r = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = r;
+		vst4q_u8(dest + i*4, v);
+	}
+	swapRbScalar(dest + i*4, src + i*4, n - i);
+}
+
+// Same rounding as mulDiv255, (t + 128 + ((t + 128) >> 8)) >> 8
+static uint8x8_t mulDiv255Neon(uint8x8_t c, uint8x8_t a) {
+	uint16x8_t t = vmull_u8(c, a);
+	return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void premultiplyNeon(uint8_t *pxs, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t v = vld4_u8(pxs + i*4);
+		v.val[0] = mulDiv255Neon(v.val[0], v.val[3]);
+		v.val[1] = mulDiv255Neon(v.val[1], v.val[3]);
+		v.val[2] = mulDiv255Neon(v.val[2], v.val[3]);
+		vst4_u8(pxs + i*4, v);
+	}
+	premultiplyScalar(pxs + i*4, n - i);
+}
+
+static void downscale2xNeon(uint8_t *dest, const uint8_t *src, int w, int h) {
+	for (int y = 0; y < h/2; ++y) {
+		const uint8_t *a = src + (size_t)y*2*w*4, *b = a + (size_t)w*4;
+		uint8_t       *d = dest + (size_t)y*(w/2)*4;
+		int x = 0;
+		// 16 pixels of both rows make 8, neighbours are added pairwise
+		for (; x + 8 <= w/2; x += 8) {
+			uint8x16x4_t va = vld4q_u8(a + x*8), vb = vld4q_u8(b + x*8);
+			uint8x8x4_t  out;
+			for (int c = 0; c < 4; ++c) {
+				uint16x8_t s = vaddq_u16(vpaddlq_u8(va.val[c]), vpaddlq_u8(vb.val[c]));
+				out.val[c] = vrshrn_n_u16(s, 2);
+			}
+			vst4_u8(d + x*4, out);
+		}
+		downscale2xRow(d, a, b, x, w/2);
+	}
+}
+
+// Reverses the 4 pixels of a vector
+static uint32x4_t reverseNeon(uint32x4_t v) {
+	v = vrev64q_u32(v);
+	return vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+}
+
+static void rotate90TileNeon(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw,
+                             int x0, int x1, int y0, int y1) {
+	for (int y = y0; y < y1; y += 4)
+		for (int x = x0; x < x1; x += 4) {
+			const uint8_t *s = src + ((size_t)y*w + x)*4;
+			uint32x4x2_t t0 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s)),
+			                            vreinterpretq_u32_u8(vld1q_u8(s + (size_t)w*4)));
+			uint32x4x2_t t1 = vtrnq_u32(vreinterpretq_u32_u8(vld1q_u8(s + (size_t)w*8)),
+			                            vreinterpretq_u32_u8(vld1q_u8(s + (size_t)w*12)));
+			uint32x4_t cols[4] = {
+				vcombine_u32(vget_low_u32(t0.val[0]),  vget_low_u32(t1.val[0])),
+				vcombine_u32(vget_low_u32(t0.val[1]),  vget_low_u32(t1.val[1])),
+				vcombine_u32(vget_high_u32(t0.val[0]), vget_high_u32(t1.val[0])),
+				vcombine_u32(vget_high_u32(t0.val[1]), vget_high_u32(t1.val[1])),
+			};
+			for (int i = 0; i < 4; ++i) {
+				uint8_t   *to  = rotatedAt(dest, pitch, w, h, cw, x + i, cw? y + 3 : y);
+				uint32x4_t col = cw? reverseNeon(cols[i]) : cols[i];
+				vst1q_u8(to, vreinterpretq_u8_u32(col));
+			}
+		}
+}
+
+static void rotate90Neon(uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw) {
+	rotate90Tiled(dest, pitch, src, w, h, cw, rotate90TileNeon);
+}
+
+static void mirrorNeon(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(src + (n - 4 - i)*4));
+		vst1q_u8(dest + i*4, vreinterpretq_u8_u32(reverseNeon(v)));
+	}
+	mirrorScalar(dest + i*4, src, n - i);
+}
+
+static bool isOpaqueNeon(const uint8_t *pxs, size_t n) {
+	uint8x16_t acc = vdupq_n_u8(0xFF);
+	size_t     i   = 0;
+	for (; i + 16 <= n; i += 16) acc = vandq_u8(acc, vld4q_u8(pxs + i*4).val[3]);
+	if (vminvq_u8(acc) != 0xFF) return false;
+	return isOpaqueScalar(pxs + i*4, n - i);
+}
+
+static void overNeon(uint8_t *dest, const uint8_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t s = vld4_u8(src + i*4), d = vld4_u8(dest + i*4);
+		uint8x8_t   inv = vmvn_u8(s.val[3]);
+		for (int c = 0; c < 4; ++c) d.val[c] = vqadd_u8(s.val[c], mulDiv255Neon(d.val[c], inv));
+		vst4_u8(dest + i*4, d);
+	}
+	overScalar(dest + i*4, src + i*4, n - i);
+}
+
+// Both source pixels of a sample weighted, added and rounded back to 8 bits
+static uint16x4_t lerpNeon(const uint8_t *px, unsigned fx) {
+	uint16x8_t v = vmulq_u16(vmovl_u8(vld1_u8(px)),
+	                         vcombine_u16(vdup_n_u16(256 - fx), vdup_n_u16(fx)));
+	return vrshr_n_u16(vadd_u16(vget_low_u16(v), vget_high_u16(v)), 8);
+}
+
+static void scaleRowNeon(uint8_t *dest, const uint8_t *a, const uint8_t *b, const int32_t *xs,
+                         const uint16_t *fxs, int fy, size_t n) {
+	const uint16x4_t wa = vdup_n_u16(256 - fy), wb = vdup_n_u16(fy);
+	for (size_t i = 0; i < n; ++i) {
+		size_t     x = (size_t)xs[i]*4;
+		uint16x4_t v = vmla_u16(vmul_u16(lerpNeon(a + x, fxs[i]), wa), lerpNeon(b + x, fxs[i]), wb);
+		uint8x8_t  p = vrshrn_n_u16(vcombine_u16(v, v), 8);
+		storePixel(dest + i*4, vget_lane_u32(vreinterpret_u32_u8(p), 0));
+	}
+}
+
+static const Kernels neonKernels = {
+	"neon", rgbToRgbaNeon, swapRbNeon, premultiplyNeon, downscale2xNeon, rotate90Neon,
+	mirrorNeon, isOpaqueNeon, overNeon, scaleRowNeon,
+};
+
+#endif
+
+Kernels kernels = {
+	"scalar", rgbToRgbaScalar, swapRbScalar, premultiplyScalar, downscale2xScalar, rotate90Scalar,
+	mirrorScalar, isOpaqueScalar, overScalar, scaleRowScalar,
+};
+
+const Kernels *getKernels(int set) {
+	switch (set) {
+	case KERNELSSCALAR: return &scalarKernels;
+#ifdef KERNELSX86
+	case KERNELSSSE2: __builtin_cpu_init(); return __builtin_cpu_supports("sse2")? &sse2Kernels : NULL;
+	case KERNELSAVX2: __builtin_cpu_init(); return __builtin_cpu_supports("avx2")? &avx2Kernels : NULL;
+#endif
+#ifdef KERNELSARM
+	case KERNELSNEON: return &neonKernels;
+#endif
+	default: return NULL;
+	}
+}
+
+void initKernels(void) {
+	for (int set = KERNELSCOUNT - 1; set >= 0; --set) {
+		const Kernels *best = getKernels(set);
+		if (best != NULL) {
+			kernels = *best;
+			return;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef KERNELS_H_HEADER_GUARD
+#define KERNELS_H_HEADER_GUARD
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint8_t, uint16_t, uint32_t, int32_t
+#include <stdbool.h> // bool, true, false
+#include <string.h>  // memcpy
+
+// Pixel kernels work on RGBA pixels unless said otherwise, and they're exact, so every set gives
+// the same result as the scalar one
+typedef struct {
+	const char *name;
+	void (*rgbToRgba)  (uint8_t *dest, const uint8_t *src, size_t n); // Alpha is set to opaque
+	void (*swapRb)     (uint8_t *dest, const uint8_t *src, size_t n); // RGBA <-> BGRA, can be in place
+	void (*premultiply)(uint8_t *pxs, size_t n);
+	// Box filter into (w/2)x(h/2), the last column and row of odd sizes are dropped
+	void (*downscale2x)(uint8_t *dest, const uint8_t *src, int w, int h);
+	// The result is h pixels wide and w pixels high, pitch is the size of its rows in bytes
+	void (*rotate90)   (uint8_t *dest, int pitch, const uint8_t *src, int w, int h, bool cw);
+	void (*mirror)     (uint8_t *dest, const uint8_t *src, size_t n); // Reverses n pixels, not in place
+	bool (*isOpaque)   (const uint8_t *pxs, size_t n);
+	// Premultiplied src over dest
+	void (*over)       (uint8_t *dest, const uint8_t *src, size_t n);
+	/* Bilinear samples between rows a and b: pixel i mixes xs[i] and the one after it by fxs[i], and
+	   the rows by fy, with weights out of 256. Both rows need a readable pixel after xs[i] */
+	void (*scaleRow)   (uint8_t *dest, const uint8_t *a, const uint8_t *b, const int32_t *xs,
+	                    const uint16_t *fxs, int fy, size_t n);
+} Kernels;
+
+enum {
+	KERNELSSCALAR = 0,
+	KERNELSSSE2,
+	KERNELSAVX2,
+	KERNELSNEON,
+	KERNELSCOUNT,
+};
+
+extern Kernels kernels; // The fastest set the CPU supports once initKernels was called
+
+void           initKernels(void);
+const Kernels *getKernels(int set); // NULL if the set isn't built in or the CPU doesn't support it
+
+#endif
@@ -8,6 +8,57 @@
 #define STBI_FAILURE_USERMSG
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#undef STB_IMAGE_IMPLEMENTATION
+
+#include "loader.h"
+
+// stb_image can only decode all GIF frames at once, but its internals can go frame by frame
+struct GifDecoder {
+	stbi__context ctx;
+	stbi__gif     gif;
+	uint8_t      *back[2]; // Copies of the last two frames, for the "restore previous" disposal
+	int           frame;
+};
+
+GifDecoder *newGifDecoder(const uint8_t *buf, size_t sz, int *w, int *h) {
+	GifDecoder *dec = alloc(GifDecoder, 1);
+	zeroMem(dec);
+	stbi__start_mem(&dec->ctx, buf, sz);
+	if (!stbi__gif_test(&dec->ctx) || !stbi__gif_header(&dec->ctx, &dec->gif, NULL, true)) {
+		free(dec);
+		return NULL;
+	}
+	*w = dec->gif.w;
+	*h = dec->gif.h;
+
+	// Header parsing isn't repeatable, so rewind and let the first frame parse it again
+	zeroMem(&dec->gif);
+	stbi__rewind(&dec->ctx);
+	return dec;
+}
+
+uint8_t *nextGifFrame(GifDecoder *dec, int *delay) {
+	uint8_t *twoBack = dec->frame >= 2? dec->back[dec->frame%2] : NULL;
+	uint8_t *out     = stbi__gif_load_next(&dec->ctx, &dec->gif, NULL, 4, twoBack);
+	if (out == NULL || out == (uint8_t*)&dec->ctx) return NULL; // Error or end of the GIF
+
+	size_t sz = (size_t)dec->gif.w*dec->gif.h*4;
+	if (dec->back[dec->frame%2] == NULL) dec->back[dec->frame%2] = alloc(uint8_t, sz);
+	memcpy(dec->back[dec->frame%2], out, sz);
+	++dec->frame;
+
+	*delay = dec->gif.delay;
+	return out;
+}
+
+void freeGifDecoder(GifDecoder *dec) {
+	free(dec->gif.out);
+	free(dec->gif.background);
+	free(dec->gif.history);
+	free(dec->back[0]);
+	free(dec->back[1]);
+	free(dec);
+}
 
 // tini
 #define TINI_ALLOC(SZ)        alloc_(SZ)
@@ -1,55 +1,20 @@
 #include "loader.h"
 
-void normalizeImagePath(const char *path, char *buf) {
-	if (!*path) *buf = 0;
-	else if (realpath(path, buf) == NULL)
-		die("Failed to normalize image path \"%s\": %s", path, strerror(errno));
-}
-
-Image *newImage(const char *path) {
-	Image *img = alloc(Image, 1);
-	zeroMem(img);
-	normalizeImagePath(path, img->path);
-	pthread_mutex_init(&img->mutex, NULL);
-	return img;
-}
-
-void freeImage(Image *img) {
-	if (isImageLoading(img)) {
-		/* Let's just detach the thread and not destroy the mutex, if an image is beeing free'd,
-		   the program is probably about to quit anyways */
-		int err = pthread_detach(img->thread);
-		if (err != 0) die("Failed to detach image thread: %s", strerror(err));
-	} else {
-		if (isImageLoaded(img)) unloadImage(img);
-
-		int err = pthread_mutex_destroy(&img->mutex);
-		if (err != 0) die("Failed to destroy image mutex: %s", strerror(err));
-	}
-	free(img);
-}
-
-void lockImage(Image *img) {
-	int err = pthread_mutex_lock(&img->mutex);
-	if (err != 0) die("Failed to lock image mutex: %s", strerror(err));
-}
-
-void unlockImage(Image *img) {
-	int err = pthread_mutex_unlock(&img->mutex);
-	if (err != 0) die("Failed to unlock image mutex: %s", strerror(err));
-}
-
 bool isImageLoading(Image *img) {
-	lockImage(img); bool tmp = img->loading; unlockImage(img);
-	return tmp;
+	int state = atomicLoad(&img->state);
+	return state == IMGLOADING || state == IMGLOADINGSTALE;
 }
 
 bool isImageLoaded(Image *img) {
-	lockImage(img); bool tmp = img->loaded; unlockImage(img);
-	return tmp;
+	return atomicLoad(&img->state) == IMGLOADED;
+}
+
+int getImageRows(Image *img) {
+	return atomicLoad(&img->rows);
 }
 
 #define BUFCHUNKSZ (256*256)
+#define MAXTHREADS 64 // Most threads a single image is decoded with
 
 static Error readFileAtOnce(FILE *f, uint8_t **buf, size_t *sz) {
 	fseek(f, 0, SEEK_END);
@@ -68,31 +33,37 @@ static Error readFileAtOnce(FILE *f, uint8_t **buf, size_t *sz) {
 	return NULL;
 }
 
-static Error readFileByChunks(FILE *f, uint8_t **buf, size_t *sz) {
-	int    byte;
-	size_t cap = BUFCHUNKSZ;
-	*sz  = 0;
-	*buf = alloc(uint8_t, cap);
-	while ((byte = fgetc(f)) != EOF) {
-		if (*sz >= cap) resize(*buf, cap *= 2);
-		(*buf)[(*sz)++] = byte;
-	}
-	if (ferror(f)) {
-		free(*buf);
-		return strerror(errno); // fgetc should set errno, right?
-	}
-
-	// Make sure buffer is not too big
-	if (*sz != cap) resize(*buf, *sz);
+// Pipes can't be sized or seeked, so they're read in bulk into a buffer that grows as data arrives
+typedef struct {
+	int      fd;
+	uint8_t *buf;
+	size_t   sz, cap;
+	bool     eof;
+} Stream;
+
+// Reads whatever is available, blocking only if nothing is
+static Error readStream(Stream *s) {
+	if (s->sz >= s->cap) resize(s->buf, s->cap = s->cap == 0? BUFCHUNKSZ : s->cap*2);
+	ssize_t n;
+	do n = read(s->fd, s->buf + s->sz, s->cap - s->sz);
+	while (n == -1 && errno == EINTR);
+	if (n == -1) return strerror(errno);
+	if (n ==  0) s->eof = true;
+	s->sz += n;
 	return NULL;
 }
 
+static Error readStreamToEnd(Stream *s) {
+	Error err = NULL;
+	while (!s->eof && err == NULL) err = readStream(s);
+	return err;
+}
+
 #define imgError(IMG, ERR) ((IMG)->err = ERR)
 
 static uint8_t *imageReadFile(Image *img, FILE *f, size_t *sz) {
-	// ftell doesn't work with piping, so we have to read by chunks for stdin
-	uint8_t *buf;
-	Error    err = f == stdin? readFileByChunks(f, &buf, sz) : readFileAtOnce(f, &buf, sz);
+	uint8_t *buf = NULL;
+	Error    err = readFileAtOnce(f, &buf, sz);
 	if (err != NULL) {
 		imgError(img, err);
 		return NULL;
@@ -100,26 +71,718 @@ static uint8_t *imageReadFile(Image *img, FILE *f, size_t *sz) {
 	return buf;
 }
 
-// TODO: Animated WEBP support
-static void decodeWebp(FILE *f, Image *img) {
+#define FRAMEHASHSZ (FRAMEMAXCOLORS*2)
+
+// Returns the palette size, or 0 if there are too many colors for a palette
+static int palettizeFrame(const uint32_t *pxs, int stride, int w, int h, uint32_t *palette,
+                          uint8_t *idxs) {
+	// Open addressing hash table of colors, slots hold palette index + 1
+	uint16_t table[FRAMEHASHSZ] = {0};
+	int      colors = 0;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			uint32_t px = pxs[(size_t)y*stride + x];
+			unsigned i  = (px*2654435761u) >> 23; // Knuth's multiplicative hash, top 9 bits
+			while (table[i] && palette[table[i] - 1] != px) i = (i + 1)%FRAMEHASHSZ;
+			if (!table[i]) {
+				if (colors >= FRAMEMAXCOLORS) return 0;
+				palette[colors] = px;
+				table[i] = ++colors;
+			}
+			*idxs++ = table[i] - 1;
+		}
+	}
+	return colors;
+}
+
+// Stores the rectangle of the canvas that differs from the previous one
+static void compressFrame(Frame *frame, const uint8_t *canvas, const uint8_t *prev, int w, int h,
+                          bool keyframe) {
+	const uint32_t *pxs = (const uint32_t*)canvas, *prevPxs = (const uint32_t*)prev;
+	int x0 = 0, y0 = 0, x1 = w, y1 = h;
+	if (!keyframe) {
+		x0 = w, y0 = h, x1 = y1 = 0;
+		for (int y = 0; y < h; ++y) {
+			const uint32_t *row = pxs + (size_t)y*w, *prevRow = prevPxs + (size_t)y*w;
+			if (memcmp(row, prevRow, w*4) == 0) continue;
+			if (y < y0) y0 = y;
+			y1 = y + 1;
+			for (int x = 0;     x < x0; ++x) if (row[x] != prevRow[x]) x0 = x;
+			for (int x = w - 1; x >= x1; --x) if (row[x] != prevRow[x]) x1 = x + 1;
+		}
+		// Nothing changed, keep a 1x1 rectangle so every frame has some data
+		if (x1 <= x0 || y1 <= y0) x0 = y0 = 0, x1 = y1 = 1;
+	}
+	frame->x = x0;
+	frame->y = y0;
+	frame->w = x1 - x0;
+	frame->h = y1 - y0;
+
+	// Indices are written after the space for the biggest palette, and moved once it's known
+	const uint32_t *rect     = pxs + (size_t)y0*w + x0;
+	size_t          pxsCount = (size_t)frame->w*frame->h;
+	uint32_t        palette[FRAMEMAXCOLORS];
+	frame->data   = alloc(uint8_t, FRAMEMAXCOLORS*4 + pxsCount);
+	frame->colors = palettizeFrame(rect, w, frame->w, frame->h, palette,
+	                               frame->data + FRAMEMAXCOLORS*4);
+	if (frame->colors > 0) {
+		memcpy(frame->data, palette, frame->colors*4);
+		memmove(frame->data + frame->colors*4, frame->data + FRAMEMAXCOLORS*4, pxsCount);
+		resize(frame->data, frame->colors*4 + pxsCount);
+		return;
+	}
+
+	resize(frame->data, pxsCount*4);
+	for (int y = 0; y < frame->h; ++y)
+		memcpy(frame->data + (size_t)y*frame->w*4, rect + (size_t)y*w, frame->w*4);
+}
+
+static void applyFrame(uint8_t *canvas, int w, const Frame *frame) {
+	uint32_t *dest = (uint32_t*)canvas + (size_t)frame->y*w + frame->x;
+	if (frame->colors == 0) {
+		for (int y = 0; y < frame->h; ++y)
+			memcpy(dest + (size_t)y*w, frame->data + (size_t)y*frame->w*4, frame->w*4);
+		return;
+	}
+
+	uint32_t palette[FRAMEMAXCOLORS];
+	memcpy(palette, frame->data, frame->colors*4);
+	const uint8_t *idxs = frame->data + frame->colors*4;
+	for (int y = 0; y < frame->h; ++y)
+		for (int x = 0; x < frame->w; ++x)
+			dest[(size_t)y*w + x] = palette[idxs[(size_t)y*frame->w + x]];
+}
+
+static size_t frameSize(const Frame *frame) {
+	size_t pxsCount = (size_t)frame->w*frame->h;
+	return frame->colors > 0? frame->colors*4 + pxsCount : pxsCount*4;
+}
+
+// Frame by frame decoders, next returns the composited canvas or NULL at the end of the animation
+typedef struct {
+	void    *(*open)(const uint8_t *buf, size_t sz, int *w, int *h);
+	uint8_t *(*next)(void *dec, int *delay);
+	void     (*close)(void *dec);
+} AnimFormat;
+
+#define ANIMRINGSZ  8
+#define ANIMCACHESZ (32*1024*1024) // Animations with less compressed frame data are not re-decoded
+
+/* Animations are decoded by a worker, which stays one ring of frames ahead of the playback. The
+   first loop is also cached if it's small enough, otherwise the animation is decoded again every
+   time it loops, so long animations only ever have a few frames in memory */
+struct Anim {
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	int             refs; // The image and the worker
+	bool            stop;
+
+	// Worker only
+	uint8_t          *buf, *prev;
+	size_t            sz, cacheSz;
+	int               w, h;
+	const AnimFormat *fmt;
+	void             *dec;
+	bool              caching;
+
+	// Shared, protected by the mutex
+	Frame    ring[ANIMRINGSZ];
+	unsigned produced, consumed;
+	Frame   *cache;
+	int      cacheLen, cacheCap;
+	bool     cached; // The whole first loop is in the cache, and the worker is done
+
+	// Playback only
+	unsigned pos;
+	int      delay;
+};
+
+static void lockAnim(Anim *anim) {
+	int err = pthread_mutex_lock(&anim->mutex);
+	if (err != 0) die("Failed to lock animation mutex: %s", strerror(err));
+}
+
+static void unlockAnim(Anim *anim) {
+	int err = pthread_mutex_unlock(&anim->mutex);
+	if (err != 0) die("Failed to unlock animation mutex: %s", strerror(err));
+}
+
+static void releaseAnim(Anim *anim) {
+	lockAnim(anim);
+	bool last = --anim->refs == 0;
+	unlockAnim(anim);
+	if (!last) return;
+
+	for (unsigned i = anim->consumed; i != anim->produced; ++i) free(anim->ring[i%ANIMRINGSZ].data);
+	for (int i = 0; i < anim->cacheLen; ++i) free(anim->cache[i].data);
+	free(anim->cache);
+	if (anim->dec != NULL) anim->fmt->close(anim->dec);
+	free(anim->buf);
+	free(anim->prev);
+	pthread_mutex_destroy(&anim->mutex);
+	pthread_cond_destroy(&anim->cond);
+	free(anim);
+}
+
+static void stopAnim(Anim *anim) {
+	lockAnim(anim);
+	anim->stop = true;
+	pthread_cond_signal(&anim->cond);
+	unlockAnim(anim);
+	releaseAnim(anim);
+}
+
+// Only the worker touches the cache until it's complete, so it doesn't need the mutex
+static void cacheFrame(Anim *anim, const Frame *frame) {
+	if (!anim->caching) return;
+	if ((anim->cacheSz += frameSize(frame)) > ANIMCACHESZ) {
+		// Too big, the animation will have to be decoded again on every loop
+		for (int i = 0; i < anim->cacheLen; ++i) free(anim->cache[i].data);
+		free(anim->cache);
+		anim->cache    = NULL;
+		anim->cacheLen = 0;
+		anim->caching  = false;
+		return;
+	}
+
+	if (anim->cacheLen >= anim->cacheCap)
+		resize(anim->cache, anim->cacheCap = anim->cacheCap == 0? 16 : anim->cacheCap*2);
+	Frame *copy = anim->cache + anim->cacheLen++;
+	*copy      = *frame;
+	copy->data = alloc(uint8_t, frameSize(frame));
+	memcpy(copy->data, frame->data, frameSize(frame));
+}
+
+// Decodes the next frame, going back to the start at the end of the animation
+static bool decodeAnimFrame(Anim *anim, Frame *frame) {
+	uint8_t *canvas;
+	bool     keyframe = false;
+	while ((canvas = anim->fmt->next(anim->dec, &frame->delay)) == NULL) {
+		// The end of the first loop, so the cache (if any) is complete
+		if (anim->caching || keyframe) return false;
+
+		anim->fmt->close(anim->dec);
+		anim->dec = anim->fmt->open(anim->buf, anim->sz, &anim->w, &anim->h);
+		assert(anim->dec != NULL); // It was decoded succesfully before
+		keyframe = true; // Loops start with a keyframe, so frames don't depend on the previous loop
+	}
+	compressFrame(frame, canvas, anim->prev, anim->w, anim->h, keyframe);
+	memcpy(anim->prev, canvas, (size_t)anim->w*anim->h*4);
+	return true;
+}
+
+static void runAnim(Anim *anim) {
+	for (;;) {
+		Frame frame;
+		bool  decoded = decodeAnimFrame(anim, &frame);
+		if (decoded) cacheFrame(anim, &frame);
+
+		lockAnim(anim);
+		if (decoded) {
+			// Wait for the playback to make space in the ring
+			while (!anim->stop && anim->produced - anim->consumed >= ANIMRINGSZ)
+				pthread_cond_wait(&anim->cond, &anim->mutex);
+			if (anim->stop) free(frame.data);
+			else anim->ring[anim->produced++%ANIMRINGSZ] = frame;
+		} else anim->cached = anim->cacheLen > 0;
+		bool done = anim->stop || !decoded;
+		unlockAnim(anim);
+		if (done) break;
+	}
+	releaseAnim(anim);
+}
+
+int getAnimDelay(Image *img) {
+	assert(img->anim != NULL);
+	return img->anim->delay;
+}
+
+bool nextAnimFrame(Image *img, int *x, int *y, int *w, int *h) {
+	Anim *anim = img->anim;
+	assert(anim != NULL);
+
+	lockAnim(anim);
+	Frame frame;
+	bool  fromRing = anim->consumed != anim->produced, cached = anim->cached;
+	if (fromRing) {
+		frame = anim->ring[anim->consumed++%ANIMRINGSZ];
+		pthread_cond_signal(&anim->cond);
+	}
+	unlockAnim(anim);
+
+	// Once the worker is done with the cache, it's read-only
+	if      (!fromRing && cached) frame = anim->cache[anim->pos%anim->cacheLen];
+	else if (!fromRing) return false; // The next frame isn't decoded yet, keep showing this one
+
+	applyFrame(img->pxs, img->w, &frame);
+	*x = frame.x, *y = frame.y, *w = frame.w, *h = frame.h;
+	anim->delay = frame.delay;
+	++anim->pos;
+	if (fromRing) free(frame.data);
+	return true;
+}
+
+// Decodes the first frame and leaves the rest to the loading thread, takes ownership of buf
+static bool startAnim(Image *img, uint8_t *buf, size_t sz, const AnimFormat *fmt) {
+	Anim *anim = alloc(Anim, 1);
+	zeroMem(anim);
+	anim->buf = buf;
+	anim->sz  = sz;
+	anim->fmt = fmt;
+
+	Frame    frame;
+	uint8_t *canvas = NULL;
+	if ((anim->dec = fmt->open(buf, sz, &img->w, &img->h)) != NULL)
+		canvas = fmt->next(anim->dec, &frame.delay);
+	if (canvas == NULL) {
+		if (anim->dec != NULL) fmt->close(anim->dec);
+		free(buf);
+		free(anim);
+		return false;
+	}
+
+	size_t canvasSz = (size_t)img->w*img->h*4;
+	img->pxs   = alloc(uint8_t, canvasSz);
+	anim->prev = alloc(uint8_t, canvasSz);
+	memcpy(img->pxs,   canvas, canvasSz);
+	memcpy(anim->prev, canvas, canvasSz);
+	anim->w       = img->w;
+	anim->h       = img->h;
+	anim->refs    = 2;
+	anim->caching = true;
+	anim->delay   = frame.delay;
+	anim->pos     = 1;
+
+	compressFrame(&frame, canvas, NULL, img->w, img->h, true);
+	cacheFrame(anim, &frame);
+	free(frame.data);
+
+	pthread_mutex_init(&anim->mutex, NULL);
+	pthread_cond_init(&anim->cond, NULL);
+	img->anim = anim;
+	return true;
+}
+
+static void *openGif(const uint8_t *buf, size_t sz, int *w, int *h) {
+	return newGifDecoder(buf, sz, w, h);
+}
+static uint8_t *nextGif(void *dec, int *delay) { return nextGifFrame(dec, delay); }
+static void     closeGif(void *dec)            { freeGifDecoder(dec); }
+
+static const AnimFormat gifFormat = {openGif, nextGif, closeGif};
+
+static void decodeGif(FILE *f, Image *img) {
 	size_t   sz;
 	uint8_t *buf = imageReadFile(img, f, &sz);
 	if (buf == NULL) return;
-	if ((img->pxs = WebPDecodeRGBA(buf, sz, &img->w, &img->h)) == NULL)
-		imgError(img, "Failed to load WEBP");
-	free(buf);
+	if (!startAnim(img, buf, sz, &gifFormat)) imgError(img, stbi_failure_reason());
 }
 
-static void decodeGif(FILE *f, Image *img) {
+// Crop and scale done by libwebp while decoding, so a smaller proxy of a big image doesn't need a
+// full size decode first. The crop is taken from the full image and then scaled to outw x outh
+typedef struct {
+	int x, y, w, h; // A zero w or h means the whole image
+	int outw, outh; // Zero means the size of the crop
+} WebpView;
+
+static void getWebpViewSize(const WebpView *view, int w, int h, int *outw, int *outh) {
+	*outw = w;
+	*outh = h;
+	if (view == NULL) return;
+	if (view->w > 0 && view->h > 0) {
+		*outw = view->w;
+		*outh = view->h;
+	}
+	if (view->outw > 0 && view->outh > 0) {
+		*outw = view->outw;
+		*outh = view->outh;
+	}
+}
+
+// Decodes a still WEBP as RGB or RGBA into the caller's buffer, which holds the output size in rows
+// of stride bytes. Lossy images are filtered on a second thread while the next rows are decoded
+static bool decodeWebpInto(const uint8_t *buf, size_t sz, uint8_t *pxs, int ch, int stride, int outh,
+                           const WebpView *view) {
+	WebPDecoderConfig config;
+	if (!WebPInitDecoderConfig(&config)) return false;
+	config.options.use_threads = 1;
+	if (view != NULL && view->w > 0 && view->h > 0) {
+		config.options.use_cropping = 1;
+		config.options.crop_left    = view->x;
+		config.options.crop_top     = view->y;
+		config.options.crop_width   = view->w;
+		config.options.crop_height  = view->h;
+	}
+	if (view != NULL && view->outw > 0 && view->outh > 0) {
+		config.options.use_scaling   = 1;
+		config.options.scaled_width  = view->outw;
+		config.options.scaled_height = view->outh;
+	}
+	config.output.colorspace         = ch == 3? MODE_RGB : MODE_RGBA;
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba        = pxs;
+	config.output.u.RGBA.stride      = stride;
+	config.output.u.RGBA.size        = (size_t)stride*outh;
+	return WebPDecode(buf, sz, &config) == VP8_STATUS_OK;
+}
+
+// Frame by frame animated WEBP decoding, libwebp's demuxer isn't bundled so the chunks are parsed here
+typedef struct {
+	const uint8_t *buf;
+	size_t         sz, pos; // pos is the offset of the next chunk
+	int            w, h;
+	uint8_t       *canvas, *frame;
+	int            disposex, disposey, disposew, disposeh; // Cleared before the next frame
+} WebpDecoder;
+
+#define readLe24(P) ((P)[0] | (P)[1] << 8 | (P)[2] << 16)
+#define readLe32(P) ((uint32_t)readLe24(P) | (uint32_t)(P)[3] << 24)
+
+// Returns the payload of the next chunk and advances to the one after it, or NULL at the end
+static const uint8_t *nextWebpChunk(WebpDecoder *dec, const char *fourcc, size_t *sz) {
+	while (dec->sz - dec->pos >= 8) {
+		const uint8_t *chunk = dec->buf + dec->pos;
+		*sz = readLe32(chunk + 4);
+		if (*sz > dec->sz - dec->pos - 8) return NULL;
+		dec->pos += 8 + *sz + (*sz & 1); // Chunks are padded to an even size
+		if (dec->pos > dec->sz) dec->pos = dec->sz;
+		if (memcmp(chunk, fourcc, 4) == 0) return chunk + 8;
+	}
+	return NULL;
+}
+
+static WebpDecoder *newWebpDecoder(const uint8_t *buf, size_t sz, int *w, int *h) {
+	if (sz < 30 || memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WEBPVP8X", 8) != 0) return NULL;
+	if (readLe32(buf + 4) + 8 < sz) sz = readLe32(buf + 4) + 8; // Ignore trailing data
+	const uint8_t *vp8x = buf + 20;
+	if (!(vp8x[0] & 0x02)) return NULL; // Not animated
+
+	int cw = readLe24(vp8x + 4) + 1, ch = readLe24(vp8x + 7) + 1;
+	if ((uint64_t)cw*ch*4 > INT32_MAX) return NULL; // Too big for the rest of the viewer anyway
+
+	WebpDecoder *dec = alloc(WebpDecoder, 1);
+	zeroMem(dec);
+	dec->buf = buf;
+	dec->sz  = sz;
+	dec->pos = 12;
+	*w = dec->w = cw;
+	*h = dec->h = ch;
+	dec->canvas = alloc(uint8_t, (size_t)dec->w*dec->h*4);
+	dec->frame  = alloc(uint8_t, (size_t)dec->w*dec->h*4);
+	memset(dec->canvas, 0, (size_t)dec->w*dec->h*4);
+	return dec;
+}
+
+// Non-premultiplied source over destination
+static void blendWebpPixel(uint8_t *dest, const uint8_t *src) {
+	if (src[3] == 255) memcpy(dest, src, 4);
+	if (src[3] == 255 || src[3] == 0) return;
+	int destA = dest[3]*(256 - src[3]) >> 8, a = src[3] + destA;
+	for (int c = 0; c < 3; ++c) dest[c] = (src[c]*src[3] + dest[c]*destA)/a;
+	dest[3] = a;
+}
+
+static uint8_t *nextWebpFrame(WebpDecoder *dec, int *delay) {
+	for (int y = 0; y < dec->disposeh; ++y)
+		memset(dec->canvas + ((size_t)(dec->disposey + y)*dec->w + dec->disposex)*4, 0, dec->disposew*4);
+	dec->disposeh = 0;
+
+	size_t         sz;
+	const uint8_t *anmf = nextWebpChunk(dec, "ANMF", &sz);
+	if (anmf == NULL || sz < 16) return NULL;
+	int x = readLe24(anmf)*2, y = readLe24(anmf + 3)*2;
+	int w = readLe24(anmf + 6) + 1, h = readLe24(anmf + 9) + 1;
+	if (x + w > dec->w || y + h > dec->h) return NULL;
+	*delay = readLe24(anmf + 12);
+
+	// The frame data is an optional ALPH chunk followed by the bitstream, libwebp decodes both
+	int fw, fh;
+	if (!WebPGetInfo(anmf + 16, sz - 16, &fw, &fh) || fw != w || fh != h) return NULL;
+	if (!decodeWebpInto(anmf + 16, sz - 16, dec->frame, 4, w*4, h, NULL)) return NULL;
+
+	bool blend = !(anmf[15] & 0x02);
+	for (int row = 0; row < h; ++row) {
+		uint8_t       *dest = dec->canvas + ((size_t)(y + row)*dec->w + x)*4;
+		const uint8_t *src  = dec->frame + (size_t)row*w*4;
+		if (!blend) memcpy(dest, src, w*4);
+		else for (int i = 0; i < w; ++i) blendWebpPixel(dest + i*4, src + i*4);
+	}
+	if (anmf[15] & 0x01) {
+		dec->disposex = x, dec->disposey = y;
+		dec->disposew = w, dec->disposeh = h;
+	}
+	return dec->canvas;
+}
+
+static void freeWebpDecoder(WebpDecoder *dec) {
+	free(dec->canvas);
+	free(dec->frame);
+	free(dec);
+}
+
+static void *openWebp(const uint8_t *buf, size_t sz, int *w, int *h) {
+	return newWebpDecoder(buf, sz, w, h);
+}
+static uint8_t *nextWebp(void *dec, int *delay) { return nextWebpFrame(dec, delay); }
+static void     closeWebp(void *dec)            { freeWebpDecoder(dec); }
+
+static const AnimFormat webpFormat = {openWebp, nextWebp, closeWebp};
+
+static void decodeWebp(FILE *f, Image *img, const WebpView *view) {
 	size_t   sz;
 	uint8_t *buf = imageReadFile(img, f, &sz);
 	if (buf == NULL) return;
-	if ((img->pxs = stbi_load_gif_from_memory(buf, sz, &img->delays, &img->w, &img->h,
-	                                          &img->len, NULL, 4)) != NULL) img->isGif = true;
-	else imgError(img, stbi_failure_reason());
+
+	WebPBitstreamFeatures features;
+	if (WebPGetFeatures(buf, sz, &features) != VP8_STATUS_OK) {
+		imgError(img, "Failed to load WEBP");
+		free(buf);
+		return;
+	}
+	if (features.has_animation) {
+		if (!startAnim(img, buf, sz, &webpFormat)) imgError(img, "Failed to load animated WEBP");
+		return;
+	}
+
+	int w, h, ch = features.has_alpha? 4 : 3;
+	getWebpViewSize(view, features.width, features.height, &w, &h);
+	if ((uint64_t)w*h*4 > INT32_MAX) {
+		imgError(img, "WEBP is too big");
+		free(buf);
+		return;
+	}
+	img->pxs = alloc(uint8_t, (size_t)w*h*ch);
+	if (decodeWebpInto(buf, sz, img->pxs, ch, w*ch, h, view)) {
+		img->w      = w;
+		img->h      = h;
+		img->ch     = ch;
+		img->opaque = !features.has_alpha;
+	} else {
+		free(img->pxs);
+		img->pxs = NULL;
+		imgError(img, "Failed to load WEBP");
+	}
 	free(buf);
 }
 
+// Rows are decoded as they arrive, so the viewer can show them before the whole stream is read
+static void decodeWebpStream(Stream *s, Image *img) {
+	WebPBitstreamFeatures features;
+	VP8StatusCode         status;
+	Error                 err = NULL;
+	while ((status = WebPGetFeatures(s->buf, s->sz, &features)) == VP8_STATUS_NOT_ENOUGH_DATA)
+		if (s->eof || (err = readStream(s)) != NULL) break;
+	if (err == NULL && status != VP8_STATUS_OK) err = "Failed to load WEBP";
+	if (err != NULL) {
+		imgError(img, err);
+		return;
+	}
+
+	if (features.has_animation) {
+		if ((err = readStreamToEnd(s)) != NULL) {
+			imgError(img, err);
+			return;
+		}
+		if (!startAnim(img, s->buf, s->sz, &webpFormat)) imgError(img, "Failed to load animated WEBP");
+		s->buf = NULL; // Taken by startAnim
+		return;
+	}
+
+	size_t stride = (size_t)features.width*4, pxsSz = stride*features.height;
+	img->w   = features.width;
+	img->h   = features.height;
+	img->pxs = alloc(uint8_t, pxsSz);
+	memset(img->pxs, 0, pxsSz); // Rows that never arrive are left transparent
+
+	WebPIDecoder *idec = WebPINewRGB(MODE_RGBA, img->pxs, pxsSz, stride);
+	if (idec == NULL) {
+		free(img->pxs);
+		img->pxs = NULL;
+		imgError(img, "Failed to load WEBP");
+		return;
+	}
+
+	// The decoder keeps its own copy of the data, so the buffer is reused after every append
+	status = WebPIAppend(idec, s->buf, s->sz);
+	int rows = 0;
+	while (status == VP8_STATUS_SUSPENDED) {
+		WebPIDecodedArea(idec, NULL, NULL, NULL, &rows);
+		atomicStore(&img->rows, rows);
+		s->sz = 0;
+		if ((err = readStream(s)) != NULL || s->eof) break;
+		status = WebPIAppend(idec, s->buf, s->sz);
+	}
+	WebPIDecodedArea(idec, NULL, NULL, NULL, &rows);
+	WebPIDelete(idec);
+
+	// The viewer could already be showing the rows it got, so a truncated image is kept as it is
+	if (status == VP8_STATUS_OK || rows > 0) {
+		atomicStore(&img->rows, rows);
+		return;
+	}
+	free(img->pxs);
+	img->pxs = NULL;
+	imgError(img, err != NULL? err : "Failed to load WEBP");
+}
+
+// Runs fn for every index from 0 to count on all cores, the calling thread takes part as well
+typedef struct {
+	void (*fn)(void *data, int i);
+	void  *data;
+	int    count, next;
+} ParallelTask;
+
+static void *parallelThread(void *data) {
+	ParallelTask *task = data;
+	for (int i; (i = atomicAdd(&task->next, 1)) < task->count;) task->fn(task->data, i);
+	return NULL;
+}
+
+static void runParallel(void (*fn)(void *data, int i), void *data, int count) {
+	ParallelTask task    = {fn, data, count, 0};
+	long         threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (threads > count - 1)   threads = count - 1;
+	if (threads > MAXTHREADS) threads = MAXTHREADS;
+
+	pthread_t ids[MAXTHREADS];
+	int       started = 0;
+	for (; started < threads; ++started)
+		if (pthread_create(&ids[started], NULL, parallelThread, &task) != 0) break;
+	parallelThread(&task);
+	for (int i = 0; i < started; ++i) pthread_join(ids[i], NULL);
+}
+
+// Copies PTF channels at byte offset off of the channel data into RGBA pixels
+static void expandPtf(uint8_t *pxs, const uint8_t *src, size_t off, size_t sz, int ch) {
+	if (ch == 4) {
+		memcpy(pxs + off, src, sz);
+		return;
+	}
+
+	// Pixels split between blocks are copied byte by byte, every byte has its own place in pxs
+	size_t i = 0;
+	for (; i < sz && (off + i)%3 != 0; ++i) pxs[(off + i)/3*4 + (off + i)%3] = src[i];
+	size_t n = (sz - i)/3;
+	kernels.rgbToRgba(pxs + (off + i)/3*4, src + i, n);
+	for (i += n*3; i < sz; ++i) {
+		pxs[(off + i)/3*4 + (off + i)%3] = src[i];
+		if ((off + i)%3 == 0) pxs[(off + i)/3*4 + 3] = 0xFF;
+	}
+}
+
+// LZ4 frame whose blocks don't depend on each other, so they can be decompressed in any order
+typedef struct {
+	const uint8_t **blocks;    // Each starts with its size, like in the frame
+	int             count;
+	size_t          blockMax, sz;
+	bool            checksums; // Each block is followed by its XXH32
+	uint8_t        *pxs;
+	int             ch;
+	int             failed;
+} PtfFrame;
+
+static void decodePtfBlock(void *data, int i) {
+	PtfFrame      *frame = data;
+	const uint8_t *block = frame->blocks[i] + 4;
+	uint32_t       size  = readLe32(block - 4) & 0x7FFFFFFF;
+	size_t         off   = (size_t)i*frame->blockMax;
+	size_t         want  = i == frame->count - 1? frame->sz - off : frame->blockMax;
+	if (frame->checksums && XXH32(block, size, 0) != readLe32(block + size)) {
+		atomicStore(&frame->failed, true);
+		return;
+	}
+
+	// Full RGBA is decompressed straight into the pixels
+	uint8_t *tmp = NULL, *dest = frame->pxs + off;
+	if (frame->ch != 4) dest = tmp = alloc(uint8_t, want);
+	int got = size;
+	if (readLe32(block - 4) & 0x80000000) {
+		if (size == want) memcpy(dest, block, size);
+	} else got = LZ4_decompress_safe((const char*)block, (char*)dest, size, want);
+
+	if (got < 0 || (size_t)got != want) atomicStore(&frame->failed, true);
+	else if (tmp != NULL) expandPtf(frame->pxs, tmp, off, want, frame->ch);
+	free(tmp);
+}
+
+// Returns false if the frame doesn't have independent blocks laid out the way lz4 writes them
+static bool decodePtfParallel(const uint8_t *buf, size_t sz, Image *img, int ch) {
+	if (sz < 7 || readLe32(buf) != 0x184D2204) return false;
+	int flags = buf[4], bd = buf[5];
+	// Version 1, independent blocks, no dictionary
+	if ((flags & 0xC0) != 0x40 || !(flags & 0x20) || (flags & 0x01)) return false;
+
+	PtfFrame frame = {
+		.blockMax  = (size_t)1 << (8 + 2*((bd >> 4) & 7)),
+		.sz        = (size_t)img->w*img->h*ch,
+		.checksums = flags & 0x10,
+		.pxs       = img->pxs,
+		.ch        = ch,
+	};
+	if (frame.blockMax < 64*1024) return false;
+	int blocks = (frame.sz + frame.blockMax - 1)/frame.blockMax;
+	frame.blocks = alloc(const uint8_t*, blocks);
+
+	size_t pos = 7 + (flags & 0x08? 8 : 0);
+	while (pos + 4 <= sz && readLe32(buf + pos) != 0) {
+		size_t size = readLe32(buf + pos) & 0x7FFFFFFF, next = pos + 4 + size + (frame.checksums? 4 : 0);
+		if (frame.count == blocks || next > sz) break;
+		frame.blocks[frame.count++] = buf + pos;
+		pos = next;
+	}
+	bool ok = frame.count == blocks && pos + 4 <= sz && readLe32(buf + pos) == 0;
+	if (ok) runParallel(decodePtfBlock, &frame, blocks);
+	free(frame.blocks);
+	return ok && !frame.failed;
+}
+
+/* Needs the whole frame at once, a file is mapped and anything else is read. Returns false if the
+   frame has to be streamed after all */
+static bool decodePtfFile(FILE *f, long start, Image *img, int ch) {
+	struct stat st;
+	int         fd = fileno(f);
+	if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > start) {
+		uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED) return false;
+		bool ok = decodePtfParallel(map + start, st.st_size - start, img, ch);
+		munmap(map, st.st_size);
+		return ok;
+	}
+
+	long end = -1;
+	if (fseek(f, 0, SEEK_END) == 0) end = ftell(f);
+	if (end <= start || fseek(f, start, SEEK_SET) != 0) return false;
+	size_t   sz  = end - start;
+	uint8_t *buf = alloc(uint8_t, sz);
+	bool     ok  = fread(buf, 1, sz, f) == sz && decodePtfParallel(buf, sz, img, ch);
+	free(buf);
+	return ok;
+}
+
+#define PTFCHUNKSZ (64*1024) // Pixels decompressed at once when streaming
+
+static Error decodePtfStream(FILE *f, Image *img, int ch) {
+	LZ4_readFile_t  *ctx;
+	LZ4F_errorCode_t err;
+	if (LZ4F_isError(err = LZ4F_readOpen(&ctx, f))) return LZ4F_getErrorName(err);
+
+	// Full RGBA is decompressed straight into the pixels, RGB a chunk at a time
+	size_t   sz  = (size_t)img->w*img->h;
+	uint8_t *tmp = ch == 4? NULL : alloc(uint8_t, PTFCHUNKSZ*ch);
+	Error    res = NULL;
+	for (size_t i = 0; i < sz && res == NULL; i += PTFCHUNKSZ) {
+		size_t   n    = sz - i < PTFCHUNKSZ? sz - i : PTFCHUNKSZ;
+		uint8_t *dest = tmp == NULL? img->pxs + i*4 : tmp;
+		size_t   got  = LZ4F_read(ctx, dest, n*ch);
+		if      (LZ4F_isError(got)) res = LZ4F_getErrorName(got);
+		else if (got < n*ch)        res = "PTF file truncated";
+		else if (tmp != NULL)       expandPtf(img->pxs, tmp, i*ch, n*ch, ch);
+	}
+	free(tmp);
+	LZ4F_readClose(ctx);
+	return res;
+}
+
 // https://platinumsrc.github.io/docs/formats/ptf/
 // https://github.com/PlatinumSrc/PlatinumSrc/blob/master/src/psrc/engine/ptf.c
 static void decodePtf(FILE *f, Image *img) {
@@ -130,40 +793,291 @@ static void decodePtf(FILE *f, Image *img) {
 		imgError(img, "Invalid PTF");
 		return;
 	}
-	unsigned w = 1 << (r & 0xF), h = 1 << (r >> 4), ch = (x & 1) + 3, sz = w*h;
+	int ch = (x & 1) + 3;
+	img->w   = 1 << (r & 0xF);
+	img->h   = 1 << (r >> 4);
+	img->pxs = alloc(uint8_t, (size_t)img->w*img->h*4);
+
+	// Frames with independent blocks are decompressed on all cores, others are streamed
+	long    start = ftell(f);
+	uint8_t head[5];
+	bool    indep = start != -1 && fread(head, 1, 5, f) == 5 && (head[4] & 0x20);
+	if (indep && decodePtfFile(f, start, img, ch)) return;
+	Error err = fseek(f, start, SEEK_SET) != 0? strerror(errno) : decodePtfStream(f, img, ch);
+	if (err != NULL) {
+		free(img->pxs);
+		img->pxs = NULL;
+		imgError(img, err);
+	}
+}
+
+#define readLe16(P) ((P)[0] | (P)[1] << 8)
+
+static bool readPnmNumber(const uint8_t *buf, size_t sz, size_t *i, int *res) {
+	// Skip whitespace and comments
+	for (;;) {
+		while (*i < sz && isspace(buf[*i])) ++*i;
+		if (*i < sz && buf[*i] == '#') while (*i < sz && buf[*i] != '\n') ++*i;
+		else break;
+	}
+	if (*i >= sz || !isdigit(buf[*i])) return false;
+
+	int64_t n = 0;
+	while (*i < sz && isdigit(buf[*i])) if ((n = n*10 + buf[(*i)++] - '0') > INT32_MAX) return false;
+	*res = n;
+	return true;
+}
+
+/* The header parsers give where the pixels start, how long a row is in the file, and whether the
+   rows are stored bottom-up */
+typedef struct {
+	size_t off, pitch;
+	bool   bottomUp;
+} RawLayout;
+
+// Only 8-bit binary PGM and PPM, which store exactly the pixels
+static bool parsePnm(const uint8_t *buf, size_t sz, Image *img, RawLayout *layout) {
+	if (sz < 2 || buf[0] != 'P' || (buf[1] != '5' && buf[1] != '6')) return false;
+	size_t i = 2;
+	int    max;
+	if (!readPnmNumber(buf, sz, &i, &img->w) || !readPnmNumber(buf, sz, &i, &img->h)) return false;
+	if (!readPnmNumber(buf, sz, &i, &max) || max != 255) return false;
+	if (i >= sz || !isspace(buf[i])) return false;
+
+	img->raw.fmt  = buf[1] == '5'? RAWGRAY : RAWRGB;
+	layout->off   = i + 1;
+	layout->pitch = (size_t)img->w*(buf[1] == '5'? 1 : 3);
+	return true;
+}
+
+// Only 24-bit BMP without compression, 32-bit ones need their alpha checked like stb_image does
+static bool parseBmp(const uint8_t *buf, size_t sz, Image *img, RawLayout *layout) {
+	if (sz < 54 || buf[0] != 'B' || buf[1] != 'M' || readLe32(buf + 14) < 40) return false;
+	if (readLe16(buf + 26) != 1 || readLe16(buf + 28) != 24 || readLe32(buf + 30) != 0) return false;
+
+	int32_t w = readLe32(buf + 18), h = readLe32(buf + 22);
+	if (w <= 0 || h == 0 || h == INT32_MIN) return false;
 	img->w = w;
-	img->h = h;
+	img->h = h < 0? -h : h;
+
+	// Rows are padded to 4 bytes and stored bottom-up, unless the height is negative
+	img->raw.fmt     = RAWBGR;
+	layout->off      = readLe32(buf + 10);
+	layout->pitch    = ((size_t)w*3 + 3) & ~(size_t)3;
+	layout->bottomUp = h > 0;
+	return true;
+}
 
-	LZ4_readFile_t  *ctx;
-	LZ4F_errorCode_t err;
-	if (LZ4F_isError(err = LZ4F_readOpen(&ctx, f))) {
-		imgError(img, LZ4F_getErrorName(err));
-		return;
+// Only uncompressed true color and grayscale TGA, TGA has no magic so it's checked last
+static bool parseTga(const uint8_t *buf, size_t sz, Image *img, RawLayout *layout) {
+	if (sz < 18 || buf[1] != 0) return false;
+	int bpp = buf[16], ch;
+	if      (buf[2] == 2 && (bpp == 24 || bpp == 32)) ch = bpp/8;
+	else if (buf[2] == 3 && bpp == 8)                ch = 1;
+	else return false;
+	img->w = readLe16(buf + 12);
+	img->h = readLe16(buf + 14);
+	if (img->w == 0 || img->h == 0) return false;
+
+	// Rows are stored bottom-up, unless the descriptor says the origin is at the top
+	img->raw.fmt     = ch == 1? RAWGRAY : ch == 3? RAWBGR : RAWBGRA;
+	layout->off      = 18 + buf[0];
+	layout->pitch    = (size_t)img->w*ch;
+	layout->bottomUp = !(buf[17] & 0x20);
+	return true;
+}
+
+/* Uncompressed PPM, PGM, BMP and TGA files already store the pixels, so big ones are mapped and
+   converted only where they're shown. Returns false if the file has to be decoded instead */
+static bool mapRaw(FILE *f, Image *img) {
+	struct stat st;
+	int         fd = fileno(f); // Files read from memory have no descriptor
+	if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < RAWMINSZ)
+		return false;
+
+	uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return false;
+	size_t    sz     = st.st_size;
+	RawLayout layout = {0};
+	bool      ok     = parsePnm(map, sz, img, &layout) || parseBmp(map, sz, img, &layout) ||
+	                   parseTga(map, sz, img, &layout);
+
+	// All the rows have to be inside of the file
+	size_t row = (size_t)img->w*(img->raw.fmt == RAWGRAY? 1 : img->raw.fmt == RAWBGRA? 4 : 3);
+	if (ok && img->w > 0 && img->h > 0 && layout.off <= sz && layout.pitch >= row) {
+		size_t rows = (sz - layout.off)/layout.pitch;
+		// The last row doesn't need its padding
+		if (rows < (size_t)img->h && (sz - layout.off)%layout.pitch >= row) ++rows;
+		ok = rows >= (size_t)img->h;
+	} else ok = false;
+	if (!ok) {
+		munmap(map, sz);
+		img->w = img->h = 0;
+		return false;
 	}
 
-	uint8_t *pxs = alloc(uint8_t, sz*ch);
-	if (LZ4F_isError(err = LZ4F_read(ctx, pxs, sz*ch))) {
-		LZ4F_readClose(ctx);
-		free(pxs);
-		imgError(img, LZ4F_getErrorName(err));
-		return;
+	ptrdiff_t pitch = layout.pitch;
+	img->raw.map   = map;
+	img->raw.sz    = sz;
+	img->raw.first = map + layout.off + (layout.bottomUp? pitch*(img->h - 1) : 0);
+	img->raw.pitch = layout.bottomUp? -pitch : pitch;
+	img->opaque    = img->raw.fmt != RAWBGRA;
+	// Tiles read a part of each row, and zoomed out only some of the rows, so nothing is read ahead
+	madvise(map, sz, MADV_RANDOM);
+	return true;
+}
+
+static void convertRow(uint8_t *dest, const uint8_t *src, int w, int fmt) {
+	switch (fmt) {
+	case RAWGRAY:
+		for (int x = 0; x < w; ++x, dest += 4) dest[0] = dest[1] = dest[2] = src[x], dest[3] = 0xFF;
+		break;
+	case RAWRGB:  kernels.rgbToRgba(dest, src, w); break;
+	case RAWBGR:  kernels.rgbToRgba(dest, src, w); kernels.swapRb(dest, dest, w); break;
+	case RAWBGRA: kernels.swapRb(dest, src, w); break;
+	case RAWRGBA: memcpy(dest, src, (size_t)w*4); break;
+	default: assert(0 && "Unknown raw pixel format");
 	}
-	LZ4F_readClose(ctx);
+}
+
+// Like convertRow, but only every step-th pixel of src is taken
+static void convertSparseRow(uint8_t *dest, const uint8_t *src, int w, int step, int fmt) {
+	switch (fmt) {
+	case RAWGRAY:
+		for (int x = 0; x < w; ++x, dest += 4, src += step) dest[0] = dest[1] = dest[2] = *src, dest[3] = 0xFF;
+		break;
+	case RAWRGB:
+		for (int x = 0; x < w; ++x, dest += 4, src += step*3)
+			dest[0] = src[0], dest[1] = src[1], dest[2] = src[2], dest[3] = 0xFF;
+		break;
+	case RAWBGR:
+		for (int x = 0; x < w; ++x, dest += 4, src += step*3)
+			dest[0] = src[2], dest[1] = src[1], dest[2] = src[0], dest[3] = 0xFF;
+		break;
+	case RAWBGRA:
+		for (int x = 0; x < w; ++x, dest += 4, src += step*4)
+			dest[0] = src[2], dest[1] = src[1], dest[2] = src[0], dest[3] = src[3];
+		break;
+	case RAWRGBA:
+		for (int x = 0; x < w; ++x, dest += 4, src += step*4) memcpy(dest, src, 4);
+		break;
+	default: assert(0 && "Unknown raw pixel format");
+	}
+}
+
+void copyImageTile(Image *img, int x, int y, int w, int h, int step, uint8_t *dest, int pitch) {
+	static const int chFmts[] = {[1] = RAWGRAY, [3] = RAWRGB, [4] = RAWRGBA};
+	static const int fmtChs[] = {[RAWGRAY] = 1, [RAWRGB] = 3, [RAWBGR] = 3, [RAWBGRA] = 4, [RAWRGBA] = 4};
+	bool mapped = img->raw.map != NULL;
+	int  fmt    = mapped? img->raw.fmt : chFmts[img->ch];
+	for (int i = 0; i < h; ++i, dest += pitch) {
+		int            sy  = y + i*step;
+		const uint8_t *src = mapped? img->raw.first + sy*img->raw.pitch : img->pxs + (size_t)sy*img->w*img->ch;
+		src += (size_t)x*fmtChs[fmt];
+		if (step == 1) convertRow(dest, src, w, fmt);
+		else convertSparseRow(dest, src, w, step, fmt);
+	}
+}
+
+void copyImageRows(Image *img, int y, int h, uint8_t *dest, int pitch) {
+	copyImageTile(img, 0, y, img->w, h, 1, dest, pitch);
+}
 
-	img->pxs = alloc(uint8_t, sz*4);
-	for (unsigned i = 0; i < sz; ++ i) {
-		img->pxs[i*4]     = pxs[i*ch];
-		img->pxs[i*4 + 1] = pxs[i*ch + 1];
-		img->pxs[i*4 + 2] = pxs[i*ch + 2];
-		img->pxs[i*4 + 3] = ch == 4? pxs[i*ch + 3] : 0xFF;
+#define ORIENTBAND 64 // Rows transformed between checks for cancellation
+
+struct Orient {
+	pthread_t thread;
+	Image    *img;
+	uint8_t   rot;
+	bool      flipv, fliph;
+	uint8_t  *pxs;
+	bool      done, cancel; // Access with atomicLoad/atomicStore
+};
+
+/* Flips are done while the rows are copied out, and the rotation that's left is done band by band
+   with the rotate kernel. Half a turn is the same as both flips, so at most a quarter turn is left */
+static void *orientThread(void *data) {
+	Orient *o   = data;
+	Image  *img = o->img;
+	int     w = img->w, h = img->h;
+	bool    half = o->rot >= 2, rot = o->rot%2, flipv = o->flipv != half, fliph = o->fliph != half;
+	bool    rgba = img->pxs != NULL && img->ch == 4;
+
+	uint8_t *band = rot? alloc(uint8_t, (size_t)w*ORIENTBAND*4) : NULL;
+	uint8_t *row  = fliph && !rgba? alloc(uint8_t, (size_t)w*4) : NULL;
+	for (int y = 0; y < h && !atomicLoad(&o->cancel); y += ORIENTBAND) {
+		int      bh   = h - y < ORIENTBAND? h - y : ORIENTBAND;
+		uint8_t *dest = rot? band : o->pxs + (size_t)y*w*4;
+		for (int i = 0; i < bh; ++i, dest += (size_t)w*4) {
+			int sy = flipv? h - 1 - y - i : y + i;
+			if (!fliph) copyImageRows(img, sy, 1, dest, w*4);
+			else if (rgba) kernels.mirror(dest, img->pxs + (size_t)sy*w*4, w);
+			else {
+				copyImageRows(img, sy, 1, row, w*4);
+				kernels.mirror(dest, row, w);
+			}
+		}
+		// Rows y to y + bh become the columns h - y - bh to h - y when rotated clockwise
+		if (rot) kernels.rotate90(o->pxs + (size_t)(h - y - bh)*4, h*4, band, w, bh, true);
 	}
-	free(pxs);
+	free(band);
+	free(row);
+	atomicStore(&o->done, true);
+	return NULL;
+}
+
+void orientImage(Image *img) {
+	assert(isImageLoaded(img) && img->anim == NULL);
+	cancelOrient(img);
+	Orient *o = alloc(Orient, 1);
+	zeroMem(o);
+	o->img   = img;
+	o->rot   = img->rot;
+	o->flipv = img->flipv;
+	o->fliph = img->fliph;
+	o->pxs   = alloc(uint8_t, (size_t)img->w*img->h*4);
+	int err = pthread_create(&o->thread, NULL, orientThread, o);
+	if (err != 0) die("Failed to start image orienting thread: %s", strerror(err));
+	img->orient = o;
+}
+
+uint8_t *takeOrientedImage(Image *img, uint8_t *rot, bool *flipv, bool *fliph) {
+	Orient *o = img->orient;
+	if (o == NULL || !atomicLoad(&o->done)) return NULL;
+	pthread_join(o->thread, NULL);
+	*rot   = o->rot;
+	*flipv = o->flipv;
+	*fliph = o->fliph;
+	uint8_t *pxs = o->pxs;
+	free(o);
+	img->orient = NULL;
+	return pxs;
+}
+
+void cancelOrient(Image *img) {
+	Orient *o = img->orient;
+	if (o == NULL) return;
+	atomicStore(&o->cancel, true);
+	pthread_join(o->thread, NULL);
+	free(o->pxs);
+	free(o);
+	img->orient = NULL;
 }
 
 // JPG, PNG, BMP, WEBP, HDR, TGA, PIC, PSD, PGM, PPM
 static void decodeOther(FILE *f, Image *img) {
-	if ((img->pxs = stbi_load_from_file(f, &img->w, &img->h, NULL, 4)) == NULL)
+	// Grayscale and RGB images keep their channels, they're only expanded to RGBA when uploaded
+	int  ch;
+	long start = ftell(f);
+	if (!stbi_info_from_file(f, &img->w, &img->h, &ch) || ch == 2) ch = 4;
+	fseek(f, start, SEEK_SET);
+
+	if ((img->pxs = stbi_load_from_file(f, &img->w, &img->h, NULL, ch)) == NULL) {
 		imgError(img, stbi_failure_reason());
+		return;
+	}
+	img->ch     = ch;
+	img->opaque = ch < 4;
 }
 
 static Error getMagic(FILE *f, uint8_t *magic) {
@@ -179,8 +1093,7 @@ static Error getMagic(FILE *f, uint8_t *magic) {
 #define isGifMagic(M)  magicEquals3(M, 'G', 'I', 'F')
 #define isPtfMagic(M)  magicEquals4(M, 'P', 'T', 'F', 0)
 
-static void decodeImg(FILE *f, Image *img) {
-	img->isGif = false;
+static void decodeFile(FILE *f, Image *img) {
 	uint8_t magic[4];
 	Error err = getMagic(f, magic);
 	if (err != NULL) {
@@ -188,129 +1101,668 @@ static void decodeImg(FILE *f, Image *img) {
 		return;
 	}
 
-	if      (isWebpMagic(magic)) decodeWebp(f, img);
+	if      (isWebpMagic(magic)) decodeWebp(f, img, NULL);
 	else if (isGifMagic(magic))  decodeGif(f, img);
 	else if (isPtfMagic(magic))  decodePtf(f, img);
-	else decodeOther(f, img);
+	else if (!mapRaw(f, img))    decodeOther(f, img);
+
+	// Plenty of RGBA images don't use their alpha, and those can be drawn without blending
+	if (img->pxs != NULL && img->anim == NULL && img->ch == 4 && !img->opaque)
+		img->opaque = kernels.isOpaque(img->pxs, (size_t)img->w*img->h);
+}
+
+// Only WEBP is decoded while the data arrives, other formats wait for the whole stream
+static void decodeStdin(Image *img) {
+	Stream s   = {.fd = STDIN_FILENO};
+	Error  err = NULL;
+	while (s.sz < 4 && !s.eof && err == NULL) err = readStream(&s);
+	if (err == NULL && s.sz < 4) err = "Invalid image file (failed to read magic bytes)";
+
+	if (err == NULL && isWebpMagic(s.buf)) decodeWebpStream(&s, img);
+	else if (err == NULL && (err = readStreamToEnd(&s)) == NULL) {
+		// The decoders need to seek, which a pipe can't do
+		FILE *f = fmemopen(s.buf, s.sz, "r");
+		if (f == NULL) err = strerror(errno);
+		else {
+			decodeFile(f, img);
+			fclose(f);
+		}
+	}
+	if (err != NULL) imgError(img, err);
+	free(s.buf);
+}
+
+static void resetPixels(Image *img) {
+	img->pxs    = NULL;
+	img->anim   = NULL;
+	img->ch     = 4;
+	img->opaque = false;
+	zeroMem(&img->raw);
+}
+
+static void decodeImg(FILE *f, Image *img) {
+	resetPixels(img);
+	if (f == stdin) decodeStdin(img);
+	else decodeFile(f, img);
+}
+
+static void freePixels(Image *img) {
+	cancelOrient(img); // The worker could still be reading the pixels
+	free(img->pxs);
+	if (img->raw.map != NULL) munmap(img->raw.map, img->raw.sz);
+	zeroMem(&img->raw);
+	if (img->anim != NULL) stopAnim(img->anim);
+	img->anim = NULL;
+	img->hash = 0; // Whatever gets decoded next can be from another version of the file
 }
 
 // Annoying, but threads can only take data that's either global or heap-allocated
 typedef struct {
-	Image *img;
-	FILE  *f;
+	Image    *img;
+	FILE     *f;
+	uint64_t *hash, prevHash; // Only for reloads
 } ImageThreadData;
 
+// Reloads skip decoding if the file is byte for byte the same as the one the pixels came from
+static bool decodeIfChanged(FILE *f, Image *img, uint64_t prevHash, uint64_t *hash) {
+	resetPixels(img);
+	// Big files are hashed through a mapping instead of a copy, so they can still be mapped by decodeFile
+	struct stat st;
+	int         fd = fileno(f);
+	if (fd != -1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= RAWMINSZ) {
+		uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			*hash = XXH64(map, st.st_size, 0);
+			munmap(map, st.st_size);
+			if (*hash == prevHash) return false;
+			decodeFile(f, img);
+			return true;
+		}
+	}
+
+	size_t   sz;
+	uint8_t *buf = imageReadFile(img, f, &sz);
+	if (buf == NULL) return true;
+	if ((*hash = XXH64(buf, sz, 0)) == prevHash) {
+		free(buf);
+		return false;
+	}
+
+	FILE *mem = fmemopen(buf, sz, "r");
+	if (mem == NULL) imgError(img, strerror(errno));
+	else {
+		decodeFile(mem, img);
+		fclose(mem);
+	}
+	free(buf);
+	return true;
+}
+
 static void *imageLoadingThread(void *data) {
-	Image *img = ((ImageThreadData*)data)->img;
-	FILE  *f   = ((ImageThreadData*)data)->f;
- 	free(data);
- 	decodeImg(f, img);
-	fclose(f);
+	ImageThreadData thread = *(ImageThreadData*)data;
+	Image          *img    = thread.img;
+	free(data);
+
+	bool changed = true;
+	if (thread.hash != NULL) changed = decodeIfChanged(thread.f, img, thread.prevHash, thread.hash);
+	else decodeImg(thread.f, img);
+	fclose(thread.f);
+	if (!changed) {
+		atomicStore(&img->state, IMGUNLOADED);
+		return NULL;
+	}
 	if (img->err == NULL && (img->w <= 0 || img->h <= 0)) imgError(img, "Invalid image dimensions");
 
-	lockImage(img);
-	img->loading = false;
-	img->loaded  = img->err == NULL;
-	if (img->loaded && img->deferredUnload) {
-		img->deferredUnload = false;
-		unloadImage(img);
+	if (img->err != NULL) {
+		atomicStore(&img->state, IMGUNLOADED);
+		return NULL;
+	}
+
+	// The image can't be touched once it's published, so remember the animation
+	Anim *anim  = img->anim;
+	int   state = IMGLOADING;
+	if (!atomicCas(&img->state, &state, IMGLOADED)) {
+		// The image went stale while it was loading, so unload it right away
+		assert(state == IMGLOADINGSTALE);
+		freePixels(img);
+		atomicStore(&img->state, IMGUNLOADED);
 	}
-	unlockImage(img);
+
+	// Animations keep the thread around to decode the rest of the frames
+	if (anim != NULL) runAnim(anim);
 	return NULL;
 }
 
-static void startLoadingThread(Image *img, FILE *f) {
+// Nobody ever joins the loading threads, they just publish their result through the image state
+static void startDetachedThread(void *(*fn)(void*), void *data) {
+	pthread_t      thread;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int err = pthread_create(&thread, &attr, fn, data);
+	if (err != 0) die("Failed to start image loading thread: %s", strerror(err));
+	pthread_attr_destroy(&attr);
+}
+
+static void startLoadingThread(Image *img, FILE *f, uint64_t prevHash, uint64_t *hash) {
 	assert(!isImageLoading(img));
 
-	if (img->loaded) unloadImage(img);
-	img->err     = NULL;
-	img->loading = true;
+	if (isImageLoaded(img)) unloadImage(img);
+	img->err  = NULL;
+	img->rows = 0;
+	atomicStore(&img->state, IMGLOADING);
 
 	ImageThreadData *data = alloc(ImageThreadData, 1);
-	data->img = img;
-	data->f   = f;
-	int err = pthread_create(&img->thread, NULL, imageLoadingThread, data);
-	if (err != 0) die("Failed to start image loading thread: %s", strerror(err));
+	data->img      = img;
+	data->f        = f;
+	data->hash     = hash;
+	data->prevHash = prevHash;
+	startDetachedThread(imageLoadingThread, data);
 }
 
-// TODO: Potential race conditions?
-static bool isPathAnImage(const char *path) {
-	struct stat st;
-	if (stat(path, &st) != 0) return false;
-	if (!S_ISREG(st.st_mode)) return false;
+struct Feed {
+	pthread_mutex_t mutex;
+	Image          *img;   // Only until the first frame is loaded into it
+	uint8_t        *ready; // Newest decoded frame that wasn't shown yet
+	int             w, h, ch;
+	bool            opaque;
+};
+
+// Only the first frame of animations is used, the worker never runs so its reference is dropped too
+static void decodeFeedFrame(Feed *feed, const uint8_t *buf, size_t sz) {
+	FILE *f = fmemopen((void*)buf, sz, "r");
+	if (f == NULL) return;
+	Image frame;
+	zeroMem(&frame);
+	resetPixels(&frame);
+	decodeFile(f, &frame);
+	fclose(f);
+	if (frame.anim != NULL) {
+		stopAnim(frame.anim);
+		releaseAnim(frame.anim);
+	}
+	// Broken frames are skipped, the previous one stays on screen
+	if (frame.err != NULL || frame.w <= 0 || frame.h <= 0) {
+		free(frame.pxs);
+		return;
+	}
 
-	FILE *f = fopen(path, "rb");
-	if (f == NULL) return false;
+	if (feed->img != NULL) {
+		feed->img->pxs    = frame.pxs;
+		feed->img->w      = frame.w;
+		feed->img->h      = frame.h;
+		feed->img->ch     = frame.ch;
+		feed->img->opaque = frame.opaque;
+		atomicStore(&feed->img->state, IMGLOADED);
+		feed->img = NULL;
+		return;
+	}
 
-// This makes me wish C had defer
-#define fcloseAndReturn(VAL) do { fclose(f); return VAL; } while (0)
+	pthread_mutex_lock(&feed->mutex);
+	free(feed->ready); // Dropped if the viewer didn't take it in time
+	feed->ready  = frame.pxs;
+	feed->w      = frame.w;
+	feed->h      = frame.h;
+	feed->ch     = frame.ch;
+	feed->opaque = frame.opaque;
+	pthread_mutex_unlock(&feed->mutex);
+}
 
-	uint8_t magic[4];
-	if (getMagic(f, magic) != NULL) fcloseAndReturn(false);
-	if (isPtfMagic(magic)) fcloseAndReturn(true);
+static void *feedThread(void *data) {
+	Feed  *feed = data;
+	Stream s    = {.fd = STDIN_FILENO};
+	Error  err  = NULL;
+	while (err == NULL && !s.eof) {
+		// Wait for some data, then take everything else that's already in the pipe
+		int avail;
+		err = readStream(&s);
+		while (err == NULL && !s.eof && ioctl(s.fd, FIONREAD, &avail) == 0 && avail > 0)
+			err = readStream(&s);
+
+		// Only the newest complete frame is decoded, the ones before it are already stale
+		const uint8_t *newest = NULL;
+		size_t         newestSz = 0, start = 0;
+		while (s.sz - start >= 4 && s.sz - start - 4 >= readLe32(s.buf + start)) {
+			newestSz = readLe32(s.buf + start);
+			newest   = s.buf + start + 4;
+			start   += 4 + newestSz;
+		}
+		if (newest != NULL) decodeFeedFrame(feed, newest, newestSz);
 
-	uint8_t *buf;
-	size_t   sz;
-	if (readFileAtOnce(f, &buf, &sz) != NULL) fcloseAndReturn(false);
-	fclose(f);
+		// Keep the incomplete frame for the next read
+		memmove(s.buf, s.buf + start, s.sz - start);
+		s.sz -= start;
+	}
+	free(s.buf);
 
-#undef fcloseAndReturn
+	// The feed ended without a single frame
+	if (feed->img != NULL) {
+		imgError(feed->img, err != NULL? err : "No frames in the feed");
+		atomicStore(&feed->img->state, IMGUNLOADED);
+	}
+	return NULL;
+}
+
+Feed *startFeed(Image *img) {
+	assert(!isImageLoading(img) && !isImageLoaded(img));
+	img->err  = NULL;
+	img->rows = 0;
+	atomicStore(&img->state, IMGLOADING);
+
+	// The feed runs until stdin ends, and like the loading threads it's never joined or freed
+	Feed *feed = alloc(Feed, 1);
+	zeroMem(feed);
+	feed->img = img;
+	pthread_mutex_init(&feed->mutex, NULL);
+	startDetachedThread(feedThread, feed);
+	return feed;
+}
+
+bool nextFeedFrame(Feed *feed, Image *img) {
+	assert(isImageLoaded(img));
+	pthread_mutex_lock(&feed->mutex);
+	uint8_t *pxs = feed->ready;
+	feed->ready = NULL;
+	if (pxs != NULL) {
+		img->w      = feed->w;
+		img->h      = feed->h;
+		img->ch     = feed->ch;
+		img->opaque = feed->opaque;
+	}
+	pthread_mutex_unlock(&feed->mutex);
+	if (pxs == NULL) return false;
+
+	free(img->pxs);
+	img->pxs = pxs;
+	return true;
+}
+
+#define WEBPHEADERSZ 64 // Enough for the RIFF header and the VP8, VP8L or VP8X chunk header
+
+static bool isFileAnImage(FILE *f) {
+	uint8_t magic[4];
+	if (getMagic(f, magic) != NULL) return false;
+	if (isPtfMagic(magic)) return true;
 
 	/* If we can't even read the size of the image, we assume it is either not an image, or so
-	   corrupted that we just won't classify it as an image */
-	bool isImg = stbi_info_from_memory(buf, sz, NULL, NULL, NULL) ||
-	             WebPGetInfo(buf, sz, NULL, NULL);
-	free(buf);
+	   corrupted that we just won't classify it as an image. Only the header is read, the rest of
+	   the file is left untouched */
+	bool isImg;
+	if (isWebpMagic(magic)) {
+		uint8_t header[WEBPHEADERSZ];
+		isImg = WebPGetInfo(header, fread(header, 1, sizeof(header), f), NULL, NULL);
+	} else isImg = stbi_info_from_file(f, NULL, NULL, NULL);
+	rewind(f);
 	return isImg;
 }
 
-void loadImage(Image *img) {
-	if (!isPathAnImage(img->path)) {
-		imgError(img, "File is not an image");
+// Opens a file relative to the directory, checking whether it's a regular file unless it's known
+static FILE *openFileAt(int dirfd, const char *path, bool isReg) {
+	if (!isReg) {
+		struct stat st;
+		if (fstatat(dirfd, path, &st, 0) != 0) return NULL;
+		if (!S_ISREG(st.st_mode)) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return NULL;
+
+	FILE *f = fdopen(fd, "rb");
+	if (f == NULL) close(fd);
+	return f;
+}
+
+// TODO: Potential race conditions?
+static bool isPathAnImage(int dirfd, const char *path, bool isReg) {
+	FILE *f = openFileAt(dirfd, path, isReg);
+	if (f == NULL) return false;
+	bool isImg = isFileAnImage(f);
+	fclose(f);
+	return isImg;
+}
+
+static const char *internString(Strings *strs, const char *str) {
+	size_t sz = strlen(str) + 1;
+	assert(sz <= STRSCHUNKSZ);
+
+	if (strs->count == 0 || strs->used + sz > STRSCHUNKSZ) {
+		resize(strs->chunks, strs->count + 1);
+		strs->chunks[strs->count++] = alloc(char, STRSCHUNKSZ);
+		strs->used = 0;
+	}
+	char *interned = strs->chunks[strs->count - 1] + strs->used;
+	memcpy(interned, str, sz);
+	strs->used += sz;
+	return interned;
+}
+
+static void freeStrings(Strings *strs) {
+	for (size_t i = 0; i < strs->count; ++i) free(strs->chunks[i]);
+	free(strs->chunks);
+}
+
+static Image *allocImage(ImagePool *pool) {
+	if (pool->freedSz > 0) return pool->freed[--pool->freedSz];
+
+	if (pool->used >= pool->count*IMGPOOLCHUNKSZ) {
+		resize(pool->chunks, pool->count + 1);
+		pool->chunks[pool->count++] = alloc(Image, IMGPOOLCHUNKSZ);
+	}
+	size_t i = pool->used++;
+	return &pool->chunks[i/IMGPOOLCHUNKSZ][i%IMGPOOLCHUNKSZ];
+}
+
+static void freeImage(ImagePool *pool, Image *img) {
+	assert(!isImageLoading(img));
+	if (isImageLoaded(img)) unloadImage(img);
+
+	if (pool->freedSz >= pool->freedCap)
+		resize(pool->freed, pool->freedCap = pool->freedCap == 0? IMGSCHUNKSZ : pool->freedCap*2);
+	pool->freed[pool->freedSz++] = img;
+}
+
+static void freeImagePool(ImagePool *pool) {
+	for (size_t i = 0; i < pool->count; ++i) free(pool->chunks[i]);
+	free(pool->chunks);
+	free(pool->freed);
+}
+
+/* Normalizes the path and makes it relative to the browsing directory if it's inside of it. Only
+   the parent directory gets resolved, the file name is kept as is, same as in the directory scan */
+static void normalizeImagePath(Images *imgs, const char *path, char *buf) {
+	if (!*path) {
+		*buf = 0;
 		return;
 	}
 
-	FILE *f = fopen(img->path, "rb");
+	char        dirPath[PATH_MAX], normPath[PATH_MAX];
+	const char *name = strrchr(path, '/');
+	if (name == NULL) {
+		strcpy(dirPath, ".");
+		name = path;
+	} else {
+		size_t len = name == path? 1 : (size_t)(name - path); // Keep the slash of the root directory
+		memcpy(dirPath, path, len);
+		dirPath[len] = 0;
+		++name;
+	}
+
+	if (realpath(dirPath, normPath) == NULL)
+		die("Failed to normalize image path \"%s\": %s", path, strerror(errno));
+	size_t len = strlen(normPath);
+	if (normPath[len - 1] != '/') strcpy(normPath + len, "/");
+	strcat(normPath, name);
+
+	if (strncmp(normPath, imgs->dir, imgs->dirLen) == 0 && normPath[imgs->dirLen] != 0)
+		strcpy(buf, normPath + imgs->dirLen);
+	else strcpy(buf, normPath);
+}
+
+static bool isPathRelative(const char *path) {
+	return *path && *path != '/';
+}
+
+void getImagePath(Images *imgs, Image *img, char *buf) {
+	if (isPathRelative(img->path)) {
+		strcpy(buf, imgs->dir);
+		strcat(buf, img->path);
+	} else strcpy(buf, img->path);
+}
+
+static Image *newImage(Images *imgs, const char *normPath) {
+	Image *img = allocImage(&imgs->pool);
+	zeroMem(img);
+	img->path = *normPath? internString(&imgs->strs, normPath) : IMGSTDIN;
+	return img;
+}
+
+void loadImage(Images *imgs, Image *img) {
+	FILE *f = openFileAt(imgs->dirfd, img->path, false);
 	if (f == NULL) {
 		imgError(img, strerror(errno));
 		return;
 	}
-	startLoadingThread(img, f);
+	if (!isFileAnImage(f)) {
+		fclose(f);
+		imgError(img, "File is not an image");
+		return;
+	}
+	startLoadingThread(img, f, 0, NULL);
 }
 
 void loadImageFromStdin(Image *img) {
-	startLoadingThread(img, stdin);
+	startLoadingThread(img, stdin, 0, NULL);
 }
 
 void unloadImage(Image *img) {
-	assert(img->loaded);
-	img->loaded = false;
+	assert(isImageLoaded(img));
+	atomicStore(&img->state, IMGUNLOADED);
+	freePixels(img);
+}
 
-	/* Probably don't need to join the thread at this point
-	int err = pthread_join(img->thread);
-	if (err != 0) die("Failed to join image thread: %s", strerror(err));
-	*/
+static uint64_t getMonotonicMs(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000 + t.tv_nsec/1000000;
+}
 
-	free(img->pxs);
-	if (img->isGif) free(img->delays);
+bool updateReload(Images *imgs) {
+	Image *reload = &imgs->reload, *img = imgs->reloaded;
+	if (isImageLoading(reload)) return false;
+
+	bool swapped = false;
+	if (img != NULL) {
+		imgs->reloaded = NULL;
+		// If the new version failed to load, it was probably still being written, so keep the old one
+		if (isImageLoaded(reload)) {
+			atomicStore(&reload->state, IMGUNLOADED);
+			if (isImageLoaded(img)) {
+				freePixels(img);
+				img->w      = reload->w;
+				img->h      = reload->h;
+				img->pxs    = reload->pxs;
+				img->anim   = reload->anim;
+				img->raw    = reload->raw;
+				img->ch     = reload->ch;
+				img->opaque = reload->opaque;
+				img->hash   = imgs->newHash;
+				swapped     = img == imgs->pinned;
+			} else freePixels(reload);
+		}
+	}
+
+	if (imgs->reloadAt == 0 || getMonotonicMs() < imgs->reloadAt) return swapped;
+	imgs->reloadAt = 0;
+	if (imgs->pinned == NULL || !isImageLoaded(imgs->pinned)) return swapped;
+
+	FILE *f = openFileAt(imgs->dirfd, imgs->pinned->path, false);
+	if (f == NULL) return swapped; // The write that finishes the file will trigger another reload
+	imgs->reloaded = imgs->pinned;
+	startLoadingThread(reload, f, imgs->pinned->hash, &imgs->newHash);
+	return swapped;
+}
+
+// Returns false if the image has already finished loading
+static bool markImageStale(Image *img) {
+	int state = IMGLOADING;
+	return atomicCas(&img->state, &state, IMGLOADINGSTALE) || state == IMGLOADINGSTALE;
+}
+
+static ImagesNode *newImagesNode(bool leaf) {
+	ImagesNode *node = alloc(ImagesNode, 1);
+	node->leaf  = leaf;
+	node->len   = 0;
+	node->count = 0;
+	node->first = NULL;
+	return node;
+}
+
+static void freeImagesNode(ImagesNode *node) {
+	if (!node->leaf) for (int i = 0; i < node->len; ++i) freeImagesNode(node->as.nodes[i]);
+	free(node);
+}
+
+static void updateImagesNode(ImagesNode *node) {
+	if (node->leaf) {
+		node->count = node->len;
+		node->first = node->len > 0? node->as.imgs[0] : NULL;
+		return;
+	}
+
+	node->count = 0;
+	for (int i = 0; i < node->len; ++i) node->count += node->as.nodes[i]->count;
+	node->first = node->len > 0? node->as.nodes[0]->first : NULL;
+}
+
+// Finds the child which contains the image at idx, and makes idx relative to that child
+static int findImagesNodeChild(ImagesNode *node, size_t *idx) {
+	assert(!node->leaf);
+
+	int i;
+	for (i = 0; i < node->len - 1 && *idx >= node->as.nodes[i]->count; ++i)
+		*idx -= node->as.nodes[i]->count;
+	return i;
+}
+
+// Moves the upper half of an overflowing node into a new node, which is returned
+static ImagesNode *splitImagesNode(ImagesNode *node) {
+	ImagesNode *right = newImagesNode(node->leaf);
+	int half = node->len/2;
+	right->len = node->len - half;
+	node->len  = half;
+	if (node->leaf) memcpy(right->as.imgs,  node->as.imgs  + half, right->len*sizeof(Image*));
+	else            memcpy(right->as.nodes, node->as.nodes + half, right->len*sizeof(ImagesNode*));
+	updateImagesNode(node);
+	updateImagesNode(right);
+	return right;
+}
+
+// Returns the new right sibling if the node had to be split
+static ImagesNode *insertIntoImagesNode(ImagesNode *node, Image *img, size_t idx) {
+	if (node->leaf) {
+		assert(idx <= (size_t)node->len);
+		memmove(node->as.imgs + idx + 1, node->as.imgs + idx, (node->len++ - idx)*sizeof(Image*));
+		node->as.imgs[idx] = img;
+	} else {
+		// Inserting at the end of a child is the same as inserting at the start of the next one
+		int i = findImagesNodeChild(node, &idx);
+		ImagesNode *right = insertIntoImagesNode(node->as.nodes[i], img, idx);
+		if (right != NULL) {
+			memmove(node->as.nodes + i + 2, node->as.nodes + i + 1,
+			        (node->len++ - i - 1)*sizeof(ImagesNode*));
+			node->as.nodes[i + 1] = right;
+		}
+	}
+	updateImagesNode(node);
+	return node->len > IMGSNODESZ? splitImagesNode(node) : NULL;
+}
+
+static void mergeImagesNodes(ImagesNode *node, int i) {
+	ImagesNode *left = node->as.nodes[i], *right = node->as.nodes[i + 1];
+	if (left->leaf) memcpy(left->as.imgs + left->len, right->as.imgs, right->len*sizeof(Image*));
+	else memcpy(left->as.nodes + left->len, right->as.nodes, right->len*sizeof(ImagesNode*));
+	left->len += right->len;
+	right->len = 0;
+	freeImagesNode(right);
+	updateImagesNode(left);
+
+	memmove(node->as.nodes + i + 1, node->as.nodes + i + 2, (--node->len - i - 1)*sizeof(ImagesNode*));
+}
+
+static Image *removeFromImagesNode(ImagesNode *node, size_t idx) {
+	Image *img;
+	if (node->leaf) {
+		assert(idx < (size_t)node->len);
+		img = node->as.imgs[idx];
+		memmove(node->as.imgs + idx, node->as.imgs + idx + 1, (--node->len - idx)*sizeof(Image*));
+	} else {
+		int i = findImagesNodeChild(node, &idx);
+		ImagesNode *child = node->as.nodes[i];
+		img = removeFromImagesNode(child, idx);
+
+		/* Nodes are not rebalanced by borrowing, but underfull nodes get merged with a neighbour
+		   when they fit into one node, which keeps the tree dense enough */
+		if (child->len == 0) {
+			freeImagesNode(child);
+			memmove(node->as.nodes + i, node->as.nodes + i + 1, (--node->len - i)*sizeof(ImagesNode*));
+		} else if (child->len < IMGSNODESZ/4) {
+			if      (i > 0 && node->as.nodes[i - 1]->len + child->len <= IMGSNODESZ)
+				mergeImagesNodes(node, i - 1);
+			else if (i < node->len - 1 && node->as.nodes[i + 1]->len + child->len <= IMGSNODESZ)
+				mergeImagesNodes(node, i);
+		}
+	}
+	updateImagesNode(node);
+	return img;
 }
 
 static void insertImage(Images *imgs, Image *img, int idx) {
 	assert((size_t)idx <= imgs->sz);
 
-	if (imgs->sz >= imgs->cap) resize(imgs->raw, imgs->cap *= 2);
-	for (size_t i = ++imgs->sz; i --> (size_t)idx + 1;) imgs->raw[i] = imgs->raw[i - 1];
-	imgs->raw[idx] = img;
+	ImagesNode *right = insertIntoImagesNode(imgs->root, img, idx);
+	if (right != NULL) {
+		ImagesNode *root = newImagesNode(false);
+		root->as.nodes[root->len++] = imgs->root;
+		root->as.nodes[root->len++] = right;
+		updateImagesNode(root);
+		imgs->root = root;
+	}
+	++imgs->sz;
 }
 
-static void removeImage(Images *imgs, int idx) {
-	assert((size_t)idx <= imgs->sz);
+static void compactStrings(Images *imgs);
 
-	freeImage(imgs->raw[idx]);
+static void removeImage(Images *imgs, int idx) {
+	assert((size_t)idx < imgs->sz);
+
+	Image *img = removeFromImagesNode(imgs->root, idx);
+	if (!imgs->root->leaf && imgs->root->len == 1) {
+		ImagesNode *root = imgs->root->as.nodes[0];
+		imgs->root->len = 0;
+		freeImagesNode(imgs->root);
+		imgs->root = root;
+	}
 	--imgs->sz;
-	for (size_t i = idx; i < imgs->sz; ++i) imgs->raw[i] = imgs->raw[i + 1];
+
+	if (*img->path) imgs->strs.wasted += strlen(img->path) + 1;
+	freeImage(&imgs->pool, img);
+	// When most of the string arena is made of dead strings, it's worth moving the live ones
+	if (imgs->strs.wasted > STRSCHUNKSZ && imgs->strs.wasted > imgs->strs.count*STRSCHUNKSZ/2)
+		compactStrings(imgs);
+}
+
+Image *getImage(Images *imgs, int idx) {
+	assert((size_t)idx < imgs->sz);
+
+	size_t      i    = idx;
+	ImagesNode *node = imgs->root;
+	while (!node->leaf) node = node->as.nodes[findImagesNodeChild(node, &i)];
+	return node->as.imgs[i];
+}
+
+static void reinternImagesNode(ImagesNode *node, Strings *strs) {
+	if (!node->leaf) {
+		for (int i = 0; i < node->len; ++i) reinternImagesNode(node->as.nodes[i], strs);
+		return;
+	}
+	for (int i = 0; i < node->len; ++i) {
+		Image *img = node->as.imgs[i];
+		if (*img->path) img->path = internString(strs, img->path);
+	}
+}
+
+// Only the main thread ever reads the image paths, so they can be moved safely
+static void compactStrings(Images *imgs) {
+	Strings strs = {0};
+	reinternImagesNode(imgs->root, &strs);
+	freeStrings(&imgs->strs);
+	imgs->strs = strs;
 }
 
+// Returns 1 if a goes first, 0 if b does, or 2 if they're equal
 static int cmpNames(const char *a, const char *b) {
 	// Which goes first in alphabetical order?
 	int i;
@@ -320,105 +1772,317 @@ static int cmpNames(const char *a, const char *b) {
 	}
 
 	// Which is shorter?
-	if (a[i] != 0 || a[i] != 0) return a[i] == 0;
+	if (a[i] != 0 || b[i] != 0) return a[i] == 0;
 
 	// Which has lowercase letters?
-	for (i = 0; a[i] != 0; ++i) if (isalpha(a[i]) && a[i] != b[i]) return islower(a[i]);
+	for (i = 0; a[i] != 0; ++i) if (isalpha(a[i]) && a[i] != b[i]) return islower(a[i]) != 0;
 
 	return 2; // They're equal
 }
 
-static void swapImages(Images *imgs, size_t a, size_t b) {
-	Image *tmp = imgs->raw[a];
-	imgs->raw[a] = imgs->raw[b];
-	imgs->raw[b] = tmp;
+static int cmpPaths(Images *imgs, const char *a, const char *b) {
+	// Relative paths share the browsing directory prefix, so there's no need to build full paths
+	if (isPathRelative(a) == isPathRelative(b)) return cmpNames(a, b);
+
+	char fullA[PATH_MAX], fullB[PATH_MAX];
+	strcpy(fullA, isPathRelative(a)? imgs->dir : "");
+	strcat(fullA, a);
+	strcpy(fullB, isPathRelative(b)? imgs->dir : "");
+	strcat(fullB, b);
+	return cmpNames(fullA, fullB);
+}
+
+static void swapImages(Image **arr, int a, int b) {
+	Image *tmp = arr[a];
+	arr[a] = arr[b];
+	arr[b] = tmp;
 }
 
-static size_t quicksortImagesPartition(Images *imgs, int begin, int end) {
+static bool isImageBefore(Images *imgs, Image *a, Image *b) {
+	return cmpPaths(imgs, a->path, b->path) == 1;
+}
+
+/* The median of the first, middle and last images is the pivot, so names that readdir already gives
+   sorted or reversed still split in half */
+static int quicksortImagesPartition(Images *imgs, Image **arr, int begin, int end) {
+	int mid = begin + (end - begin)/2;
+	if (isImageBefore(imgs, arr[mid], arr[begin])) swapImages(arr, mid, begin);
+	if (isImageBefore(imgs, arr[end], arr[begin])) swapImages(arr, end, begin);
+	if (isImageBefore(imgs, arr[mid], arr[end]))   swapImages(arr, mid, end);
+
 	int pivot = begin - 1;
 	for (int i = begin; i < end; ++i)
-		if (!cmpNames(imgs->raw[end]->path, imgs->raw[i]->path)) swapImages(imgs, i, ++pivot);
-	swapImages(imgs, end, ++pivot);
+		if (!cmpPaths(imgs, arr[end]->path, arr[i]->path)) swapImages(arr, i, ++pivot);
+	swapImages(arr, end, ++pivot);
 	return pivot;
 }
 
-static void quicksortImages(Images *imgs, int begin, int end) {
-	if (begin >= end) return;
-	int pivot = quicksortImagesPartition(imgs, begin, end);
-	quicksortImages(imgs, begin,     pivot - 1);
-	quicksortImages(imgs, pivot + 1, end);
+// Only the smaller side is recursed into, so the stack stays logarithmic even for bad pivots
+static void quicksortImages(Images *imgs, Image **arr, int begin, int end) {
+	while (begin < end) {
+		int pivot = quicksortImagesPartition(imgs, arr, begin, end);
+		if (pivot - begin < end - pivot) {
+			quicksortImages(imgs, arr, begin, pivot - 1);
+			begin = pivot + 1;
+		} else {
+			quicksortImages(imgs, arr, pivot + 1, end);
+			end = pivot - 1;
+		}
+	}
+}
+
+// Builds the tree bottom up from sorted images, leaving some space in the nodes for insertions
+static ImagesNode *buildImagesTree(Image **arr, size_t sz) {
+	const size_t fill = IMGSNODESZ*3/4;
+
+	size_t       len   = (sz + fill - 1)/fill;
+	ImagesNode **level = alloc(ImagesNode*, len > 0? len : 1);
+	for (size_t i = 0; i < len; ++i) {
+		ImagesNode *node = level[i] = newImagesNode(true);
+		node->len = i == len - 1? sz - i*fill : fill;
+		memcpy(node->as.imgs, arr + i*fill, node->len*sizeof(Image*));
+		updateImagesNode(node);
+	}
+	if (len == 0) level[len++] = newImagesNode(true);
+
+	while (len > 1) {
+		size_t parents = (len + fill - 1)/fill;
+		for (size_t i = 0; i < parents; ++i) {
+			ImagesNode *node = newImagesNode(false);
+			node->len = i == parents - 1? len - i*fill : fill;
+			memcpy(node->as.nodes, level + i*fill, node->len*sizeof(ImagesNode*));
+			updateImagesNode(node);
+			level[i] = node;
+		}
+		len = parents;
+	}
+
+	ImagesNode *root = *level;
+	free(level);
+	return root;
+}
+
+// Makes dirPath the browsing directory, nothing changes if it can't be opened
+static Error openImagesDir(Images *imgs, const char *dirPath) {
+	char dir[PATH_MAX];
+	int  dirfd = open(dirPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd == -1) return strerror(errno);
+	if (realpath(dirPath, dir) == NULL) {
+		close(dirfd);
+		return strerror(errno);
+	}
+
+	if (imgs->dirfd != -1) close(imgs->dirfd);
+	imgs->dirfd = dirfd;
+	strcpy(imgs->dir, dir);
+	imgs->dirLen = strlen(imgs->dir);
+	if (imgs->dir[imgs->dirLen - 1] != '/') strcpy(imgs->dir + imgs->dirLen++, "/");
+
+	if (imgs->fd == -1) return NULL; // inotify couldn't be set up in initImages
+	if (imgs->wd != -1) inotify_rm_watch(imgs->fd, imgs->wd);
+	if ((imgs->wd = inotify_add_watch(imgs->fd, dirPath, IN_CLOSE_WRITE | IN_DELETE)) == -1)
+		return strerror(errno);
+	return NULL;
 }
 
 Error initImages(Images *imgs, const char *dirPath) {
-	imgs->path = dirPath;
-	imgs->sz   = 0;
-	imgs->raw  = alloc(Image*, imgs->cap = IMGSCHUNKSZ);
+	zeroMem(imgs);
+	imgs->root = newImagesNode(true);
+	imgs->fd   = imgs->wd = imgs->dirfd = -1;
+
+	// The directory is opened either way, only watching it depends on inotify
+	Error err    = (imgs->fd = inotify_init()) == -1? strerror(errno) : NULL;
+	Error dirErr = openImagesDir(imgs, dirPath);
+	return dirErr != NULL? dirErr : err;
+}
+
+Error changeImagesDir(Images *imgs, const char *dirPath) {
+	char   oldDir[PATH_MAX];
+	size_t oldLen = imgs->dirLen;
+	strcpy(oldDir, imgs->dir);
+	Error err = openImagesDir(imgs, dirPath);
+	if (imgs->dirLen == oldLen && strcmp(imgs->dir, oldDir) == 0) return err;
+
+	/* Images in the new directory keep their records and whatever is decoded of them, the rest are
+	   dropped. The ones still loading can't be freed yet, so they're only taken out of the list */
+	size_t  sz = 0;
+	Image **arr = alloc(Image*, imgs->sz > 0? imgs->sz : 1);
+	for (size_t i = 0; i < imgs->sz; ++i) {
+		Image *img = getImage(imgs, i);
+		char   path[PATH_MAX];
+		strcpy(path, isPathRelative(img->path)? oldDir : "");
+		strcat(path, img->path);
+		const char *name = path + imgs->dirLen;
+
+		if (!*img->path) arr[sz++] = img; // Stdin isn't in any directory
+		else if (strncmp(path, imgs->dir, imgs->dirLen) == 0 && *name && strchr(name, '/') == NULL) {
+			imgs->strs.wasted += strlen(img->path) + 1;
+			img->path = internString(&imgs->strs, name);
+			arr[sz++] = img;
+		} else {
+			imgs->strs.wasted += strlen(img->path) + 1;
+			if (img == imgs->pinned) imgs->pinned = NULL;
+			if (img == imgs->reloaded) {
+				imgs->reloaded = NULL;
+				imgs->reloadAt = 0;
+			}
+			if (!markImageStale(img)) freeImage(&imgs->pool, img);
+		}
+	}
+
+	if (sz > 1) quicksortImages(imgs, arr, 0, sz - 1);
+	freeImagesNode(imgs->root);
+	imgs->root = buildImagesTree(arr, sz);
+	imgs->sz   = sz;
+	free(arr);
+	if (imgs->strs.wasted > STRSCHUNKSZ && imgs->strs.wasted > imgs->strs.count*STRSCHUNKSZ/2)
+		compactStrings(imgs);
+
+	Error scanErr = scanImages(imgs);
+	return err != NULL? err : scanErr;
+}
 
-	DIR *dir = opendir(imgs->path);
-	if (dir == NULL) return strerror(errno);
+Error scanImages(Images *imgs) {
+	if (imgs->dirfd == -1) return NULL;
+
+	// closedir closes the file descriptor, so give it a duplicate
+	int fd = dup(imgs->dirfd);
+	if (fd == -1) return strerror(errno);
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL) {
+		close(fd);
+		return strerror(errno);
+	}
+
+	size_t  sz = 0, cap = IMGSCHUNKSZ;
+	Image **arr = alloc(Image*, cap);
 
 	struct dirent *ent;
 	while ((ent = readdir(dir)) != NULL) {
-		char path[PATH_MAX]; // Using these static buffers should be ok, realpath uses them too
-		strcpy(path, dirPath);
-		strcat(path, "/");
-		strcat(path, ent->d_name);
-
 		// man readdir(3) says not all filesystems support d_type and they might return DT_UNKNOWN
 		if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN) continue;
-		if (isPathAnImage(path)) {
-			if (imgs->sz >= imgs->cap) resize(imgs->raw, imgs->cap *= 2);
-			imgs->raw[imgs->sz++] = newImage(path);
+		if (isPathAnImage(imgs->dirfd, ent->d_name, ent->d_type == DT_REG)) {
+			if (sz >= cap) resize(arr, cap *= 2);
+			arr[sz++] = newImage(imgs, ent->d_name);
 		}
 	}
-	if (imgs->sz > 1) quicksortImages(imgs, 0, imgs->sz - 1);
 	closedir(dir);
 
-	if ((imgs->fd = inotify_init()) == -1) return strerror(errno);
-	if ((imgs->wd = inotify_add_watch(imgs->fd, imgs->path, IN_CLOSE_WRITE | IN_DELETE)) == -1)
-		return strerror(errno);
+	// Sorting the images first and building the tree at once is much faster than inserting
+	if (sz > 1) quicksortImages(imgs, arr, 0, sz - 1);
+
+	/* Images added before the scan can already be loading, so they're merged in and kept in place
+	   of the ones the scan found for the same files */
+	Image **merged = alloc(Image*, sz + imgs->sz);
+	size_t  len = 0, i = 0, j = 0;
+	while (i < sz || j < imgs->sz) {
+		Image *added = j < imgs->sz? getImage(imgs, j) : NULL;
+		int    cmp   = i == sz? 0 : added == NULL? 1 : cmpPaths(imgs, arr[i]->path, added->path);
+		if (cmp == 1) merged[len++] = arr[i++];
+		else {
+			if (cmp == 2) {
+				imgs->strs.wasted += strlen(arr[i]->path) + 1;
+				freeImage(&imgs->pool, arr[i++]);
+			}
+			merged[len++] = added;
+			++j;
+		}
+	}
+	free(arr);
+
+	freeImagesNode(imgs->root);
+	imgs->root = buildImagesTree(merged, len);
+	imgs->sz   = len;
+	free(merged);
 	return NULL;
 }
 
+static bool unloadImagesNode(ImagesNode *node) {
+	bool loading = false;
+	if (!node->leaf) {
+		for (int i = 0; i < node->len; ++i) loading |= unloadImagesNode(node->as.nodes[i]);
+		return loading;
+	}
+
+	for (int i = 0; i < node->len; ++i) {
+		Image *img = node->as.imgs[i];
+		if (isImageLoading(img)) loading = true;
+		else if (isImageLoaded(img)) unloadImage(img);
+	}
+	return loading;
+}
+
 void freeImages(Images *imgs) {
 	if (imgs->fd != -1) {
 		if (imgs->wd != -1) if (inotify_rm_watch(imgs->fd, imgs->wd) != 0)
 			die("Failed to remove inotify watch: %s", strerror(errno));
 		if (close(imgs->fd) != 0) die("Failed to close inotify: %s", strerror(errno));
 	}
-
-	for (size_t i = 0; i < imgs->sz; ++i) freeImage(imgs->raw[i]);
-	free(imgs->raw);
+	if (imgs->dirfd != -1) close(imgs->dirfd);
+
+	/* If an image is still loading, its thread is going to write into the pool, so just leak the
+	   pool. If images are beeing free'd, the program is probably about to quit anyways */
+	if (!unloadImagesNode(imgs->root)) freeImagePool(&imgs->pool);
+	if (isImageLoaded(&imgs->reload)) unloadImage(&imgs->reload);
+	freeImagesNode(imgs->root);
+	freeStrings(&imgs->strs);
 }
 
-bool searchImageByName(Images *imgs, const char *path, int *idx) {
-	if (imgs->sz == 0) {
-		*idx = 0;
-		return false;
+// When not found, idx is where the image would have been or should be inserted at
+static bool searchNormalizedImage(Images *imgs, const char *normPath, int *idx) {
+	size_t      offset = 0;
+	ImagesNode *node   = imgs->root;
+	while (!node->leaf) {
+		// Find the last child whose first image doesn't go after the searched one
+		int begin = 1, end = node->len - 1, child = 0;
+		while (begin <= end) {
+			int mid = begin + (end - begin)/2;
+			if (cmpPaths(imgs, normPath, node->as.nodes[mid]->first->path) == 1) end = mid - 1;
+			else {
+				child = mid;
+				begin = mid + 1;
+			}
+		}
+		for (int i = 0; i < child; ++i) offset += node->as.nodes[i]->count;
+		node = node->as.nodes[child];
 	}
 
-	char normPath[PATH_MAX];
-	normalizeImagePath(path, normPath);
-
 	// Binary search
-	int begin = 0, end = imgs->sz - 1;
+	int begin = 0, end = node->len - 1;
 	while (begin <= end) {
-		*idx = begin + (end - begin)/2;
-		switch (cmpNames(imgs->raw[*idx]->path, normPath)) {
-		case 2: return true; // Equal
-		case 1: begin = *idx + 1; break;
-		case 0: end   = *idx - 1; break;
+		int mid = begin + (end - begin)/2;
+		switch (cmpPaths(imgs, node->as.imgs[mid]->path, normPath)) {
+		case 2:
+			*idx = offset + mid;
+			return true; // Equal
+		case 1: begin = mid + 1; break;
+		case 0: end   = mid - 1; break;
 		}
 	}
-
-	// When not found, idx is where the image would have been or should be inserted at
-	*idx += cmpNames(imgs->raw[*idx]->path, normPath);
+	*idx = offset + begin;
 	return false;
 }
 
+bool searchImageByName(Images *imgs, const char *path, int *idx) {
+	char normPath[PATH_MAX];
+	normalizeImagePath(imgs, path, normPath);
+	return searchNormalizedImage(imgs, normPath, idx);
+}
+
+int getImageIndex(Images *imgs, Image *img) {
+	int idx;
+	bool found = searchNormalizedImage(imgs, img->path, &idx);
+	assert(found);
+	unused(found);
+	return idx;
+}
+
 int getOrAddImage(Images *imgs, const char *path) {
+	char normPath[PATH_MAX];
+	normalizeImagePath(imgs, path, normPath);
+
 	int idx;
-	if (!searchImageByName(imgs, path, &idx)) insertImage(imgs, newImage(path), idx);
+	if (!searchNormalizedImage(imgs, normPath, &idx)) insertImage(imgs, newImage(imgs, normPath), idx);
 	return idx;
 }
 
@@ -435,27 +2099,34 @@ Error watchImages(Images *imgs) {
 	struct inotify_event *e;
 	for (int off = 0; off < sz; off += sizeof(*e) + e->len) {
 		e = (struct inotify_event*)(buf + off);
-		char path[PATH_MAX];
+		if (e->wd != imgs->wd) continue; // Left over from a previous browsing directory
+		// Event names are relative to the watched directory, same as the image paths
 		if (e->mask & IN_CLOSE_WRITE) {
-			normalizeImagePath(e->name, path);
 			/* Creation and modification are very similar actions, because creation could have the
 			   same effect - if a loaded image got deleted from the disk, we keep it loaded, so if
 			   it gets re-created, for us it's as if it got modified */
 			int idx;
-			if (searchImageByName(imgs, path, &idx)) {
-				Image *img = imgs->raw[idx];
-				if      (isImageLoaded(img))  unloadImage(img);
-				else if (isImageLoading(img)) img->deferredUnload = true;
-			} else if (isPathAnImage(path)) insertImage(imgs, newImage(path), idx);
+			if (searchNormalizedImage(imgs, e->name, &idx)) {
+				Image *img = getImage(imgs, idx);
+				// In watch mode, the shown image keeps its pixels until the new version is decoded
+				if (imgs->watchReload && img == imgs->pinned && isImageLoaded(img)) {
+					uint64_t now = getMonotonicMs();
+					if (imgs->reloadAt == 0) imgs->reloadFirst = now;
+					imgs->reloadAt = now + RELOADDELAY;
+					if (imgs->reloadAt > imgs->reloadFirst + RELOADMAXDELAY)
+						imgs->reloadAt = imgs->reloadFirst + RELOADMAXDELAY;
+				} else if (!markImageStale(img)) if (isImageLoaded(img)) unloadImage(img);
+			} else if (isPathAnImage(imgs->dirfd, e->name, false))
+				insertImage(imgs, newImage(imgs, e->name), idx);
 		} else if (e->mask & IN_DELETE) {
-			normalizeImagePath(e->name, path);
 			int idx;
-			if (!searchImageByName(imgs, path, &idx)) continue;
+			if (!searchNormalizedImage(imgs, e->name, &idx)) continue;
 			/* Do not delete the image if it's loaded or still loading, because that means the
 			   viewer might currently be viewing it */
 			/* TODO: A way to signal to the viewer when an image is deleted, so that this can
 			         delete loaded images too? */
-			if (isImageLoaded(imgs->raw[idx]) || isImageLoading(imgs->raw[idx])) continue;
+			Image *img = getImage(imgs, idx);
+			if (img == imgs->pinned || isImageLoaded(img) || isImageLoading(img)) continue;
 			removeImage(imgs, idx);
 		}
 	}
@@ -1,80 +1,212 @@
 #ifndef LOADER_H_HEADER_GUARD
 #define LOADER_H_HEADER_GUARD
 
-#include <stdio.h>        // fopen, fclose, stdin, fseek, ftell, rewind, fread, fgetc
+#include <stdio.h>        // fdopen, fmemopen, fclose, stdin, fseek, ftell, rewind, fread, fgetc
 #include <stdlib.h>       // realpath
 #include <stdbool.h>      // bool, true, false
-#include <stdint.h>       // uint8_t, uint64_t
-#include <string.h>       // strerror, strcpy, strcat
-#include <ctype.h>        // isalpha, tolower
+#include <stdint.h>       // uint8_t, uint64_t, INT32_MAX
+#include <stddef.h>       // ptrdiff_t
+#include <string.h>       // strerror, strcpy, strcat, strrchr
+#include <ctype.h>        // isalpha, tolower, isspace, isdigit
 #include <errno.h>        // errno
 #include <assert.h>       // assert
-#include <dirent.h>       // opendir, closedir, readdir
-#include <pthread.h>      // pthread_*, pthread_mutex_*
-#include <unistd.h>       // close
-#include <sys/stat.h>     // stat
+#include <dirent.h>       // fdopendir, closedir, readdir
+#include <pthread.h>      // pthread_*
+#include <unistd.h>       // close, dup, read, sysconf, STDIN_FILENO
+#include <fcntl.h>        // open, openat, O_*
+#include <sys/stat.h>     // fstatat, fstat
+#include <sys/mman.h>     // mmap, munmap, madvise
 #include <sys/inotify.h>  // inotify_*
 #include <sys/ioctl.h>    // ioctl
+#include <time.h>         // clock_gettime, CLOCK_MONOTONIC
 #include <linux/limits.h> // PATH_MAX
 
 #include <stb_image.h>
 #include <lz4/lz4file.h>
 #include <webp/decode.h>
+#include <lz4/xxhash.h>
+#include <lz4/lz4.h>
 // TODO: libwebp caused tinview size to go from around 100k to 500k
 
 #include "common.h"
+#include "kernels.h"
 
 #define IMGSTDIN ""
 
+// Image loading states, only ever changed atomically
+enum {
+	IMGUNLOADED = 0,
+	IMGLOADING,      // Image is currently being loaded in a thread
+	IMGLOADINGSTALE, // Image is being loaded, but should be unloaded when it's finished
+	IMGLOADED,       // Image loading has succesfully finished
+};
+
+/* Animation frames are stored as the rectangle that changed since the previous frame. If the
+   rectangle has at most 256 colors, it's stored as a palette followed by indices into it */
 typedef struct {
-	char     path[PATH_MAX];
-	int      w, h;
-	uint8_t *pxs;
-	bool     isGif;
-	int     *delays, len; // Only for gifs
-
-	bool flipv, fliph; // Vertical and horizontal flip
-	int  rot; // 0 - 3, rot*90 translates to degrees
-
-	/* loading        - Image is currently being loaded in a thread
-	 * loaded         - Image loading has succesfully finished
-	 * deferredUnload - Unload the image when it's finished loading
-	 * err            - Image loading error, NULL if no error
-	 */
-	bool  loading, loaded, deferredUnload;
-	Error err;
-	pthread_t       thread;
-	pthread_mutex_t mutex;
-} Image;
+	int      delay;
+	int      x, y, w, h;
+	int      colors; // Palette size, 0 if the pixels are stored as RGBA
+	uint8_t *data;
+} Frame;
+
+#define FRAMEMAXCOLORS 256
 
-void normalizeImagePath(const char *path, char *buf);
+typedef struct Anim Anim;
 
-Image *newImage(const char *path);
-void   freeImage(Image *img);
+// Pixel layouts of mapped images, and RAWGRAY, RAWRGB or RAWRGBA for decoded ones
+enum {
+	RAWGRAY = 0,
+	RAWRGB,
+	RAWBGR,
+	RAWBGRA,
+	RAWRGBA,
+};
+
+/* Big uncompressed images are memory mapped instead of decoded, their rows are only converted to
+   RGBA when they're copied out with copyImageRows */
+typedef struct {
+	uint8_t       *map; // NULL if the image isn't mapped
+	size_t         sz;
+	const uint8_t *first; // First row of pixels in the mapping
+	ptrdiff_t      pitch; // Negative for images stored bottom-up
+	int            fmt;   // One of RAW*
+} Raw;
+
+#define RAWMINSZ (16*1024*1024) // Smaller files are cheap enough to just decode
+
+typedef struct Orient Orient;
+
+typedef struct {
+	/* Relative to the browsing directory, or absolute if the image is outside of it. Interned in
+	   the string arena of the images list the image belongs to */
+	const char *path;
+	int         w, h;
+	uint8_t    *pxs;  // For animations, this is the current frame. NULL for mapped images
+	Anim       *anim; // Only for animations
+	Raw         raw;  // Only for mapped images
+	/* Bytes per pixel of pxs, 1 for grayscale, 3 for RGB and 4 for RGBA. Animations and images
+	   that are shown while they load are always RGBA */
+	int         ch;
+	bool        opaque; // No pixel is translucent, so the image can be drawn without blending
+	uint64_t    hash;   // XXH64 of the file the pixels were reloaded from, 0 if unknown
+	Orient     *orient; // Rotated and flipped copy being made on a worker, see orientImage
+
+	bool    flipv, fliph; // Vertical and horizontal flip
+	uint8_t rot; // 0 - 3, rot*90 translates to degrees
+
+	int   state; // One of IMG*, access with atomicLoad/atomicStore
+	int   rows;  // Rows of pxs already decoded while progressively loading, access with getImageRows
+	Error err;   // Image loading error, NULL if no error
+} Image;
 
-void lockImage     (Image *img);
-void unlockImage   (Image *img);
 bool isImageLoading(Image *img);
 bool isImageLoaded (Image *img);
+int  getImageRows  (Image *img); // While loading, w, h and that many rows of pxs can be shown
+// Writes h rows of a loaded still image from row y as RGBA, whatever its layout is
+void copyImageRows(Image *img, int y, int h, uint8_t *dest, int pitch);
+// Same for w by h pixels from x, y, taking only every step-th pixel in both directions
+void copyImageTile(Image *img, int x, int y, int w, int h, int step, uint8_t *dest, int pitch);
 
-void loadImage(Image *img);
-void loadImageFromStdin(Image *img);
-void unloadImage(Image *img);
+/* An RGBA copy of a loaded still image is rotated and flipped on a worker, so the viewer can draw
+   it as it is instead of transforming it every frame. Starting a new copy cancels the previous
+   one, and so does freeing the pixels of the image */
+void     orientImage(Image *img); // Uses the current rot, flipv and fliph of the image
+// Returns the copy once it's done, along with the orientation it has. The caller frees it
+uint8_t *takeOrientedImage(Image *img, uint8_t *rot, bool *flipv, bool *fliph);
+void     cancelOrient(Image *img);
+
+#define STRSCHUNKSZ (64*1024)
+
+// String arena, strings never move so pointers to them stay valid until the arena is freed
+typedef struct {
+	char  **chunks;
+	size_t  count, used, wasted; // used - Bytes used in the last chunk, wasted - Bytes of dead strings
+} Strings;
+
+#define IMGPOOLCHUNKSZ 1024
+
+// Image records are allocated in chunks, so they're laid out contiguously and never move
+typedef struct {
+	Image **chunks, **freed;
+	size_t  count, used, freedSz, freedCap;
+} ImagePool;
+
+#define IMGSNODESZ 64
+
+// Node of the images B+tree. Every node knows how many images are in its subtree, so images can be
+// looked up both by name and by index
+typedef struct ImagesNode {
+	bool   leaf;
+	int    len;   // Number of child nodes or images
+	size_t count; // Number of images in the subtree
+	Image *first; // First image in the subtree, the key of the node
+	union { // One extra slot, so a node can overflow before it gets split
+		struct ImagesNode *nodes[IMGSNODESZ + 1];
+		Image             *imgs [IMGSNODESZ + 1];
+	} as;
+} ImagesNode;
 
 // Ordered list of images
 typedef struct {
-	const char *path;
-	Image     **raw;
-	size_t      sz, cap;
+	char        dir[PATH_MAX]; // Normalized browsing directory path, always ends with a slash
+	size_t      dirLen;
+	int         dirfd; // Images are opened relative to the browsing directory
+	ImagesNode *root;
+	size_t      sz;
+	Image      *pinned; // Never removed from the list, because the viewer is showing it
 	int         fd, wd; // inotify and watch file descriptors
+	ImagePool   pool;
+	Strings     strs;
+
+	// Watch reload mode, the pinned image is decoded again in the background and then swapped in
+	bool      watchReload;
+	uint64_t  reloadAt;    // Monotonic milliseconds when the pending reload starts, 0 if none
+	uint64_t  reloadFirst; // Monotonic milliseconds of the first write the pending reload is for
+	Image     reload;      // Decodes the new version of reloaded
+	Image    *reloaded;    // NULL if no reload is running
+	uint64_t  newHash;     // Hash of the file reload was decoded from
 } Images;
 
+#define RELOADDELAY    50  // Writes closer together than this (in milliseconds) are reloaded once
+#define RELOADMAXDELAY 250 // But a file that's written all the time still reloads this often
+
 #define IMGSCHUNKSZ 128
 
-Error initImages(Images *imgs, const char *dirPath);
+Error initImages(Images *imgs, const char *dirPath); // The list starts empty
+Error scanImages(Images *imgs); // Adds the images in the browsing directory
+// Browses another directory, the images that aren't in it are dropped and its images are scanned
+Error changeImagesDir(Images *imgs, const char *dirPath);
 void  freeImages(Images *imgs);
 Error watchImages(Images *imgs);
+bool  updateReload(Images *imgs); // Returns true if the pinned image was just replaced
 bool  searchImageByName(Images *imgs, const char *path, int *idx); // TODO: Use size_t for indexes?
 int   getOrAddImage(Images *imgs, const char *path);
+Image *getImage(Images *imgs, int idx);
+int    getImageIndex(Images *imgs, Image *img);
+void  getImagePath(Images *imgs, Image *img, char *buf); // Writes the absolute path of an image
+
+int  getAnimDelay (Image *img); // Delay of the current frame
+// Returns false if the next frame isn't decoded yet, otherwise gives the rectangle that changed
+bool nextAnimFrame(Image *img, int *x, int *y, int *w, int *h);
+
+// Frame by frame GIF decoding, implemented next to stb_image in lib.c
+typedef struct GifDecoder GifDecoder;
+
+GifDecoder *newGifDecoder(const uint8_t *buf, size_t sz, int *w, int *h);
+uint8_t    *nextGifFrame(GifDecoder *dec, int *delay); // NULL at the end of the GIF
+void        freeGifDecoder(GifDecoder *dec);
+
+void loadImage(Images *imgs, Image *img);
+void loadImageFromStdin(Image *img);
+void unloadImage(Image *img);
+
+/* Feed mode, stdin carries a stream of images that are each prefixed by their size as a 32-bit
+   little endian integer. The first frame is loaded into the image, newer ones replace its pixels
+   with nextFeedFrame. Frames that arrive faster than they can be decoded or shown are dropped */
+typedef struct Feed Feed;
+
+Feed *startFeed(Image *img);
+bool  nextFeedFrame(Feed *feed, Image *img); // Returns false if there's no new frame
 
 #endif
@@ -1,5 +1,5 @@
 #include <stdio.h>        // printf, fprintf, stderr
-#include <stdlib.h>       // getenv, exit, EXIT_FAILURE
+#include <stdlib.h>       // getenv, exit, EXIT_FAILURE, strtod, strtol
 #include <string.h>       // strcpy, strcat, strerror, strcmp, strlen
 #include <errno.h>        // errno
 #include <sys/stat.h>     // mkdir
@@ -14,17 +14,26 @@
 
 static const char **paths, *browsePath = NULL;
 static int          pathCount;
+static ViewOptions  opts;
 
 static void usage(void) {
 	printf("tinview (v"VERSION", compiled on "__DATE__")\n"
 	       "  A pretty and minimalist Linux image viewer\n"
 	       "\n"
-	       "Usage: tinview [FILE...] [-h | --help] [-v | --version] [-d DIR | --dir DIR]\n"
+	       "Usage: tinview [FILE...] [-h | --help] [-v | --version] [-d DIR | --dir DIR] [-f | --feed]\n"
+	       "               [-p FPS | --play FPS] [-r FIRST:LAST | --range FIRST:LAST] [-l | --loop]\n"
+	       "               [-R FILE | --record FILE] [-P FILE | --replay FILE]\n"
 	       "Github: https://github.com/lordoftrident/tinview\n"
 	       "Options:\n"
 	       "  -h, --help       Prints the usage and version information\n"
 	       "  -v, --version    Prints the version\n"
 	       "  -d, --dir        Sets the image browsing directory\n"
+	       "  -f, --feed       Shows a stream of size-prefixed images from stdin\n"
+	       "  -p, --play       Plays the images as a flipbook at the given fps\n"
+	       "  -r, --range      Sets the first and last image of the playback, counting from 1\n"
+	       "  -l, --loop       Loops the playback\n"
+	       "  -R, --record     Records the input to a file\n"
+	       "  -P, --replay     Replays recorded input without a display and prints frame statistics\n"
 	       "\n"
 	       "For other information, see the program's manpage tinview(1)\n");
 	exit(0);
@@ -35,14 +44,38 @@ static void version(void) {
 	exit(0);
 }
 
-static const char *flagArg(const char ***argv) {
+static const char *flagArg(const char ***argv, const char *what) {
 	if (*++*argv == NULL) {
-			fprintf(stderr, "Error: Flag \"%s\" expects directory path\n", (*argv)[-1]);
+			fprintf(stderr, "Error: Flag \"%s\" expects %s\n", (*argv)[-1], what);
 			exit(EXIT_FAILURE);
 	}
 	return **argv;
 }
 
+static void badFlagArg(const char **argv, const char *what) {
+	fprintf(stderr, "Error: Flag \"%s\" expects %s, got \"%s\"\n", argv[-1], what, *argv);
+	exit(EXIT_FAILURE);
+}
+
+static double parseFps(const char ***argv) {
+	const char *str = flagArg(argv, "fps"), *end;
+	double fps = strtod(str, (char**)&end);
+	if (end == str || *end != '\0' || !(fps > 0)) badFlagArg(*argv, "a positive fps");
+	return fps;
+}
+
+// Parses FIRST:LAST, either can be left out to mean the start or the end of the images list
+static void parseRange(const char ***argv) {
+	const char *str = flagArg(argv, "range"), *end;
+	opts.first = *str == ':'? 0 : strtol(str, (char**)&end, 10);
+	if (*str != ':') str = end;
+	if (*str++ != ':') badFlagArg(*argv, "range FIRST:LAST");
+	opts.last = *str == '\0'? 0 : strtol(str, (char**)&end, 10);
+	if (*str != '\0' && *end != '\0') badFlagArg(*argv, "range FIRST:LAST");
+	if (opts.first < 0 || opts.last < 0 || (opts.last && opts.first > opts.last))
+		badFlagArg(*argv, "range of positive positions FIRST:LAST");
+}
+
 static void parseArgs(int argc, const char **argv) {
 	paths = alloc(const char*, argc);
 
@@ -52,12 +85,27 @@ static void parseArgs(int argc, const char **argv) {
 		// TODO: Config flags, which would override config
 		if      (flag("h", "help"))    usage();
 		else if (flag("v", "version")) version();
-		else if (flag("d", "dir"))     browsePath = flagArg(&argv);
+		else if (flag("d", "dir"))     browsePath = flagArg(&argv, "directory path");
+		else if (flag("f", "feed"))    opts.feed = true;
+		else if (flag("p", "play"))    opts.fps  = parseFps(&argv);
+		else if (flag("r", "range"))   parseRange(&argv);
+		else if (flag("l", "loop"))    opts.loop = true;
+		else if (flag("R", "record"))  opts.record = flagArg(&argv, "file path");
+		else if (flag("P", "replay"))  opts.replay = flagArg(&argv, "file path");
 		else if (**argv == '-') {
 			fprintf(stderr, "Error: Unknown flag \"%s\", try \"--help\"\n", *argv);
 			exit(EXIT_FAILURE);
 		} else paths[pathCount++] = *argv;
 	}
+
+	if (opts.feed && pathCount) {
+		fprintf(stderr, "Error: Files can't be opened in feed mode, the images come from stdin\n");
+		exit(EXIT_FAILURE);
+	}
+	if (opts.record != NULL && opts.replay != NULL) {
+		fprintf(stderr, "Error: Input can't be recorded while it's replayed\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
 static void checkDir(const char *path) {
@@ -66,6 +114,7 @@ static void checkDir(const char *path) {
 }
 
 int main(int argc, const char **argv) {
+	initKernels();
 	parseArgs(argc, argv);
 
 	char path[PATH_MAX];
@@ -75,15 +124,23 @@ int main(int argc, const char **argv) {
 	strcat(path, "/config.ini");
 	initConfig(path);
 
+	// A viewer running in single-instance mode opens plain files itself, it's already warmed up
+	if (conf.win.singleInstance && pathCount && browsePath == NULL && !opts.feed && opts.fps == 0 &&
+	    opts.replay == NULL)
+		if (sendToInstance(paths, pathCount)) return 0;
+
+	char dir[PATH_MAX];
 	if (browsePath == NULL) {
 		if (pathCount) {
 			// Get the parent directory of the first provided image
-			strcpy(path, *paths);
-			browsePath = dirname(path);
+			strcpy(dir, *paths);
+			browsePath = dirname(dir);
 		} else browsePath = ".";
 	}
+	// Decoding of the first image runs alongside starting SDL2
+	startView(browsePath, paths, pathCount, &opts);
 
-	view(browsePath, paths, pathCount);
+	view();
 	free(paths);
 	return 0;
 }
@@ -0,0 +1,562 @@
+#include "render.h"
+
+/* OpenGL 3.3 core, drawn directly instead of through SDL's renderer. Quads are batched, and the
+   baked interface textures share an atlas, so the checkerboard and everything drawn over the image
+   usually go out in a single draw each. Filtering is a sampler, minified images get mipmaps, and textures that keep
+   getting updated, like gif and feed frames, stream through a persistently mapped pixel buffer.
+   Runs on Mesa's llvmpipe as well, LIBGL_ALWAYS_SOFTWARE=1 forces it */
+
+#define ATLASSIZE  1024        // Baked textures share one, the interface draws from a single texture
+#define ATLASMAX   256         // Largest texture put in the atlas
+#define PBOSLOTS   3           // Updates a streamed texture can have in flight
+#define PBOMAXSIZE (128 << 20) // Larger textures are uploaded straight from the pixels
+
+#define GLFUNCS(X) \
+	X(void,      Enable,                  (GLenum cap)) \
+	X(void,      Disable,                 (GLenum cap)) \
+	X(void,      BlendFuncSeparate,       (GLenum srcRgb, GLenum destRgb, GLenum srcA, GLenum destA)) \
+	X(void,      Clear,                   (GLbitfield mask)) \
+	X(void,      ClearColor,              (GLfloat r, GLfloat g, GLfloat b, GLfloat a)) \
+	X(void,      Viewport,                (GLint x, GLint y, GLsizei w, GLsizei h)) \
+	X(void,      GetIntegerv,             (GLenum name, GLint *data)) \
+	X(void,      PixelStorei,             (GLenum name, GLint param)) \
+	X(void,      GenTextures,             (GLsizei n, GLuint *ids)) \
+	X(void,      DeleteTextures,          (GLsizei n, const GLuint *ids)) \
+	X(void,      BindTexture,             (GLenum target, GLuint id)) \
+	X(void,      TexImage2D,              (GLenum target, GLint level, GLint internal, GLsizei w, GLsizei h, \
+	                                       GLint border, GLenum format, GLenum type, const void *pxs)) \
+	X(void,      TexSubImage2D,           (GLenum target, GLint level, GLint x, GLint y, GLsizei w, \
+	                                       GLsizei h, GLenum format, GLenum type, const void *pxs)) \
+	X(void,      GenerateMipmap,          (GLenum target)) \
+	X(void,      GenSamplers,             (GLsizei n, GLuint *ids)) \
+	X(void,      DeleteSamplers,          (GLsizei n, const GLuint *ids)) \
+	X(void,      SamplerParameteri,       (GLuint id, GLenum name, GLint param)) \
+	X(void,      BindSampler,             (GLuint unit, GLuint id)) \
+	X(GLuint,    CreateShader,            (GLenum type)) \
+	X(void,      ShaderSource,            (GLuint id, GLsizei n, const GLchar *const *src, const GLint *len)) \
+	X(void,      CompileShader,           (GLuint id)) \
+	X(void,      GetShaderiv,             (GLuint id, GLenum name, GLint *param)) \
+	X(void,      GetShaderInfoLog,        (GLuint id, GLsizei sz, GLsizei *len, GLchar *log)) \
+	X(void,      DeleteShader,            (GLuint id)) \
+	X(GLuint,    CreateProgram,           (void)) \
+	X(void,      AttachShader,            (GLuint program, GLuint shader)) \
+	X(void,      LinkProgram,             (GLuint id)) \
+	X(void,      GetProgramiv,            (GLuint id, GLenum name, GLint *param)) \
+	X(void,      GetProgramInfoLog,       (GLuint id, GLsizei sz, GLsizei *len, GLchar *log)) \
+	X(void,      DeleteProgram,           (GLuint id)) \
+	X(void,      UseProgram,              (GLuint id)) \
+	X(GLint,     GetUniformLocation,      (GLuint program, const GLchar *name)) \
+	X(void,      Uniform2f,               (GLint loc, GLfloat x, GLfloat y)) \
+	X(void,      GenVertexArrays,         (GLsizei n, GLuint *ids)) \
+	X(void,      DeleteVertexArrays,      (GLsizei n, const GLuint *ids)) \
+	X(void,      BindVertexArray,         (GLuint id)) \
+	X(void,      VertexAttribPointer,     (GLuint i, GLint n, GLenum type, GLboolean normalized, \
+	                                       GLsizei stride, const void *off)) \
+	X(void,      EnableVertexAttribArray, (GLuint i)) \
+	X(void,      DrawArrays,              (GLenum mode, GLint first, GLsizei count)) \
+	X(void,      GenBuffers,              (GLsizei n, GLuint *ids)) \
+	X(void,      DeleteBuffers,           (GLsizei n, const GLuint *ids)) \
+	X(void,      BindBuffer,              (GLenum target, GLuint id)) \
+	X(void,      BufferData,              (GLenum target, GLsizeiptr sz, const void *data, GLenum usage)) \
+	X(void*,     MapBufferRange,          (GLenum target, GLintptr off, GLsizeiptr sz, GLbitfield access)) \
+	X(GLboolean, UnmapBuffer,             (GLenum target)) \
+	X(GLsync,    FenceSync,               (GLenum condition, GLbitfield flags)) \
+	X(GLenum,    ClientWaitSync,          (GLsync sync, GLbitfield flags, GLuint64 timeout)) \
+	X(void,      DeleteSync,              (GLsync sync))
+
+#define declareGl(RET, NAME, ARGS) RET (APIENTRY *NAME) ARGS;
+
+static struct {
+	GLFUNCS(declareGl)
+	// Only with ARB_buffer_storage, textures aren't streamed without it
+	void (APIENTRY *BufferStorage)(GLenum target, GLsizeiptr sz, const void *data, GLbitfield flags);
+} gl;
+
+enum {
+	SAMPLERNEAREST = 0,
+	SAMPLERLINEAR,
+	SAMPLERMIPMAP,
+	SAMPLERCOUNT,
+};
+
+// Batches can take quads that don't care about blending either way
+enum {
+	BLENDOFF = 0,
+	BLENDON,
+	BLENDANY,
+};
+
+typedef struct {
+	float   x, y, u, v;
+	uint8_t color[4], odd[4]; // Checkerboard quads alternate between color and odd
+	float   tile;             // Checkerboard tile size, 0 samples the texture and -1 is a plain color
+} Vertex;
+
+typedef struct {
+	GLuint tex; // 0 while only untextured quads are in it
+	int    sampler, blend;
+	int    first, count;
+} Batch;
+
+typedef struct {
+	GLuint   id;
+	int      x, y, texw, texh; // Where it is in the GL texture, which is the atlas for small ones
+	bool     atlased, mipmapsStale;
+	int      updates;
+	// Streaming, every slot holds a whole texture
+	GLuint   pbo;
+	uint8_t *mapped;
+	GLsync   fences[PBOSLOTS];
+	int      slot;
+	// Locking without streaming
+	uint8_t *staging;
+	SDL_Rect locked;
+} GlTexture;
+
+static struct {
+	SDL_Window   *win;
+	SDL_GLContext ctx;
+	GLuint        program, vao, vbo, samplers[SAMPLERCOUNT];
+	GLint         sizeLoc, maxSize;
+	GLuint        atlas;
+	int           atlasx, atlasy, shelfh; // Textures are packed into shelves from the top left
+	Vertex       *verts;
+	int           vertCount, vertCap;
+	Batch        *batches;
+	int           batchCount, batchCap;
+} gpu;
+
+static const char *vertexShader =
+	"#version 330 core\n"
+	"layout(location = 0) in vec2 pos;\n"
+	"layout(location = 1) in vec2 uv;\n"
+	"layout(location = 2) in vec4 color;\n"
+	"layout(location = 3) in vec4 odd;\n"
+	"layout(location = 4) in float tile;\n"
+	"uniform vec2 size;\n"
+	"out vec2 fpos, fuv;\n"
+	"out vec4 fcolor;\n"
+	"flat out vec4 fodd;\n"
+	"flat out float ftile;\n"
+	"void main() {\n"
+	"	fpos = pos; fuv = uv; fcolor = color; fodd = odd; ftile = tile;\n"
+	"	gl_Position = vec4(pos.x/size.x*2.0 - 1.0, 1.0 - pos.y/size.y*2.0, 0.0, 1.0);\n"
+	"}\n";
+
+static const char *fragmentShader =
+	"#version 330 core\n"
+	"in vec2 fpos, fuv;\n"
+	"in vec4 fcolor;\n"
+	"flat in vec4 fodd;\n"
+	"flat in float ftile;\n"
+	"uniform sampler2D tex;\n"
+	"out vec4 outColor;\n"
+	"void main() {\n"
+	"	if (ftile > 0.0) {\n"
+	"		vec2 t = floor(fpos/ftile);\n"
+	"		outColor = mod(t.x + t.y, 2.0) == 0.0? fcolor : fodd;\n"
+	"	} else if (ftile < 0.0) outColor = fcolor;\n"
+	"	else outColor = texture(tex, fuv)*fcolor;\n"
+	"}\n";
+
+// ISO C can't cast the object pointer SDL gives to a function pointer
+static bool loadGl(void *fn, const char *name) {
+	void *addr = SDL_GL_GetProcAddress(name);
+	memcpy(fn, &addr, sizeof(addr));
+	return addr != NULL;
+}
+
+static GLuint compileShader(GLenum type, const char *src) {
+	GLuint id = gl.CreateShader(type);
+	GLint  ok;
+	gl.ShaderSource(id, 1, &src, NULL);
+	gl.CompileShader(id);
+	gl.GetShaderiv(id, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[512];
+		gl.GetShaderInfoLog(id, sizeof(log), NULL, log);
+		error("Failed to compile shader: %s", log);
+	}
+	return id;
+}
+
+static bool createProgram(void) {
+	GLuint vs = compileShader(GL_VERTEX_SHADER, vertexShader);
+	GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentShader);
+	GLint  ok;
+	gpu.program = gl.CreateProgram();
+	gl.AttachShader(gpu.program, vs);
+	gl.AttachShader(gpu.program, fs);
+	gl.LinkProgram(gpu.program);
+	gl.DeleteShader(vs);
+	gl.DeleteShader(fs);
+	gl.GetProgramiv(gpu.program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[512];
+		gl.GetProgramInfoLog(gpu.program, sizeof(log), NULL, log);
+		error("Failed to link shaders: %s", log);
+		return false;
+	}
+	gpu.sizeLoc = gl.GetUniformLocation(gpu.program, "size");
+	return true;
+}
+
+static void createSamplers(void) {
+	static const GLint filters[SAMPLERCOUNT][2] = {
+		[SAMPLERNEAREST] = {GL_NEAREST, GL_NEAREST},
+		[SAMPLERLINEAR]  = {GL_LINEAR,  GL_LINEAR},
+		[SAMPLERMIPMAP]  = {GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR},
+	};
+	gl.GenSamplers(SAMPLERCOUNT, gpu.samplers);
+	for (int i = 0; i < SAMPLERCOUNT; ++i) {
+		gl.SamplerParameteri(gpu.samplers[i], GL_TEXTURE_MIN_FILTER, filters[i][0]);
+		gl.SamplerParameteri(gpu.samplers[i], GL_TEXTURE_MAG_FILTER, filters[i][1]);
+		gl.SamplerParameteri(gpu.samplers[i], GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		gl.SamplerParameteri(gpu.samplers[i], GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+}
+
+static void createVertexArray(void) {
+	gl.GenVertexArrays(1, &gpu.vao);
+	gl.GenBuffers(1, &gpu.vbo);
+	gl.BindVertexArray(gpu.vao);
+	gl.BindBuffer(GL_ARRAY_BUFFER, gpu.vbo);
+	gl.VertexAttribPointer(0, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, x));
+	gl.VertexAttribPointer(1, 2, GL_FLOAT,         GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, u));
+	gl.VertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Vertex), (void*)offsetof(Vertex, color));
+	gl.VertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE,  sizeof(Vertex), (void*)offsetof(Vertex, odd));
+	gl.VertexAttribPointer(4, 1, GL_FLOAT,         GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tile));
+	for (int i = 0; i < 5; ++i) gl.EnableVertexAttribArray(i);
+}
+
+// Starts out transparent, so filtering at the edge of a texture can't pick up garbage
+static void createAtlas(void) {
+	uint8_t *zero = alloc(uint8_t, ATLASSIZE*ATLASSIZE*4);
+	memset(zero, 0, ATLASSIZE*ATLASSIZE*4);
+	gl.GenTextures(1, &gpu.atlas);
+	gl.BindTexture(GL_TEXTURE_2D, gpu.atlas);
+	gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, ATLASSIZE, ATLASSIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, zero);
+	free(zero);
+}
+
+static bool initGl(SDL_Window *win, bool fallback, bool vsync) {
+	unused(fallback);
+	gpu.win = win;
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+	if ((gpu.ctx = SDL_GL_CreateContext(win)) == NULL) {
+		error("Failed to create OpenGL 3.3 context: %s", SDL_GetError());
+		SDL_GL_ResetAttributes(); // The other renderers could want a different context
+		return false;
+	}
+
+	bool ok = true;
+#define loadGlFunc(RET, NAME, ARGS) ok = loadGl(&gl.NAME, "gl" #NAME) && ok;
+	GLFUNCS(loadGlFunc)
+#undef loadGlFunc
+	if (SDL_GL_ExtensionSupported("GL_ARB_buffer_storage")) loadGl(&gl.BufferStorage, "glBufferStorage");
+	if (!ok || !createProgram()) {
+		if (!ok) error("Failed to load OpenGL functions");
+		SDL_GL_DeleteContext(gpu.ctx);
+		SDL_GL_ResetAttributes();
+		return false;
+	}
+	// Adaptive vsync lets a late frame through right away instead of waiting for the next refresh
+	if (!vsync) SDL_GL_SetSwapInterval(0);
+	else if (SDL_GL_SetSwapInterval(-1) != 0) SDL_GL_SetSwapInterval(1);
+
+	gl.GetIntegerv(GL_MAX_TEXTURE_SIZE, &gpu.maxSize);
+	gl.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	createSamplers();
+	createVertexArray();
+	createAtlas();
+	return true;
+}
+
+static int maxGlTextureSize(void) {
+	return gpu.maxSize;
+}
+
+static void quitGl(void) {
+	gl.DeleteTextures(1, &gpu.atlas);
+	gl.DeleteSamplers(SAMPLERCOUNT, gpu.samplers);
+	gl.DeleteBuffers(1, &gpu.vbo);
+	gl.DeleteVertexArrays(1, &gpu.vao);
+	gl.DeleteProgram(gpu.program);
+	SDL_GL_DeleteContext(gpu.ctx);
+	free(gpu.verts);
+	free(gpu.batches);
+}
+
+/* Shelves fill from left to right. Only baked textures go in, they're all created at startup and
+   live until exit, so space is never given back */
+static bool placeInAtlas(GlTexture *t, int w, int h) {
+	w += 2; // Edge texels are repeated around each texture
+	h += 2;
+	if (gpu.atlasx + w > ATLASSIZE) {
+		gpu.atlasx  = 0;
+		gpu.atlasy += gpu.shelfh;
+		gpu.shelfh  = 0;
+	}
+	if (gpu.atlasy + h > ATLASSIZE) return false;
+	t->id      = gpu.atlas;
+	t->x       = gpu.atlasx + 1;
+	t->y       = gpu.atlasy + 1;
+	t->texw    = t->texh = ATLASSIZE;
+	t->atlased = true;
+	gpu.atlasx += w;
+	if (h > gpu.shelfh) gpu.shelfh = h;
+	return true;
+}
+
+static void createGlTexture(Texture *tex) {
+	GlTexture *t = alloc(GlTexture, 1);
+	zeroMem(t);
+	tex->data = t;
+	if (tex->baked && tex->w <= ATLASMAX && tex->h <= ATLASMAX && placeInAtlas(t, tex->w, tex->h)) return;
+
+	if (tex->w > gpu.maxSize || tex->h > gpu.maxSize)
+		die("Failed to create texture: %ix%i is more than the %i OpenGL allows", tex->w, tex->h,
+		    gpu.maxSize);
+	t->texw = tex->w;
+	t->texh = tex->h;
+	gl.GenTextures(1, &t->id);
+	gl.BindTexture(GL_TEXTURE_2D, t->id);
+	gl.TexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, tex->w, tex->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+}
+
+static void destroyGlTexture(Texture *tex) {
+	GlTexture *t = tex->data;
+	for (int i = 0; i < PBOSLOTS; ++i) if (t->fences[i] != NULL) gl.DeleteSync(t->fences[i]);
+	if (t->pbo != 0) {
+		gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo);
+		gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		gl.DeleteBuffers(1, &t->pbo);
+	}
+	if (!t->atlased) gl.DeleteTextures(1, &t->id);
+	free(t->staging);
+	free(t);
+}
+
+// pxs is an offset into the bound pixel buffer while streaming
+static void uploadTexels(GlTexture *t, int x, int y, int w, int h, const void *pxs, int pitch) {
+	gl.BindTexture(GL_TEXTURE_2D, t->id);
+	gl.PixelStorei(GL_UNPACK_ROW_LENGTH, pitch/4);
+	gl.TexSubImage2D(GL_TEXTURE_2D, 0, t->x + x, t->y + y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pxs);
+}
+
+// Repeats the edges of r that are on the edges of the texture into the space around it in the atlas
+static void padAtlas(const Texture *tex, GlTexture *t, const SDL_Rect *r, const uint8_t *pxs, int pitch) {
+	const uint8_t *last = pxs + (size_t)(r->h - 1)*pitch, *right = pxs + (r->w - 1)*4;
+	bool top = r->y == 0, bottom = r->y + r->h == tex->h, left = r->x == 0, edge = r->x + r->w == tex->w;
+	if (top)    uploadTexels(t, r->x, -1,     r->w, 1, pxs,  pitch);
+	if (bottom) uploadTexels(t, r->x, tex->h, r->w, 1, last, pitch);
+	if (left)   uploadTexels(t, -1,     r->y, 1, r->h, pxs,   pitch);
+	if (edge)   uploadTexels(t, tex->w, r->y, 1, r->h, right, pitch);
+	if (top    && left) uploadTexels(t, -1,     -1,     1, 1, pxs,                       pitch);
+	if (top    && edge) uploadTexels(t, tex->w, -1,     1, 1, right,                     pitch);
+	if (bottom && left) uploadTexels(t, -1,     tex->h, 1, 1, last,                      pitch);
+	if (bottom && edge) uploadTexels(t, tex->w, tex->h, 1, 1, last + (r->w - 1)*4, pitch);
+}
+
+static void startStreaming(const Texture *tex, GlTexture *t) {
+	size_t     sz    = (size_t)tex->w*tex->h*4*PBOSLOTS;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	if (sz > PBOMAXSIZE) return;
+	gl.GenBuffers(1, &t->pbo);
+	gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo);
+	gl.BufferStorage(GL_PIXEL_UNPACK_BUFFER, sz, NULL, flags);
+	t->mapped = gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sz, flags);
+	gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (t->mapped == NULL) {
+		gl.DeleteBuffers(1, &t->pbo);
+		t->pbo = 0;
+	}
+}
+
+// Textures that are updated again are gif and feed frames, they stream through a mapped buffer
+static bool isStreamed(const Texture *tex, GlTexture *t) {
+	if (t->pbo == 0 && t->updates > 0 && !t->atlased && gl.BufferStorage != NULL) startStreaming(tex, t);
+	return t->pbo != 0;
+}
+
+// Waits until the GPU is done with the oldest slot, which is the next one to be written
+static uint8_t *nextSlot(const Texture *tex, GlTexture *t) {
+	t->slot = (t->slot + 1)%PBOSLOTS;
+	if (t->fences[t->slot] != NULL) {
+		gl.ClientWaitSync(t->fences[t->slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		gl.DeleteSync(t->fences[t->slot]);
+		t->fences[t->slot] = NULL;
+	}
+	return t->mapped + (size_t)t->slot*tex->w*tex->h*4;
+}
+
+// Rows in the current slot are packed
+static void uploadSlot(const Texture *tex, GlTexture *t, const SDL_Rect *r) {
+	uintptr_t off = (uintptr_t)t->slot*tex->w*tex->h*4;
+	gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, t->pbo);
+	uploadTexels(t, r->x, r->y, r->w, r->h, (const void*)off, r->w*4);
+	gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	t->fences[t->slot] = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void updateGlTexture(Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch) {
+	GlTexture *t = tex->data;
+	if (isStreamed(tex, t)) {
+		uint8_t *slot = nextSlot(tex, t);
+		for (int y = 0; y < r->h; ++y) memcpy(slot + (size_t)y*r->w*4, pxs + (size_t)y*pitch, r->w*4);
+		uploadSlot(tex, t, r);
+	} else {
+		uploadTexels(t, r->x, r->y, r->w, r->h, pxs, pitch);
+		if (t->atlased) padAtlas(tex, t, r, pxs, pitch);
+	}
+	++t->updates;
+	t->mipmapsStale = true;
+}
+
+// Streamed textures are written in place, right into the mapped buffer
+static bool lockGlTexture(Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch) {
+	GlTexture *t = tex->data;
+	t->locked = *r;
+	*pitch    = r->w*4;
+	if (isStreamed(tex, t)) *pxs = nextSlot(tex, t);
+	else *pxs = resize(t->staging, (size_t)r->w*r->h*4);
+	return true;
+}
+
+static void unlockGlTexture(Texture *tex) {
+	GlTexture *t = tex->data;
+	if (t->pbo == 0) {
+		updateGlTexture(tex, &t->locked, t->staging, t->locked.w*4);
+		return;
+	}
+	uploadSlot(tex, t, &t->locked);
+	++t->updates;
+	t->mipmapsStale = true;
+}
+
+// Quads only start a new batch when they need another texture, sampler or blending
+static void addQuad(float pos[4][2], float uv[4][2], Rgba color, Rgba odd, float tile,
+                    GLuint tex, int sampler, int blend) {
+	Batch *b = gpu.batchCount > 0? &gpu.batches[gpu.batchCount - 1] : NULL;
+	if (b != NULL && (blend == BLENDANY || b->blend == BLENDANY || b->blend == blend) &&
+	    (tex == 0 || b->tex == 0 || (b->tex == tex && b->sampler == sampler))) {
+		if (b->blend == BLENDANY) b->blend = blend;
+		if (b->tex == 0) {
+			b->tex     = tex;
+			b->sampler = sampler;
+		}
+	} else {
+		if (gpu.batchCount == gpu.batchCap)
+			resize(gpu.batches, gpu.batchCap = gpu.batchCap? gpu.batchCap*2 : 16);
+		b  = &gpu.batches[gpu.batchCount++];
+		*b = (Batch){tex, sampler, blend, gpu.vertCount, 0};
+	}
+
+	if (gpu.vertCount + 6 > gpu.vertCap) resize(gpu.verts, gpu.vertCap = gpu.vertCap? gpu.vertCap*2 : 256);
+	static const int corners[6] = {0, 1, 2, 0, 2, 3};
+	for (int i = 0; i < 6; ++i) {
+		int c = corners[i];
+		gpu.verts[gpu.vertCount++] = (Vertex){
+			pos[c][0], pos[c][1], uv[c][0], uv[c][1],
+			{color.r, color.g, color.b, color.a}, {odd.r, odd.g, odd.b, odd.a}, tile,
+		};
+	}
+	b->count += 6;
+}
+
+// Corners of r, or of the window if it's NULL, clockwise from the top left
+static void getCorners(const SDL_Rect *r, float pos[4][2]) {
+	SDL_Rect full = {0, 0, 0, 0};
+	if (r == NULL) {
+		SDL_GetWindowSize(gpu.win, &full.w, &full.h);
+		r = &full;
+	}
+	float x0 = r->x, y0 = r->y, x1 = r->x + r->w, y1 = r->y + r->h;
+	float corners[4][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+	memcpy(pos, corners, sizeof(corners));
+}
+
+static void fillGl(const SDL_Rect *r, Rgba color, bool blend) {
+	float pos[4][2], uv[4][2] = {{0}};
+	getCorners(r, pos);
+	addQuad(pos, uv, color, color, -1, 0, SAMPLERNEAREST, color.a == 0xFF? BLENDANY : blend);
+}
+
+static void checkerboardGl(int tile, Rgba even, Rgba odd) {
+	float pos[4][2], uv[4][2] = {{0}};
+	getCorners(NULL, pos);
+	even.a = odd.a = 0xFF;
+	addQuad(pos, uv, even, odd, tile, 0, SAMPLERNEAREST, BLENDANY);
+}
+
+static void copyGl(Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle, bool flip) {
+	GlTexture *t = tex->data;
+	// Minified filtered images sample mipmaps, which are made the first time they're needed
+	int sampler = SAMPLERNEAREST;
+	if (tex->filtering) sampler = !t->atlased && (dest->w < src->w || dest->h < src->h)? SAMPLERMIPMAP : SAMPLERLINEAR;
+	if (sampler == SAMPLERMIPMAP && t->mipmapsStale) {
+		gl.BindTexture(GL_TEXTURE_2D, t->id);
+		gl.GenerateMipmap(GL_TEXTURE_2D);
+		t->mipmapsStale = false;
+	}
+
+	float u0 = (float)(t->x + src->x)/t->texw, u1 = (float)(t->x + src->x + src->w)/t->texw;
+	float v0 = (float)(t->y + src->y)/t->texh, v1 = (float)(t->y + src->y + src->h)/t->texh;
+	if (flip) {
+		float u = u0;
+		u0 = u1;
+		u1 = u;
+	}
+	float uv[4][2] = {{u0, v0}, {u1, v0}, {u1, v1}, {u0, v1}}, pos[4][2];
+	getCorners(dest, pos);
+	if (angle != 0) {
+		// Quarter turns stay exact, so the image stays on whole pixels
+		double rad = angle*M_PI/180, c = cos(rad), s = sin(rad);
+		if (fabs(c) < 1e-9) c = 0;
+		if (fabs(s) < 1e-9) s = 0;
+		double cx = dest->x + dest->w/2.0, cy = dest->y + dest->h/2.0;
+		for (int i = 0; i < 4; ++i) {
+			double dx = pos[i][0] - cx, dy = pos[i][1] - cy;
+			pos[i][0] = cx + dx*c - dy*s;
+			pos[i][1] = cy + dx*s + dy*c;
+		}
+	}
+	addQuad(pos, uv, tex->mod, tex->mod, 0, t->id, sampler, tex->blend? BLENDON : BLENDOFF);
+}
+
+static void presentGl(void) {
+	int w, h, dw, dh;
+	SDL_GetWindowSize(gpu.win, &w, &h);
+	SDL_GL_GetDrawableSize(gpu.win, &dw, &dh);
+	gl.Viewport(0, 0, dw, dh);
+	gl.ClearColor(0, 0, 0, 1);
+	gl.Clear(GL_COLOR_BUFFER_BIT);
+
+	if (gpu.vertCount > 0) {
+		gl.UseProgram(gpu.program);
+		gl.Uniform2f(gpu.sizeLoc, w, h);
+		gl.BindVertexArray(gpu.vao);
+		gl.BindBuffer(GL_ARRAY_BUFFER, gpu.vbo);
+		gl.BufferData(GL_ARRAY_BUFFER, gpu.vertCount*sizeof(Vertex), gpu.verts, GL_STREAM_DRAW);
+		for (int i = 0; i < gpu.batchCount; ++i) {
+			const Batch *b = &gpu.batches[i];
+			if (b->tex != 0) {
+				gl.BindTexture(GL_TEXTURE_2D, b->tex);
+				gl.BindSampler(0, gpu.samplers[b->sampler]);
+			}
+			if (b->blend == BLENDON) gl.Enable(GL_BLEND);
+			else gl.Disable(GL_BLEND);
+			gl.DrawArrays(GL_TRIANGLES, b->first, b->count);
+		}
+	}
+	gpu.vertCount = gpu.batchCount = 0;
+	SDL_GL_SwapWindow(gpu.win);
+}
+
+const RenderBackend glBackend = {
+	"opengl", initGl, quitGl, maxGlTextureSize, createGlTexture, destroyGlTexture, updateGlTexture,
+	lockGlTexture, unlockGlTexture, fillGl, checkerboardGl, copyGl, presentGl,
+};
@@ -0,0 +1,216 @@
+#include "render.h"
+
+static const RenderBackend *backend;
+
+/* SDL's renderer. Anything but a hardware accelerated one is left to the CPU backend in auto mode,
+   SDL's software renderer draws rotated and scaled textures on a single core */
+
+static SDL_Renderer *ren;
+
+static bool initSdl(SDL_Window *win, bool fallback, bool vsync) {
+	if ((ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE |
+	                                       SDL_RENDERER_PRESENTVSYNC*vsync)) == NULL) {
+		if (fallback) return false;
+		die("Failed to create renderer: %s", SDL_GetError());
+	}
+	// SDL_RENDER_DRIVER can still force the software one
+	SDL_RendererInfo info;
+	if (fallback && SDL_GetRendererInfo(ren, &info) == 0 && info.flags & SDL_RENDERER_SOFTWARE) {
+		SDL_DestroyRenderer(ren);
+		ren = NULL;
+		return false;
+	}
+	if (SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND) < 0)
+		error("Failed to set blend mode: %s", SDL_GetError());
+	return true;
+}
+
+static void quitSdl(void) {
+	SDL_DestroyRenderer(ren);
+}
+
+// Renderers that give no limit have none
+static int maxSdlTextureSize(void) {
+	SDL_RendererInfo info;
+	if (SDL_GetRendererInfo(ren, &info) != 0 || info.max_texture_width <= 0 || info.max_texture_height <= 0)
+		return INT32_MAX;
+	return info.max_texture_width < info.max_texture_height? info.max_texture_width : info.max_texture_height;
+}
+
+static void createSdlTexture(Texture *tex) {
+	if ((tex->data = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING,
+	                                   tex->w, tex->h)) == NULL)
+		die("Failed to create texture: %s", SDL_GetError());
+}
+
+static void destroySdlTexture(Texture *tex) {
+	SDL_DestroyTexture(tex->data);
+}
+
+static void updateSdlTexture(Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch) {
+	SDL_UpdateTexture(tex->data, r, pxs, pitch);
+}
+
+static bool lockSdlTexture(Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch) {
+	void *data;
+	if (SDL_LockTexture(tex->data, r, &data, pitch) != 0) {
+		error("Failed to lock texture: %s", SDL_GetError());
+		return false;
+	}
+	*pxs = data;
+	return true;
+}
+
+static void unlockSdlTexture(Texture *tex) {
+	SDL_UnlockTexture(tex->data);
+}
+
+static void fillSdl(const SDL_Rect *r, Rgba color, bool blend) {
+	SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
+	if (r == NULL && !blend) SDL_RenderClear(ren);
+	else SDL_RenderFillRect(ren, r);
+}
+
+static void checkerboardSdl(int tile, Rgba even, Rgba odd) {
+	int w, h;
+	SDL_GetRendererOutputSize(ren, &w, &h);
+	for (int y = 0; y <= h/tile; ++y) {
+		for (int x = 0; x <= w/tile; ++x) {
+			Rgba color = (x + y)%2 == 0? even : odd;
+			SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, SDL_ALPHA_OPAQUE);
+			SDL_RenderFillRect(ren, &(SDL_Rect){x*tile, y*tile, tile, tile});
+		}
+	}
+}
+
+static void copySdl(Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle, bool flip) {
+	SDL_SetTextureBlendMode(tex->data, tex->blend? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+	SDL_SetTextureColorMod(tex->data, tex->mod.r, tex->mod.g, tex->mod.b);
+	SDL_SetTextureAlphaMod(tex->data, tex->mod.a);
+	SDL_SetTextureScaleMode(tex->data, tex->filtering? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+	if (angle == 0 && !flip) SDL_RenderCopy(ren, tex->data, src, dest);
+	else SDL_RenderCopyEx(ren, tex->data, src, dest, angle, NULL, SDL_FLIP_HORIZONTAL*flip);
+}
+
+static void presentSdl(void) {
+	SDL_RenderPresent(ren);
+}
+
+const RenderBackend sdlBackend = {
+	"sdl", initSdl, quitSdl, maxSdlTextureSize, createSdlTexture, destroySdlTexture, updateSdlTexture,
+	lockSdlTexture, unlockSdlTexture, fillSdl, checkerboardSdl, copySdl, presentSdl,
+};
+
+Uint32 getRendererWindowFlags(int renderer) {
+	return renderer == RENDEREROPENGL? SDL_WINDOW_OPENGL : 0;
+}
+
+// The others fall back to auto when they can't be used
+void initRenderer(SDL_Window *win, int renderer, bool vsync) {
+	if (renderer == RENDEREROPENGL) {
+		if (glBackend.init(win, true, vsync)) {
+			backend = &glBackend;
+			return;
+		}
+		renderer = RENDERERAUTO;
+	}
+	if (renderer != RENDERERCPU && sdlBackend.init(win, renderer == RENDERERAUTO, vsync)) {
+		backend = &sdlBackend;
+		return;
+	}
+	backend = &cpuBackend;
+	backend->init(win, false, vsync);
+}
+
+void quitRenderer(void) {
+	backend->quit();
+}
+
+int getMaxTextureSize(void) {
+	return backend->maxTextureSize();
+}
+
+static Texture *newTexture(int w, int h, bool filtering, bool baked) {
+	Texture *tex = alloc(Texture, 1);
+	zeroMem(tex);
+	tex->w         = w;
+	tex->h         = h;
+	tex->filtering = filtering;
+	tex->blend     = true;
+	tex->baked     = baked;
+	tex->mod       = (Rgba){0xFF, 0xFF, 0xFF, 0xFF};
+	backend->createTexture(tex);
+	return tex;
+}
+
+Texture *createTexture(int w, int h, bool filtering) {
+	return newTexture(w, h, filtering, false);
+}
+
+Texture *createBakedTexture(int w, int h, bool filtering) {
+	return newTexture(w, h, filtering, true);
+}
+
+void destroyTexture(Texture *tex) {
+	backend->destroyTexture(tex);
+	free(tex);
+}
+
+void updateTexture(Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch) {
+	backend->updateTexture(tex, r != NULL? r : &(SDL_Rect){0, 0, tex->w, tex->h}, pxs, pitch);
+}
+
+bool lockTexture(Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch) {
+	return backend->lockTexture(tex, r != NULL? r : &(SDL_Rect){0, 0, tex->w, tex->h}, pxs, pitch);
+}
+
+void unlockTexture(Texture *tex) {
+	backend->unlockTexture(tex);
+}
+
+void setTextureBlend(Texture *tex, bool blend) {
+	tex->blend = blend;
+}
+
+void setTextureMod(Texture *tex, Rgba mod) {
+	tex->mod = mod;
+}
+
+void setTextureFiltering(Texture *tex, bool filtering) {
+	tex->filtering = filtering;
+}
+
+void drawClear(Rgba color) {
+	color.a = 0xFF;
+	backend->fill(NULL, color, false);
+}
+
+void drawFill(const SDL_Rect *r, Rgba color) {
+	backend->fill(r, color, true);
+}
+
+// Like SDL_RenderDrawRect, the outline is inside r
+void drawOutline(SDL_Rect r, Rgba color) {
+	if (r.w <= 0 || r.h <= 0) return;
+	backend->fill(&(SDL_Rect){r.x, r.y, r.w, 1}, color, true);
+	if (r.h > 1) backend->fill(&(SDL_Rect){r.x, r.y + r.h - 1, r.w, 1}, color, true);
+	if (r.h <= 2) return;
+	backend->fill(&(SDL_Rect){r.x, r.y + 1, 1, r.h - 2}, color, true);
+	if (r.w > 1) backend->fill(&(SDL_Rect){r.x + r.w - 1, r.y + 1, 1, r.h - 2}, color, true);
+}
+
+void drawCheckerboard(int tile, Rgba even, Rgba odd) {
+	backend->checkerboard(tile, even, odd);
+}
+
+void drawTexture(Texture *tex, const SDL_Rect *src, const SDL_Rect *dest) {
+	drawTextureEx(tex, src, dest, 0, false);
+}
+
+void drawTextureEx(Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle, bool flip) {
+	backend->copy(tex, src != NULL? src : &(SDL_Rect){0, 0, tex->w, tex->h}, dest, angle, flip);
+}
+
+void presentFrame(void) {
+	backend->present();
+}
@@ -0,0 +1,78 @@
+#ifndef RENDER_H_HEADER_GUARD
+#define RENDER_H_HEADER_GUARD
+
+#include <stdbool.h> // bool, true, false
+#include <stddef.h>  // offsetof
+#include <stdint.h>  // uint8_t, uint16_t, int32_t, uint64_t, intptr_t, uintptr_t, INT32_MAX
+#include <string.h>  // memcpy, memset
+#include <math.h>    // sin, cos, floor, ceil, fabs, M_PI
+#include <pthread.h> // pthread_*
+#include <unistd.h>  // sysconf
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_opengl.h>
+
+#include "common.h"
+#include "config.h"
+#include "kernels.h"
+
+/* Textures take RGBA pixels. Blending, color and alpha modulation are read when the texture is
+   drawn, like with SDL's renderer */
+typedef struct {
+	int      w, h;
+	bool     filtering, blend;
+	bool     baked; // Kept until the renderer quits, so a backend may pack it with others for good
+	Rgba     mod;
+	void    *data; // Owned by the backend
+} Texture;
+
+/* What draws the window. Drawing is recorded between presents, so a backend is free to do the work
+   in present. fill and copy get rectangles already in window coordinates, fill with a NULL rectangle
+   covers the whole window */
+typedef struct {
+	const char *name;
+	// Can only fail if there is a fallback, without vsync frames go out as soon as they're drawn
+	bool (*init)          (SDL_Window *win, bool fallback, bool vsync);
+	void (*quit)          (void);
+	int  (*maxTextureSize)(void); // Largest width and height a texture can have
+	void (*createTexture) (Texture *tex);
+	void (*destroyTexture)(Texture *tex);
+	void (*updateTexture) (Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch);
+	bool (*lockTexture)   (Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch);
+	void (*unlockTexture) (Texture *tex);
+	void (*fill)          (const SDL_Rect *r, Rgba color, bool blend);
+	void (*checkerboard)  (int tile, Rgba even, Rgba odd);
+	void (*copy)          (Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle,
+	                       bool flip);
+	void (*present)       (void);
+} RenderBackend;
+
+extern const RenderBackend sdlBackend, cpuBackend, glBackend;
+
+Uint32 getRendererWindowFlags(int renderer); // What the window needs to be created with
+void   initRenderer(SDL_Window *win, int renderer, bool vsync); // One of RENDERER*
+void   quitRenderer(void);
+int    getMaxTextureSize(void);
+
+Texture *createTexture (int w, int h, bool filtering);
+Texture *createBakedTexture(int w, int h, bool filtering); // For the interface, destroyed only at exit
+void     destroyTexture(Texture *tex);
+void     updateTexture (Texture *tex, const SDL_Rect *r, const uint8_t *pxs, int pitch); // NULL r is all
+// Gives out the pixels of r to be written, they're uploaded on unlock. Returns false on failure
+bool     lockTexture   (Texture *tex, const SDL_Rect *r, uint8_t **pxs, int *pitch);
+void     unlockTexture (Texture *tex);
+void     setTextureBlend(Texture *tex, bool blend);
+void     setTextureMod  (Texture *tex, Rgba mod);
+void     setTextureFiltering(Texture *tex, bool filtering);
+
+void drawClear       (Rgba color); // Opacity ignored
+void drawFill        (const SDL_Rect *r, Rgba color);
+void drawOutline     (SDL_Rect r, Rgba color);
+// Square tiles from the top left, where the even ones have an even sum of coordinates. Opacity ignored
+void drawCheckerboard(int tile, Rgba even, Rgba odd);
+void drawTexture     (Texture *tex, const SDL_Rect *src, const SDL_Rect *dest); // NULL src is all
+// Flipped horizontally and then turned clockwise around the center of dest
+void drawTextureEx   (Texture *tex, const SDL_Rect *src, const SDL_Rect *dest, double angle, bool flip);
+void presentFrame    (void);
+
+#endif
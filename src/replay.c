@@ -0,0 +1,214 @@
+#include "replay.h"
+
+// Upper limits of the frame time buckets in milliseconds, the last bucket takes the rest
+static const double bucketLimits[FRAMEBUCKETS - 1] = {2, 4, 8.3, 16.7, 33.3, 50, 100, 250};
+
+Error startRecording(Replay *rep, const char *path, int w, int h) {
+	zeroMem(rep);
+	if ((rep->f = fopen(path, "w")) == NULL) return strerror(errno);
+	// The replay starts with the same window size, so images are fit the same way
+	fprintf(rep->f, REPLAYHEADER"\n0.000 resize %d %d\n", w, h);
+	return NULL;
+}
+
+static void readReplayEvent(Replay *rep) {
+	char line[PATH_MAX + 64], type[16];
+	int  n = 0;
+	++rep->line;
+	// A recording that got cut off ends after its last complete event
+	if (fgets(line, sizeof(line), rep->f) == NULL) {
+		rep->ended = true;
+		return;
+	}
+	line[strcspn(line, "\n")] = 0;
+	if (sscanf(line, "%lf %15s %n", &rep->at, type, &n) < 2)
+		die("Bad line %d of the input recording: %s", rep->line, line);
+
+	SDL_Event  *e    = &rep->next;
+	const char *args = line + n;
+	int         down = 0, a = 0, b = 0, c = 0, d = 0;
+	bool        ok   = true;
+	zeroMem(e);
+	if (strcmp(type, "end") == 0) rep->ended = true;
+	else if (strcmp(type, "quit") == 0) e->type = SDL_QUIT;
+	else if (strcmp(type, "resize") == 0) {
+		ok = sscanf(args, "%d %d", &a, &b) == 2 && a > 0 && b > 0;
+		e->type         = SDL_WINDOWEVENT;
+		e->window.event = SDL_WINDOWEVENT_RESIZED;
+		e->window.data1 = a;
+		e->window.data2 = b;
+	} else if (strcmp(type, "key") == 0) {
+		ok = sscanf(args, "%d %d %d %d %d", &down, &a, &b, &c, &d) == 5 && a >= 0 && a < SDL_NUM_SCANCODES;
+		e->type                = down? SDL_KEYDOWN : SDL_KEYUP;
+		e->key.state           = down? SDL_PRESSED : SDL_RELEASED;
+		e->key.keysym.scancode = a;
+		e->key.keysym.sym      = b;
+		e->key.keysym.mod      = c;
+		e->key.repeat          = d;
+	} else if (strcmp(type, "motion") == 0) {
+		ok = sscanf(args, "%d %d %d", &a, &b, &c) == 3;
+		e->type         = SDL_MOUSEMOTION;
+		e->motion.x     = a;
+		e->motion.y     = b;
+		e->motion.state = c;
+	} else if (strcmp(type, "button") == 0) {
+		ok = sscanf(args, "%d %d %d %d %d", &down, &a, &b, &c, &d) == 5;
+		e->type          = down? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+		e->button.state  = down? SDL_PRESSED : SDL_RELEASED;
+		e->button.button = a;
+		e->button.clicks = b;
+		e->button.x      = c;
+		e->button.y      = d;
+	} else if (strcmp(type, "wheel") == 0) {
+		ok = sscanf(args, "%d %d", &a, &b) == 2;
+		e->type    = SDL_MOUSEWHEEL;
+		e->wheel.x = a;
+		e->wheel.y = b;
+	} else if (strcmp(type, "drop") == 0) {
+		ok = *args != 0;
+		e->type = SDL_DROPFILE;
+		strcpy(rep->drop, args);
+	} else ok = false;
+	if (!ok) die("Bad event on line %d of the input recording: %s", rep->line, line);
+}
+
+Error startReplay(Replay *rep, const char *path) {
+	zeroMem(rep);
+	if ((rep->f = fopen(path, "r")) == NULL) return strerror(errno);
+	rep->replaying = true;
+
+	char header[sizeof(REPLAYHEADER) + 1];
+	if (fgets(header, sizeof(header), rep->f) == NULL || strcmp(header, REPLAYHEADER"\n") != 0) {
+		fclose(rep->f);
+		rep->f = NULL;
+		return "Not an input recording";
+	}
+	rep->line = 1;
+	readReplayEvent(rep);
+	return NULL;
+}
+
+static void pushValue(double **arr, size_t *sz, size_t *cap, double v) {
+	if (*sz >= *cap) resize(*arr, *cap = *cap == 0? 1024 : *cap*2);
+	(*arr)[(*sz)++] = v;
+}
+
+static int cmpDoubles(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Sorts the values in place
+static double percentile(double *arr, size_t sz, double p) {
+	qsort(arr, sz, sizeof(*arr), cmpDoubles);
+	return arr[(size_t)(p*(sz - 1) + 0.5)];
+}
+
+static void printReplayStats(Replay *rep, double t) {
+	printf("Replayed %.2f s: %zu frames, %d of them showing the loading icon\n", t/1000, rep->frameCount,
+	       rep->loadingFrames);
+	if (rep->frameCount > 0) {
+		int hist[FRAMEBUCKETS] = {0};
+		for (size_t i = 0; i < rep->frameCount; ++i) {
+			int b = 0;
+			while (b < FRAMEBUCKETS - 1 && rep->frames[i] > bucketLimits[b]) ++b;
+			++hist[b];
+		}
+		double median = percentile(rep->frames, rep->frameCount, 0.5);
+		printf("Frame time: median %.2f ms, 99th percentile %.2f ms, max %.2f ms\n", median,
+		       percentile(rep->frames, rep->frameCount, 0.99), rep->frames[rep->frameCount - 1]);
+		for (int b = 0; b < FRAMEBUCKETS; ++b) {
+			char label[16];
+			if (b < FRAMEBUCKETS - 1) snprintf(label, sizeof(label), "<= %g", bucketLimits[b]);
+			else snprintf(label, sizeof(label), "> %g", bucketLimits[b - 1]);
+			printf("  %8s ms %7d  %5.1f%%\n", label, hist[b], hist[b]*100.0/rep->frameCount);
+		}
+	}
+
+	if (rep->switchedAt != 0) ++rep->missedSwitches;
+	printf("Next image to the first frame of it decoded whole: %zu switches", rep->switchCount);
+	if (rep->missedSwitches > 0) printf(", %d more never got there", rep->missedSwitches);
+	if (rep->switchCount == 0) {
+		printf("\n");
+		return;
+	}
+	printf("\n  Each (ms):");
+	for (size_t i = 0; i < rep->switchCount; ++i) printf(" %.1f", rep->switches[i]);
+	double median = percentile(rep->switches, rep->switchCount, 0.5);
+	printf("\n  Median %.1f ms, max %.1f ms\n", median, rep->switches[rep->switchCount - 1]);
+}
+
+void finishReplay(Replay *rep, double t) {
+	if (rep->f == NULL) return;
+	if (rep->replaying) printReplayStats(rep, t);
+	else fprintf(rep->f, "%.3f end\n", t);
+	fclose(rep->f);
+	free(rep->frames);
+	free(rep->switches);
+	zeroMem(rep);
+}
+
+bool isInputEvent(const SDL_Event *e) {
+	switch (e->type) {
+	case SDL_KEYDOWN: case SDL_KEYUP: case SDL_MOUSEMOTION: case SDL_MOUSEBUTTONDOWN: case SDL_MOUSEBUTTONUP:
+	case SDL_MOUSEWHEEL: case SDL_DROPFILE:
+		return true;
+	}
+	return false;
+}
+
+void recordEvent(Replay *rep, double t, const SDL_Event *e) {
+	if (rep->f == NULL || rep->replaying) return;
+	switch (e->type) {
+	case SDL_QUIT: fprintf(rep->f, "%.3f quit\n", t); break;
+	case SDL_WINDOWEVENT:
+		if (e->window.event == SDL_WINDOWEVENT_RESIZED)
+			fprintf(rep->f, "%.3f resize %d %d\n", t, e->window.data1, e->window.data2);
+		break;
+	case SDL_KEYDOWN: case SDL_KEYUP:
+		fprintf(rep->f, "%.3f key %d %d %d %d %d\n", t, e->type == SDL_KEYDOWN, e->key.keysym.scancode,
+		        e->key.keysym.sym, e->key.keysym.mod, e->key.repeat);
+		break;
+	case SDL_MOUSEMOTION:
+		fprintf(rep->f, "%.3f motion %d %d %u\n", t, e->motion.x, e->motion.y, e->motion.state);
+		break;
+	case SDL_MOUSEBUTTONDOWN: case SDL_MOUSEBUTTONUP:
+		fprintf(rep->f, "%.3f button %d %d %d %d %d\n", t, e->type == SDL_MOUSEBUTTONDOWN, e->button.button,
+		        e->button.clicks, e->button.x, e->button.y);
+		break;
+	case SDL_MOUSEWHEEL: fprintf(rep->f, "%.3f wheel %d %d\n", t, e->wheel.x, e->wheel.y); break;
+	case SDL_DROPFILE:
+		if (e->drop.file != NULL && *e->drop.file) fprintf(rep->f, "%.3f drop %s\n", t, e->drop.file);
+		break;
+	}
+}
+
+bool nextReplayEvent(Replay *rep, double t, SDL_Event *e) {
+	if (!rep->replaying || rep->ended || rep->at > t) return false;
+	*e = rep->next;
+	if (e->type == SDL_DROPFILE) e->drop.file = strcpy(alloc(char, strlen(rep->drop) + 1), rep->drop);
+	readReplayEvent(rep);
+	return true;
+}
+
+bool isReplayOver(Replay *rep, double t) {
+	return rep->replaying && rep->ended && t >= rep->at;
+}
+
+void countReplayFrame(Replay *rep, double dt, bool loading, bool shown) {
+	if (!rep->replaying) return;
+	if (dt > 0) pushValue(&rep->frames, &rep->frameCount, &rep->frameCap, dt);
+	if (loading) ++rep->loadingFrames;
+	if (shown && rep->switchedAt != 0) {
+		double ms = (double)(SDL_GetPerformanceCounter() - rep->switchedAt)*1000/SDL_GetPerformanceFrequency();
+		pushValue(&rep->switches, &rep->switchCount, &rep->switchCap, ms);
+		rep->switchedAt = 0;
+	}
+}
+
+// A switch that's still pending was overtaken before its image was shown
+void countImageSwitch(Replay *rep) {
+	if (!rep->replaying) return;
+	if (rep->switchedAt != 0) ++rep->missedSwitches;
+	rep->switchedAt = SDL_GetPerformanceCounter();
+}
@@ -0,0 +1,50 @@
+#ifndef REPLAY_H_HEADER_GUARD
+#define REPLAY_H_HEADER_GUARD
+
+#include <stdio.h>        // fopen, fclose, fprintf, fgets, sscanf, printf
+#include <stdlib.h>       // qsort, free
+#include <stdbool.h>      // bool, true, false
+#include <string.h>       // strerror, strlen, strcmp, strcpy, strcspn
+#include <errno.h>        // errno
+#include <linux/limits.h> // PATH_MAX
+
+#include <SDL2/SDL.h>
+
+#include "common.h"
+
+#define REPLAYHEADER "tinview-input 1"
+#define FRAMEBUCKETS 9
+
+/* Input recording and replay. A recording is a text file of the SDL input the viewer got, one event
+   per line after the milliseconds since the viewer started. Replaying feeds the same events back at
+   the same times and measures how the viewer kept up with them */
+typedef struct {
+	FILE     *f; // NULL if neither recording nor replaying
+	bool      replaying;
+	int       line;
+	double    at;   // Time of the next replayed event, or of the end of the recording
+	SDL_Event next;
+	char      drop[PATH_MAX]; // Path of the next event if it's a drop
+	bool      ended;
+
+	// Replay statistics, frame times are in milliseconds
+	double   *frames, *switches;
+	size_t    frameCount, frameCap, switchCount, switchCap;
+	int       loadingFrames, missedSwitches;
+	uint64_t  switchedAt; // Performance counter of the pending image switch, 0 if none
+} Replay;
+
+Error startRecording(Replay *rep, const char *path, int w, int h); // Window size at the start
+Error startReplay   (Replay *rep, const char *path);
+void  finishReplay  (Replay *rep, double t); // Prints the statistics of a replay
+
+bool isInputEvent   (const SDL_Event *e); // Live input is ignored while replaying
+void recordEvent    (Replay *rep, double t, const SDL_Event *e);
+// Gives the next event that is due at t, drop file paths are allocated and freed by the caller
+bool nextReplayEvent(Replay *rep, double t, SDL_Event *e);
+bool isReplayOver   (Replay *rep, double t);
+
+void countReplayFrame(Replay *rep, double dt, bool loading, bool shown); // shown - Image drawn whole
+void countImageSwitch(Replay *rep); // Called by nextImage
+
+#endif
@@ -0,0 +1,140 @@
+#include "tiles.h"
+
+typedef struct {
+	double cx, cy, scale;
+	int    rot;
+	bool   flip;
+	double w, h; // Size of the image
+} TileView;
+
+bool needsTiles(Image *img) {
+	if (img->anim != NULL) return false;
+	int max = getMaxTextureSize();
+	return img->raw.map != NULL || img->w > max || img->h > max;
+}
+
+void clearTiles(ImageTiles *tiles) {
+	for (int i = 0; i < IMGTILESMAX; ++i) {
+		if (tiles->tiles[i].tex != NULL) destroyTexture(tiles->tiles[i].tex);
+		tiles->tiles[i].tex = NULL;
+	}
+	tiles->img = NULL;
+}
+
+// Image pixels are flipped around the center of the image, then turned and scaled into the window
+static void toWindow(const TileView *v, double x, double y, double *wx, double *wy) {
+	double dx = (x - v->w/2)*v->scale, dy = (y - v->h/2)*v->scale;
+	if (v->flip) dx = -dx;
+	for (int i = 0; i < v->rot; ++i) {
+		double t = dx;
+		dx = -dy;
+		dy = t;
+	}
+	*wx = v->cx + dx;
+	*wy = v->cy + dy;
+}
+
+static void toImage(const TileView *v, double wx, double wy, double *x, double *y) {
+	double dx = wx - v->cx, dy = wy - v->cy;
+	for (int i = 0; i < v->rot; ++i) {
+		double t = dx;
+		dx = dy;
+		dy = -t;
+	}
+	if (v->flip) dx = -dx;
+	*x = dx/v->scale + v->w/2;
+	*y = dy/v->scale + v->h/2;
+}
+
+/* Gives the texture of the tile at x, y, converting it if it isn't kept yet and the frame has time
+   for it. Free slots are taken first, then the one drawn the longest ago, never one drawn this frame */
+static Texture *getTile(ImageTiles *tiles, Image *img, int x, int y, int level, uint64_t *spent) {
+	ImageTile *slot = NULL;
+	for (int i = 0; i < IMGTILESMAX; ++i) {
+		ImageTile *t = &tiles->tiles[i];
+		if (t->tex != NULL && t->x == x && t->y == y && t->level == level) {
+			t->drawn = tiles->frame;
+			return t->tex;
+		}
+		if (t->tex == NULL) {
+			if (slot == NULL || slot->tex != NULL) slot = t;
+		} else if (t->drawn < tiles->frame && (slot == NULL || (slot->tex != NULL && t->drawn < slot->drawn)))
+			slot = t;
+	}
+	// An unloaded image can still be shown while it hides, with only the tiles that were kept
+	if (slot == NULL || !isImageLoaded(img) || *spent > SDL_GetPerformanceFrequency()*IMGTILESTIME/1000)
+		return NULL;
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	int step = 1 << level, span = IMGTILESZ*step;
+	int w = ((img->w - x < span? img->w - x : span) + step - 1)/step;
+	int h = ((img->h - y < span? img->h - y : span) + step - 1)/step;
+	if (slot->tex != NULL) destroyTexture(slot->tex);
+	slot->tex   = createTexture(w, h, false);
+	slot->x     = x;
+	slot->y     = y;
+	slot->level = level;
+	slot->drawn = tiles->frame;
+	setTextureBlend(slot->tex, !img->opaque);
+
+	uint8_t *pxs;
+	int      pitch;
+	if (lockTexture(slot->tex, NULL, &pxs, &pitch)) {
+		copyImageTile(img, x, y, w, h, step, pxs, pitch);
+		unlockTexture(slot->tex);
+	}
+	*spent += SDL_GetPerformanceCounter() - start;
+	return slot->tex;
+}
+
+void drawTiles(ImageTiles *tiles, Image *img, double cx, double cy, double scale, int rot, bool flip,
+               bool filtering, int winw, int winh) {
+	if (tiles->img != img) {
+		clearTiles(tiles);
+		tiles->img = img;
+	}
+	++tiles->frame;
+	if (scale <= 0) return;
+	TileView v = {cx, cy, scale, rot, flip, img->w, img->h};
+
+	// Tiles are drawn at half their size or larger, further out every other pixel is skipped instead
+	int level = 0, size = img->w > img->h? img->w : img->h;
+	while ((2 << level)*scale <= 1 && (IMGTILESZ << level) < size) ++level;
+	int step = 1 << level, span = IMGTILESZ*step;
+
+	// The corners of the window in image pixels give the tiles that can be seen
+	double x0 = img->w, y0 = img->h, x1 = 0, y1 = 0;
+	for (int i = 0; i < 4; ++i) {
+		double x, y;
+		toImage(&v, i%2? winw : 0, i/2? winh : 0, &x, &y);
+		if (x < x0) x0 = x;
+		if (x > x1) x1 = x;
+		if (y < y0) y0 = y;
+		if (y > y1) y1 = y;
+	}
+	int tx0 = x0 < 0? 0 : x0/span, tx1 = x1 >= img->w? (img->w - 1)/span : x1/span;
+	int ty0 = y0 < 0? 0 : y0/span, ty1 = y1 >= img->h? (img->h - 1)/span : y1/span;
+
+	// Pages of mapped images can still be on the disk, so a tile could take a while
+	uint64_t spent = 0;
+	for (int ty = ty0; ty <= ty1; ++ty) for (int tx = tx0; tx <= tx1; ++tx) {
+		int      x   = tx*span, y = ty*span;
+		Texture *tex = getTile(tiles, img, x, y, level, &spent);
+		if (tex == NULL) continue;
+		setTextureFiltering(tex, filtering);
+
+		// Both corners are rounded in the window, so neighboring tiles meet without gaps
+		double ax, ay, bx, by;
+		toWindow(&v, x, y, &ax, &ay);
+		toWindow(&v, x + span < img->w? x + span : img->w, y + span < img->h? y + span : img->h, &bx, &by);
+		int left = floor((ax < bx? ax : bx) + 0.5), right  = floor((ax < bx? bx : ax) + 0.5);
+		int top  = floor((ay < by? ay : by) + 0.5), bottom = floor((ay < by? by : ay) + 0.5);
+		/* The rectangle is the tile before it's turned, around the same center. Turned a quarter, its
+		   sides only stay on whole pixels if they're both odd or both even, so it overlaps a pixel more */
+		if (rot%2 && (right - left)%2 != (bottom - top)%2) ++right;
+		SDL_Rect r = {.w = rot%2? bottom - top : right - left, .h = rot%2? right - left : bottom - top};
+		r.x = left + (right - left - r.w)/2;
+		r.y = top  + (bottom - top - r.h)/2;
+		drawTextureEx(tex, NULL, &r, rot*90, flip);
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef TILES_H_HEADER_GUARD
+#define TILES_H_HEADER_GUARD
+
+#include <stdbool.h> // bool, true, false
+#include <stdint.h>  // uint8_t, uint64_t
+#include <math.h>    // floor
+
+#include <SDL2/SDL.h>
+
+#include "common.h"
+#include "loader.h"
+#include "render.h"
+
+#define IMGTILESZ     512 // Width and height of a tile texture
+#define IMGTILESMAX   256 // Tile textures kept, the ones drawn the longest ago are reused first
+#define IMGTILESTIME  8   // Milliseconds a frame converts tiles for, the rest show up in the next ones
+
+/* Mapped images and images too big for a single texture are drawn from tiles, which are converted
+   from the image only once they come into view. Zoomed out, a tile takes every 2nd, 4th... pixel,
+   so what's converted stays around the size of the window no matter how big the image is */
+typedef struct {
+	Texture *tex;     // NULL if the slot is free
+	int      x, y;    // Top left in image pixels
+	int      level;   // Every level halves the resolution
+	uint64_t drawn;   // Frame it was last drawn in
+} ImageTile;
+
+typedef struct {
+	Image    *img; // The image the tiles are of
+	ImageTile tiles[IMGTILESMAX];
+	uint64_t  frame;
+} ImageTiles;
+
+bool needsTiles(Image *img); // For a loaded still image, once the renderer is up
+void clearTiles(ImageTiles *tiles); // The pixels of the image changed, or it isn't shown anymore
+/* Draws img centered at cx, cy and scaled, flipped horizontally and then turned clockwise rot
+   quarter turns like drawTextureEx does. Only the tiles inside of the window are drawn */
+void drawTiles(ImageTiles *tiles, Image *img, double cx, double cy, double scale, int rot, bool flip,
+               bool filtering, int winw, int winh);
+
+#endif
@@ -1,7 +1,6 @@
 #include "viewer.h"
 
 static SDL_Window   *win;
-static SDL_Renderer *ren;
 static SDL_Cursor   *cursorNormal, *cursorMove;
 static bool          keys[SDL_NUM_SCANCODES];
 static int           winw, winh;
@@ -17,15 +16,47 @@ static bool   mgrabbed;
 static Images       imgs;
 static Image       *img;
 static int          imgIdx;
-static SDL_Texture *imgTex;
+static Texture     *imgTex, *imgBackTex; // The back texture is only used for feed frames
+static uint8_t      texRot; // Rotation and flips already applied to the pixels in imgTex
+static bool         texFlipv, texFliph;
+static ImageTiles   imgTiles; // Mapped and too big images are drawn from these instead of imgTex
+static bool         tiled;
+static ViewOptions  opts;
+static Feed        *feed;
+static Instance     inst = {.fd = -1};
+static Replay       replay;
+static char        *handedPaths; // Sent by another invocation, opened once no transition is running
+
+#define PLAYMAXAHEAD   32 // Most frames decoded ahead of the playhead
+#define PLAYDEFAULTFPS 24 // Used when playback is started with P and no fps was given
+
+// Flipbook playback of the images list, frames count up from the start and wrap around the range
+static struct {
+	bool   on;
+	double fps, clock; // clock - Milliseconds since the start of the playback
+	int    first, len; // Range in the images list
+	bool   loop;
+	int    shown;      // Last shown frame, -1 before the first one
+
+	// Decoding ahead of the playhead, the window is sized from the fps and measured load time
+	double  loadTime;
+	Image  *requested[PLAYMAXAHEAD];
+	double  requestedAt[PLAYMAXAHEAD];
+
+	double achievedFps, fpsTimer;
+	int    fpsFrames, dropped;
+} play;
+static bool playPending; // Playback was requested from the command line, starts once the image shows
+
 static bool         waiting; // Is the viewer waiting for the image to finish loading?
+static int          shownRows; // Rows of a progressively loading image that are in the texture
 static void       (*runAfterHidden)(void);
 static double       showTimer, hideTimer, gifTimer, filterIconTimer;
-static int          gifFrame, filter;
+static int          filter;
 
 typedef struct {
-	SDL_Texture *tex;
-	int          w, h;
+	Texture *tex;
+	int      w, h;
 } Baked;
 
 static Baked loadingIcon, errorIcon, filteringIcon, shadowSheet;
@@ -36,15 +67,16 @@ static Baked loadingIcon, errorIcon, filteringIcon, shadowSheet;
 #include "baked_filtering.inc"
 #include "baked_shadow.inc"
 
+// Baked assets are RGBA pixels, see tools/bake.c
 static struct {
-	Baked   *baked;
-	uint8_t *raw;
-	int      sz;
+	Baked         *baked;
+	const uint8_t *pxs;
+	int            w, h;
 } bakedList[] = {
-	{&loadingIcon,   baked_loading_png,   sizeof(baked_loading_png)},
-	{&errorIcon,     baked_error_png,     sizeof(baked_error_png)},
-	{&filteringIcon, baked_filtering_png, sizeof(baked_filtering_png)},
-	{&shadowSheet,   baked_shadow_png,    sizeof(baked_shadow_png)},
+	{&loadingIcon,   baked_loading,   baked_loading_w,   baked_loading_h},
+	{&errorIcon,     baked_error,     baked_error_w,     baked_error_h},
+	{&filteringIcon, baked_filtering, baked_filtering_w, baked_filtering_h},
+	{&shadowSheet,   baked_shadow,    baked_shadow_w,    baked_shadow_h},
 };
 
 #define togglefmt(X) ((X)? "enable" : "disable")
@@ -54,28 +86,12 @@ static void fullscreen(bool on) {
 		error("Failed to %s fullscreen: %s", togglefmt(on), SDL_GetError());
 }
 
-static SDL_Texture *createTexture(int w, int h, bool filtering) {
-	if (!SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, filtering? "linear" : "nearest"))
-		error("Failed to %s filtering: %s", togglefmt(filtering), SDL_GetError());
-
-	SDL_Texture *tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_ABGR8888,
-	                                     SDL_TEXTUREACCESS_STREAMING, w, h);
-	if (tex == NULL) die("Failed to create texture: %s", SDL_GetError());
-	SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
-	return tex;
-}
-
-static void loadBaked(Baked *baked, uint8_t *raw, int sz) {
-	uint8_t *pxs = stbi_load_from_memory(raw, sz, &baked->w, &baked->h, NULL, 4);
-	if (pxs == NULL) die("Failed to load baked asset: %s", stbi_failure_reason());
-
-	baked->tex = createTexture(baked->w, baked->h, true);
-	SDL_UpdateTexture(baked->tex, NULL, pxs, baked->w*4);
-	free(pxs);
-
-	Rgba color = conf.colors.icons;
-	SDL_SetTextureColorMod(baked->tex, color.r, color.g, color.b);
-	SDL_SetTextureAlphaMod(baked->tex, color.a);
+static void loadBaked(Baked *baked, const uint8_t *pxs, int w, int h) {
+	baked->w   = w;
+	baked->h   = h;
+	baked->tex = createBakedTexture(w, h, true);
+	updateTexture(baked->tex, NULL, pxs, w*4);
+	setTextureMod(baked->tex, conf.colors.icons);
 }
 
 static void setCursor(SDL_Cursor *cursor) {
@@ -83,36 +99,35 @@ static void setCursor(SDL_Cursor *cursor) {
 }
 
 static void loadWindowIcon(void) {
-	int      w, h;
-	uint8_t *pxs = stbi_load_from_memory(baked_icon_png, sizeof(baked_icon_png), &w, &h, NULL, 4);
-	if (pxs == NULL) die("Failed to load baked window icon asset: %s", stbi_failure_reason());
-
-	SDL_Surface *surf = SDL_CreateRGBSurfaceFrom(pxs, w, h, 32, w*4,
-	                                             0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000);
+	// The surface only reads the pixels
+	SDL_Surface *surf = SDL_CreateRGBSurfaceFrom((void*)baked_icon, baked_icon_w, baked_icon_h, 32,
+	                                             baked_icon_w*4, 0x000000FF, 0x0000FF00, 0x00FF0000,
+	                                             0xFF000000);
 	if (surf == NULL) die("Failed to create surface for window icon: %s", SDL_GetError());
-	free(pxs);
 	SDL_SetWindowIcon(win, surf);
 	SDL_FreeSurface(surf);
 }
 
-static void setup(const char *browsePath) {
+static void setup(void) {
 	winw   = conf.win.startw;
 	winh   = conf.win.starth;
 	filter = conf.img.filter;
 
 	/* TODO: SDL2 startup is slow for some reason. Switch to some other graphics library? Maybe
-	         OpenGL + glfw? */
-	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) die("Failed to initialize SDL2: %s", SDL_GetError());
+	         glfw? */
+	// Replays run without a display, unless SDL_VIDEODRIVER asks for one
+	if (opts.replay != NULL) SDL_SetHintWithPriority(SDL_HINT_VIDEODRIVER, "dummy", SDL_HINT_DEFAULT);
+	// Audio, joysticks and the rest are never used, and they take a while to start
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) < 0)
+		die("Failed to initialize SDL2: %s", SDL_GetError());
 	if ((win = SDL_CreateWindow(TITLE, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-	                            winw, winh, SDL_WINDOW_RESIZABLE)) == NULL)
+	                            winw, winh, SDL_WINDOW_RESIZABLE |
+	                            getRendererWindowFlags(conf.win.renderer))) == NULL)
 		die("Failed to create window: %s", SDL_GetError());
 	SDL_SetWindowMinimumSize(win, conf.win.minw, conf.win.minh);
 	fullscreen(conf.win.fullscr);
-	if ((ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE |
-	                                       SDL_RENDERER_PRESENTVSYNC)) == NULL)
-		die("Failed to create renderer: %s", SDL_GetError());
-	if (SDL_SetRenderDrawBlendMode(ren, SDL_BLENDMODE_BLEND) < 0)
-		error("Failed to set blend mode: %s", SDL_GetError());
+	// A replay measures how long frames take to draw, so they aren't held back to the display
+	initRenderer(win, conf.win.renderer, opts.replay == NULL);
 
 	cursorNormal = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
 	cursorMove   = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_SIZEALL);
@@ -123,33 +138,35 @@ static void setup(const char *browsePath) {
 	loadWindowIcon();
 
 	for (size_t i = 0; i < lenOf(bakedList); ++i)
-		loadBaked(bakedList[i].baked, bakedList[i].raw, bakedList[i].sz);
+		loadBaked(bakedList[i].baked, bakedList[i].pxs, bakedList[i].w, bakedList[i].h);
 
-	Error err = initImages(&imgs, browsePath);
-	// Error in initImages still leaves it in a usable state
-	if (err != NULL) error("Error while initializing images list: %s", err);
+	imgs.watchReload = conf.img.reload == RELOADWATCH;
 }
 
 static void cleanup(void) {
+	finishReplay(&replay, elapsed);
 	freeImages(&imgs);
 	SDL_FreeCursor(cursorNormal);
 	SDL_FreeCursor(cursorMove);
-	if (imgTex != NULL) SDL_DestroyTexture(imgTex);
-	for (size_t i = 0; i < lenOf(bakedList); ++i) SDL_DestroyTexture(bakedList[i].baked->tex);
-	SDL_DestroyRenderer(ren);
+	if (imgTex     != NULL) destroyTexture(imgTex);
+	if (imgBackTex != NULL) destroyTexture(imgBackTex);
+	clearTiles(&imgTiles);
+	for (size_t i = 0; i < lenOf(bakedList); ++i) destroyTexture(bakedList[i].baked->tex);
+	quitRenderer();
 	SDL_DestroyWindow(win);
 	SDL_Quit();
+	closeInstance(&inst);
 }
 
 static void darken(double t) {
 	Rgba color = conf.colors.darken;
-	SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, t*color.a);
-	SDL_RenderFillRect(ren, NULL);
+	color.a *= t;
+	drawFill(NULL, color);
 }
 
 static void renderError(void) {
 	darken(1);
-	SDL_RenderCopy(ren, errorIcon.tex, NULL, &(SDL_Rect){
+	drawTexture(errorIcon.tex, NULL, &(SDL_Rect){
 		.x = winw/2 - errorIcon.w/2,
 		.y = winh/2 - errorIcon.h/2,
 		.w = errorIcon.w,
@@ -159,40 +176,40 @@ static void renderError(void) {
 
 static void renderLoading(void) {
 	darken(1);
-	SDL_RenderCopyEx(ren, loadingIcon.tex, NULL, &(SDL_Rect){
+	drawTextureEx(loadingIcon.tex, NULL, &(SDL_Rect){
 		.x = winw/2 - loadingIcon.w/2,
 		.y = winh/2 - loadingIcon.h/2,
 		.w = loadingIcon.w,
 		.h = loadingIcon.h,
-	}, sin(elapsed/400)*360, NULL, SDL_FLIP_NONE);
+	}, sin(elapsed/400)*360, false);
 }
 
 static void renderShadow(SDL_Rect r) {
 	int sz = shadowSheet.w/2;
 	// Top left
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = 0, .y = 0, .w = sz, .h = sz},
-	               &(SDL_Rect){.x = r.x - sz, .y = r.y - sz, .w = sz, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = 0, .y = 0, .w = sz, .h = sz},
+	            &(SDL_Rect){.x = r.x - sz, .y = r.y - sz, .w = sz, .h = sz});
 	// Top
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){ .x = sz, .y = 0, .w = 1, .h = sz},
-	               &(SDL_Rect){ .x = r.x, .y = r.y - sz, .w = r.w, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){ .x = sz, .y = 0, .w = 1, .h = sz},
+	            &(SDL_Rect){ .x = r.x, .y = r.y - sz, .w = r.w, .h = sz});
 	// Top right
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = sz + 1, .y = 0, .w = sz, .h = sz},
-	               &(SDL_Rect){.x = r.x + r.w, .y = r.y - sz, .w = sz, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = sz + 1, .y = 0, .w = sz, .h = sz},
+	            &(SDL_Rect){.x = r.x + r.w, .y = r.y - sz, .w = sz, .h = sz});
 	// Right
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz, .w = sz, .h = 1},
-	               &(SDL_Rect){.x = r.x + r.w, .y = r.y, .w = sz, .h = r.h});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz, .w = sz, .h = 1},
+	            &(SDL_Rect){.x = r.x + r.w, .y = r.y, .w = sz, .h = r.h});
 	// Bottom right
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz + 1, .w = sz, .h = sz},
-	               &(SDL_Rect){.x = r.x + r.w, .y = r.y + r.h, .w = sz, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz + 1, .w = sz, .h = sz},
+	            &(SDL_Rect){.x = r.x + r.w, .y = r.y + r.h, .w = sz, .h = sz});
 	// Bottom
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz, .w = 1, .h = sz},
-	               &(SDL_Rect){.x = r.x, .y = r.y + r.h, .w = r.w, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = sz, .y = sz, .w = 1, .h = sz},
+	            &(SDL_Rect){.x = r.x, .y = r.y + r.h, .w = r.w, .h = sz});
 	// Bottom left
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = 0, .y = sz + 1, .w = sz, .h = sz},
-	               &(SDL_Rect){.x = r.x - sz, .y = r.y + r.h, .w = sz, .h = sz});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = 0, .y = sz + 1, .w = sz, .h = sz},
+	            &(SDL_Rect){.x = r.x - sz, .y = r.y + r.h, .w = sz, .h = sz});
 	// Left
-	SDL_RenderCopy(ren, shadowSheet.tex, &(SDL_Rect){.x = 0, .y = sz, .w = sz, .h = 1},
-	               &(SDL_Rect){.x = r.x - sz, .y = r.y, .w = sz, .h = r.h});
+	drawTexture(shadowSheet.tex, &(SDL_Rect){.x = 0, .y = sz, .w = sz, .h = 1},
+	            &(SDL_Rect){.x = r.x - sz, .y = r.y, .w = sz, .h = r.h});
 }
 
 static void renderOutline(SDL_Rect r) {
@@ -200,9 +217,7 @@ static void renderOutline(SDL_Rect r) {
 	r.y -= 1;
 	r.w += 1;
 	r.h += 1;
-	Rgba color = conf.colors.outline;
-	SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, color.a);
-	SDL_RenderDrawRect(ren, &r);
+	drawOutline(r, conf.colors.outline);
 }
 
 static double lerp(double a, double b, double t) {
@@ -218,6 +233,20 @@ static double easeInCubic(double t) {
 	return t*t*t;
 }
 
+/* Orientations are reduced to a clockwise rotation of a texture that's optionally flipped
+   horizontally, since a vertical flip is a horizontal one turned by half a turn. Gives what's left
+   to do on imgTex to show the image the way it's oriented */
+static void getTextureTransform(int *rot, bool *flip) {
+	int  d  = img->rot + 2*img->flipv, t = texRot + 2*texFlipv;
+	bool dm = img->fliph != img->flipv, tm = texFliph != texFlipv;
+	*flip = dm != tm;
+	*rot  = ((*flip? d + t : d - t)%4 + 4)%4;
+}
+
+static bool isFiltering(void) {
+	return filter == FILTERAUTO? zoom < 1 : filter == FILTERLINEAR;
+}
+
 static void renderImage(void) {
 	double tshow = 1, thide = 1;
 	if (conf.img.animTime > 0) {
@@ -225,15 +254,19 @@ static void renderImage(void) {
 		thide = hideTimer > 0? easeInCubic(hideTimer/conf.img.animTime) : 1;
 	}
 	double scale = zoomt*tshow*thide;
+	int    texw  = texRot%2? img->h : img->w, texh = texRot%2? img->w : img->h;
 	SDL_Rect r = {
-		.x = winw/2 - camxt - img->w/2*scale,
-		.y = winh/2 - camyt - img->h/2*scale,
-		.w = img->w*scale,
-		.h = img->h*scale,
+		.x = winw/2 - camxt - texw/2*scale,
+		.y = winh/2 - camyt - texh/2*scale,
+		.w = texw*scale,
+		.h = texh*scale,
 	};
 	// TODO: Smooth image rotation animation?
-	SDL_RenderCopyEx(ren, imgTex, NULL, &r, img->rot*90, NULL,
-	                 SDL_FLIP_VERTICAL*img->flipv | SDL_FLIP_HORIZONTAL*img->fliph);
+	int  rot;
+	bool flip;
+	getTextureTransform(&rot, &flip);
+	if (!tiled) drawTextureEx(imgTex, NULL, &r, rot*90, flip);
+	else drawTiles(&imgTiles, img, winw/2 - camxt, winh/2 - camyt, scale, rot, flip, isFiltering(), winw, winh);
 
 	if (img->rot%2) {
 		r.x = winw/2 - camxt - img->h/2*scale;
@@ -263,34 +296,18 @@ static void renderFilterIcon(void) {
 	};
 	double t = filterIconTimer/FILTERICONTIME*1.3;
 	if (t > 1) t = 1;
-	SDL_SetTextureAlphaMod(filteringIcon.tex, t*conf.colors.icons.a);
-	SDL_RenderCopy(ren, filteringIcon.tex, &src, &dest);
-}
-
-static void renderCheckerboard(void) {
-	for (int y = 0; y <= winh/TILESZ; ++y) {
-		for (int x = 0; x <= winw/TILESZ; ++x) {
-			Rgba color = conf.colors.checkerboard[(x + y)%2 == 0];
-			SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, SDL_ALPHA_OPAQUE);
-			SDL_RenderFillRect(ren, &(SDL_Rect){
-				.x = x*TILESZ,
-				.y = y*TILESZ,
-				.w = TILESZ,
-				.h = TILESZ,
-			});
-		}
-	}
+	Rgba color = conf.colors.icons;
+	color.a *= t;
+	setTextureMod(filteringIcon.tex, color);
+	drawTexture(filteringIcon.tex, &src, &dest);
 }
 
 static void render(void) {
-	Rgba color = conf.colors.checkerboard[0];
-	SDL_SetRenderDrawColor(ren, color.r, color.g, color.b, SDL_ALPHA_OPAQUE);
-	SDL_RenderClear(ren);
-
-	renderCheckerboard();
+	drawClear(conf.colors.checkerboard[0]);
+	drawCheckerboard(TILESZ, conf.colors.checkerboard[1], conf.colors.checkerboard[0]);
 
 	if      (!imgs.sz) renderError();
-	else if (waiting)  renderLoading();
+	else if (waiting && shownRows == 0) renderLoading();
 	/* If there's no error, render the image, even if it's possibly not loaded. This is so that
 	   when an image gets unloaded after being modified, we can still play the hide animation and
 	   render the image before reloading it */
@@ -299,19 +316,35 @@ static void render(void) {
 
 	if (filterIconTimer > 0) renderFilterIcon();
 
-	SDL_RenderPresent(ren);
+	presentFrame();
+}
+
+// Same conditions render goes by, for the replay statistics
+static bool isLoadingShown(void) {
+	return imgs.sz && waiting && shownRows == 0;
+}
+
+static bool isWholeImageShown(void) {
+	return imgs.sz && img != NULL && !waiting && img->err == NULL && isImageLoaded(img) && hideTimer == 0;
 }
 
 static void updateWindowTitle(void) {
 	static char title[PATH_MAX + 32];
 	if (waiting) strcpy(title, TITLE" - (...) ");
 	else sprintf(title, TITLE" - (%ix%i) ", img->w, img->h);
+	if (play.on) {
+		sprintf(title + strlen(title), "[%.1f/%g fps", play.achievedFps, play.fps);
+		if (play.dropped > 0) sprintf(title + strlen(title), ", %i dropped", play.dropped);
+		strcat(title, "] ");
+	}
 
-	const char *path = img->path;
-	if (*path == 0) {
+	if (*img->path == 0) {
 		SDL_SetWindowTitle(win, title);
 		return;
 	}
+	char fullPath[PATH_MAX];
+	getImagePath(&imgs, img, fullPath);
+	const char *path = fullPath;
 
 	// Shorten path by current working directory path
 	char cwd[PATH_MAX];
@@ -331,15 +364,81 @@ static void updateWindowTitle(void) {
 	SDL_SetWindowTitle(win, title);
 }
 
+static Texture *createImageTexture(void) {
+	return createTexture(img->w, img->h, isFiltering());
+}
+
+/* RGBA pixels are uploaded as they are. Mapped, grayscale and RGB images are converted straight
+   into the texture. The blend mode follows the pixels, because frames of a sequence can differ */
+static void uploadImageRows(Texture *tex, int y, int h) {
+	setTextureBlend(tex, !img->opaque);
+	SDL_Rect r = {0, y, img->w, h};
+	if (img->pxs != NULL && img->ch == 4) {
+		updateTexture(tex, &r, img->pxs + (size_t)y*img->w*4, img->w*4);
+		return;
+	}
+
+	uint8_t *pxs;
+	int      pitch;
+	if (!lockTexture(tex, &r, &pxs, &pitch)) return;
+	copyImageRows(img, y, h, pxs, pitch);
+	unlockTexture(tex);
+}
+
+/* Rotated and flipped blits are a lot slower than plain ones in the software renderer, so still
+   images get a transformed copy made on a worker. The old texture is drawn transformed until then */
+static void orientShownImage(void) {
+	if (waiting || play.on || tiled || (feed != NULL && !*img->path)) return;
+	if (!isImageLoaded(img) || img->anim != NULL) return;
+	int  rot;
+	bool flip;
+	getTextureTransform(&rot, &flip);
+	if (rot == 0 && !flip) cancelOrient(img);
+	else orientImage(img);
+}
+
+static void updateOrientedImage(void) {
+	uint8_t  rot;
+	bool     flipv, fliph;
+	uint8_t *pxs = takeOrientedImage(img, &rot, &flipv, &fliph);
+	if (pxs == NULL) return;
+
+	int w = rot%2? img->h : img->w, h = rot%2? img->w : img->h;
+	destroyTexture(imgTex);
+	imgTex = createTexture(w, h, isFiltering());
+	setTextureBlend(imgTex, !img->opaque);
+	updateTexture(imgTex, NULL, pxs, w*4);
+	free(pxs);
+	texRot   = rot;
+	texFlipv = flipv;
+	texFliph = fliph;
+}
+
 static void recreateImageTexture(void) {
-	if (imgTex != NULL) SDL_DestroyTexture(imgTex);
-	imgTex = createTexture(img->w, img->h, filter == FILTERAUTO? zoom < 1 : filter == FILTERLINEAR);
-	SDL_UpdateTexture(imgTex, NULL, img->pxs + img->w*img->h*gifFrame*img->isGif, img->w*4);
+	if (imgTex     != NULL) destroyTexture(imgTex);
+	if (imgBackTex != NULL) destroyTexture(imgBackTex);
+	clearTiles(&imgTiles);
+	imgTex     = imgBackTex = NULL;
+	texRot     = 0;
+	texFlipv   = texFliph = false;
+	// Tiles are converted as they're drawn
+	if ((tiled = !waiting && needsTiles(img))) return;
+	imgTex = createImageTexture();
+	// While loading progressively, the rows after shownRows could still be getting written
+	uploadImageRows(imgTex, 0, waiting? shownRows : img->h);
+	orientShownImage();
+}
+
+// Filtering is read when the texture is drawn, so switching it doesn't upload the image again
+static void updateFiltering(void) {
+	if (imgTex     != NULL) setTextureFiltering(imgTex,     isFiltering());
+	if (imgBackTex != NULL) setTextureFiltering(imgBackTex, isFiltering());
 }
 
 static bool isImageAvailable(void) {
-	if (!imgs.sz || waiting) return false;
-	return img->loaded;
+	if (!imgs.sz) return false;
+	if (waiting)  return shownRows > 0; // Progressively loading images can be shown already
+	return isImageLoaded(img);
 }
 
 static void setZoom(double z, double ox, double oy) {
@@ -350,12 +449,7 @@ static void setZoom(double z, double ox, double oy) {
 	camx = (camx + ox)/prevZoom*zoom - ox;
 	camy = (camy + oy)/prevZoom*zoom - oy;
 
-	// Can't recreate image texture if the image isn't available
-	if (!isImageAvailable()) return;
-	/* TODO: recreateImageTexture() is slower with big images (for example 4285x5712), so there
-	         might be a weird jump between zoom < 1 and zoom > 1. Fix this somehow? Maybe with
-	         OpenGL I won't have to recreate the texture to change filtering? */
-	if (filter == FILTERAUTO && (prevZoom > 1) != (zoom > 1)) recreateImageTexture();
+	if (filter == FILTERAUTO) updateFiltering();
 }
 
 static void resetCamera() {
@@ -370,8 +464,7 @@ static void resetCamera() {
 
 static void showImage(void) {
 	showTimer = conf.img.animTime;
-	gifTimer  = 0;
-	gifFrame  = 0;
+	gifTimer  = 0; // Animations are streamed, so a gif shown before resumes where it was left
 	updateWindowTitle();
 	recreateImageTexture();
 	resetCamera();
@@ -391,44 +484,252 @@ static void hideImage(void (*fn)(void)) {
 }
 
 static void startLoadingImage(void) {
-	waiting = true;
-	if (*img->path) loadImage(img);
+	waiting   = true;
+	shownRows = 0;
+	if      (*img->path) loadImage(&imgs, img);
+	else if (opts.feed)  feed = startFeed(img);
 	else loadImageFromStdin(img);
 }
 
 static void prepareImage(void) {
 	assert((size_t)imgIdx < imgs.sz);
-	img = imgs.raw[imgIdx];
+	if (img != NULL) cancelOrient(img);
+	img = imgs.pinned = getImage(&imgs, imgIdx);
+	shownRows = 0;
 
 	if      (isImageLoading(img)) waiting = true;      // Image is already loading, wait for it
-	else if (img->loaded)         showImage();         // Image is cached, just show it
+	else if (isImageLoaded(img))  showImage();         // Image is cached, just show it
 	else if (img->err == NULL)    startLoadingImage(); // Start loading the image
 
 	updateWindowTitle();
 }
 
+// Uploads the rows a progressive decoder finished since the last update
+static void updatePartialImage(void) {
+	int rows = getImageRows(img), max = getMaxTextureSize();
+	if (rows <= shownRows || img->w > max || img->h > max) return; // Too big ones are tiled once loaded
+	if (shownRows == 0) {
+		shownRows = rows;
+		showImage();
+		return;
+	}
+	uploadImageRows(imgTex, shownRows, rows - shownRows);
+	shownRows = rows;
+}
+
 static void loadingEnded(void) {
-	waiting = false;
-	if (img->loaded) showImage();
+	bool shown = shownRows > 0;
+	waiting   = false;
+	shownRows = 0;
+	// If it was shown while loading, the camera and transition shouldn't be reset
+	if (isImageLoaded(img) && shown) {
+		updateWindowTitle();
+		recreateImageTexture();
+	} else if (isImageLoaded(img)) showImage();
 	/* Image just finished loading, but it's not loaded. This means it was probably requested to
 	   unload because the file got modified while it was being loaded, so let's just reload the
 	   image */
 	else if (img->err == NULL) startLoadingImage();
-	else if (*img->path) error("Failed to load image \"%s\": %s", img->path, img->err);
-	else                 error("Failed to load image from stdin: %s", img->err);
+	else if (*img->path) {
+		char path[PATH_MAX];
+		getImagePath(&imgs, img, path);
+		error("Failed to load image \"%s\": %s", path, img->err);
+	} else error("Failed to load image from stdin: %s", img->err);
 }
 
 static void nextImage(int dir) {
 	if (imgs.sz <= 1 || showTimer > 0 || hideTimer > 0) return;
+	// Images might have been added or removed since, so the index of the current one could change
+	imgIdx = getImageIndex(&imgs, img);
 	if (dir > 0) if (++imgIdx >= (int)imgs.sz) imgIdx = 0;
 	if (dir < 0) if (imgIdx-- == 0)            imgIdx = imgs.sz - 1;
+	countImageSwitch(&replay);
 	hideImage(prepareImage);
 }
 
 static void rotateImage(int dir) {
 	if (imgs.sz == 0) return;
 	if (dir > 0) if (++img->rot > 3)  img->rot = 0;
-	if (dir < 0) if (img->rot-- == 3) img->rot = 3;
+	if (dir < 0) if (img->rot-- == 0) img->rot = 3;
+	orientShownImage();
+}
+
+static void flipImage(bool vertical) {
+	if (imgs.sz == 0) return;
+	if (vertical) img->flipv = !img->flipv;
+	else img->fliph = !img->fliph;
+	orientShownImage();
+}
+
+static Image *getPlaybackFrame(int frame) {
+	return getImage(&imgs, play.first + frame%play.len);
+}
+
+static void startPlayback(void) {
+	if (!isImageAvailable()) return;
+	int first = opts.first > 0? opts.first - 1 : 0, last = opts.last > 0? opts.last - 1 : (int)imgs.sz - 1;
+	if (last  >= (int)imgs.sz) last = imgs.sz - 1;
+	if (first > last) return;
+
+	cancelOrient(img); // Frames are drawn transformed, the view can't wait for copies of them
+	play.on    = true;
+	play.fps   = opts.fps > 0? opts.fps : PLAYDEFAULTFPS;
+	play.loop  = opts.loop;
+	play.first = first;
+	play.len   = last - first + 1;
+	play.clock = play.achievedFps = play.fpsTimer = 0;
+	play.shown = -1;
+	play.fpsFrames = play.dropped = 0;
+	if (play.loadTime == 0) play.loadTime = 1000/play.fps;
+
+	// Start from the shown image if it's in the range
+	imgIdx = getImageIndex(&imgs, img);
+	if (imgIdx >= first && imgIdx <= last) {
+		play.clock = (imgIdx - first)*1000/play.fps;
+		play.shown = imgIdx - first;
+	}
+	updateWindowTitle();
+}
+
+static void stopPlayback(void) {
+	play.on = false;
+	orientShownImage();
+	updateWindowTitle();
+}
+
+// Keeps the frames after the playhead loading, and measures how long they take
+static void requestPlaybackFrames(int target) {
+	for (int i = 0; i < PLAYMAXAHEAD; ++i) {
+		Image *frame = play.requested[i];
+		if (frame == NULL || isImageLoading(frame)) continue;
+		if (isImageLoaded(frame)) play.loadTime = lerp(play.loadTime, elapsed - play.requestedAt[i], 0.2);
+		play.requested[i] = NULL;
+	}
+
+	int ahead = ceil(play.loadTime*play.fps/1000) + 1;
+	if (ahead > PLAYMAXAHEAD) ahead = PLAYMAXAHEAD;
+	for (int f = target; f <= target + ahead; ++f) {
+		if (!play.loop && f >= play.len) break;
+		Image *frame = getPlaybackFrame(f);
+		if (isImageLoaded(frame) || isImageLoading(frame) || frame->err != NULL) continue;
+		for (int i = 0; i < PLAYMAXAHEAD; ++i) if (play.requested[i] == NULL) {
+			play.requested[i]   = frame;
+			play.requestedAt[i] = elapsed;
+			loadImage(&imgs, frame);
+			break;
+		}
+	}
+
+	// Frames behind the playhead are unloaded, unless the range is so short they're also ahead of it
+	for (int f = play.shown - PLAYMAXAHEAD; f < play.shown; ++f) {
+		if (f < 0 || target + ahead - f >= play.len) continue;
+		Image *frame = getPlaybackFrame(f);
+		if (frame != img && isImageLoaded(frame)) unloadImage(frame);
+	}
+}
+
+static void showPlaybackFrame(int f) {
+	Image *frame = getPlaybackFrame(f);
+	play.dropped += f - play.shown - 1;
+	play.shown    = f;
+	++play.fpsFrames;
+
+	// The view stays the same for the whole sequence
+	frame->rot   = img->rot;
+	frame->flipv = img->flipv;
+	frame->fliph = img->fliph;
+	bool sameSize = frame->w == img->w && frame->h == img->h;
+	img = imgs.pinned = frame;
+	bool plain    = texRot == 0 && !texFlipv && !texFliph;
+	if (sameSize && plain && !tiled && img->anim == NULL && !needsTiles(img))
+		uploadImageRows(imgTex, 0, img->h);
+	else recreateImageTexture();
+}
+
+// Shows the newest loaded frame up to where the clock is, frames that didn't load in time are dropped
+static void updatePlayback(void) {
+	// Images could have been removed from the end of the list
+	if (play.first + play.len > (int)imgs.sz) play.len = imgs.sz - play.first;
+	if (play.len <= 0) {
+		stopPlayback();
+		return;
+	}
+
+	play.clock += dt;
+	int target = play.clock*play.fps/1000;
+	if (!play.loop && target >= play.len) target = play.len - 1;
+
+	requestPlaybackFrames(target);
+	for (int f = target; f > play.shown; --f) {
+		if (isImageLoaded(getPlaybackFrame(f))) {
+			showPlaybackFrame(f);
+			break;
+		}
+	}
+
+	if ((play.fpsTimer += dt) >= 1000) {
+		play.achievedFps = play.fpsFrames*1000/play.fpsTimer;
+		play.fpsTimer    = play.fpsFrames = 0;
+		updateWindowTitle();
+	}
+	// Without looping, stop once the last frame is shown or it failed to load
+	Image *last = getPlaybackFrame(play.len - 1);
+	if (!play.loop && target == play.len - 1)
+		if (play.shown == target || (!isImageLoading(last) && !isImageLoaded(last))) stopPlayback();
+}
+
+// Adds the images handed by another invocation to the list and gives the index of the first one
+static int addHandedPaths(void) {
+	for (char *path = handedPaths; *path; path += strlen(path) + 1) getOrAddImage(&imgs, path);
+	int  idx;
+	bool found = searchImageByName(&imgs, handedPaths, &idx);
+	assert(found); // We just inserted it, so it must be there
+	unused(found);
+	free(handedPaths);
+	handedPaths = NULL;
+	return idx;
+}
+
+// Handed paths are absolute, so the directory of the first one is everything up to its last slash
+static size_t getHandedDirLen(void) {
+	return strrchr(handedPaths, '/') - handedPaths + 1;
+}
+
+// Images from another directory replace the list once the shown image is hidden
+static void openHandedDir(void) {
+	if (img != NULL) cancelOrient(img);
+	img = imgs.pinned = NULL;
+	zeroMem(&play.requested); // Images that aren't in the new directory are freed
+
+	char   dir[PATH_MAX];
+	size_t len = getHandedDirLen();
+	memcpy(dir, handedPaths, len);
+	dir[len] = 0;
+	Error err = changeImagesDir(&imgs, dir);
+	if (err != NULL) error("Error while changing images directory to \"%s\": %s", dir, err);
+	imgIdx = addHandedPaths();
+	prepareImage();
+}
+
+// In single-instance mode, images from other invocations are opened like from the command line
+static void updateInstance(void) {
+	if (handedPaths == NULL) handedPaths = acceptInstance(&inst);
+	if (handedPaths == NULL || showTimer > 0 || hideTimer > 0) return;
+
+	if (play.on) stopPlayback();
+	SDL_RaiseWindow(win);
+	size_t len = getHandedDirLen();
+	if (len != imgs.dirLen || strncmp(handedPaths, imgs.dir, len) != 0) {
+		if (img != NULL) hideImage(openHandedDir);
+		else openHandedDir();
+		return;
+	}
+
+	int idx = addHandedPaths();
+	if (img != NULL && getImage(&imgs, idx) != img) {
+		imgIdx = idx;
+		hideImage(prepareImage);
+	} else if (img == NULL) imgIdx = idx; // Prepared right after this
 }
 
 static void event(SDL_Event *e) {
@@ -449,17 +750,18 @@ static void event(SDL_Event *e) {
 			switch (key) {
 			case SDLK_ESCAPE: quit = true; break;
 			case SDLK_F11:    fullscreen(fullscr = !fullscr); break;
-			case SDLK_LEFT:   nextImage(-1);   break;
-			case SDLK_RIGHT:  nextImage(1);    break;
+			case SDLK_LEFT:   if (play.on) stopPlayback(); nextImage(-1); break;
+			case SDLK_RIGHT:  if (play.on) stopPlayback(); nextImage(1);  break;
+			case SDLK_p:      if (play.on) stopPlayback(); else startPlayback(); break;
 			case SDLK_q:      rotateImage(-1); break;
 			case SDLK_e:      rotateImage(1);  break;
-			case SDLK_w: case SDLK_s: if (imgs.sz > 0) img->flipv = !img->flipv; break;
-			case SDLK_a: case SDLK_d: if (imgs.sz > 0) img->fliph = !img->fliph; break;
+			case SDLK_w: case SDLK_s: flipImage(true);  break;
+			case SDLK_a: case SDLK_d: flipImage(false); break;
 			case SDLK_SPACE:
 				if (isImageAvailable()) {
 					if (++filter >= FILTERCOUNT) filter = 0;
 					filterIconTimer = FILTERICONTIME;
-					recreateImageTexture();
+					updateFiltering();
 				}
 				break;
 			default:
@@ -512,13 +814,34 @@ static void event(SDL_Event *e) {
 }
 
 static void updateGif(void) {
-	if ((gifTimer += dt) > img->delays[gifFrame]) {
+	if ((gifTimer += dt) > getAnimDelay(img)) {
+		// If the decoder is behind, keep showing the current frame and try again next update
+		SDL_Rect r;
+		if (!nextAnimFrame(img, &r.x, &r.y, &r.w, &r.h)) return;
 		gifTimer = 0;
-		if (++gifFrame >= img->len) gifFrame = 0;
-		SDL_UpdateTexture(imgTex, NULL, img->pxs + img->w*img->h*gifFrame*4, img->w*4);
+		// Only upload what changed, small sprites moving over a big canvas are common in gifs
+		updateTexture(imgTex, &r, img->pxs + ((size_t)r.y*img->w + r.x)*4, img->w*4);
 	}
 }
 
+/* Frames are uploaded to the texture that isn't shown and then swapped with it, so the upload
+   doesn't have to wait for the previous frame to be drawn */
+static void updateFeed(void) {
+	int w = img->w, h = img->h;
+	if (!nextFeedFrame(feed, img)) return;
+	if (img->w != w || img->h != h || tiled) {
+		updateWindowTitle();
+		recreateImageTexture();
+		return;
+	}
+
+	if (imgBackTex == NULL) imgBackTex = createImageTexture();
+	uploadImageRows(imgBackTex, 0, img->h);
+	Texture *tex = imgTex;
+	imgTex     = imgBackTex;
+	imgBackTex = tex;
+}
+
 static void updateCameraTransition(void) {
 	double t = dt*conf.cam.damping;
 	if (t > 1) t = 1;
@@ -540,25 +863,39 @@ static void update(void) {
 	if (filterIconTimer > 0) if ((filterIconTimer -= dt) < 0) filterIconTimer = 0;
 
 	watchImages(&imgs);
+	updateInstance();
 	// If there are still no images, no updates need to be done
 	if (!imgs.sz) return;
 	/* If there are images but we haven't initialized the current image, let's prepare an image.
 	   This situation will never happen without img being NULL because we never remove images that
 	   are already loaded */
 	if (img == NULL) prepareImage();
+	// In watch reload mode, the new version replaces the shown image without any transition
+	if (updateReload(&imgs)) {
+		updateWindowTitle();
+		recreateImageTexture();
+		gifTimer = 0;
+	}
 
 	// If we're still waiting but the image isn't loading, that means the loading has just ended
 	if (waiting && !isImageLoading(img)) loadingEnded();
-	/* If we're still waiting, or there's an error, we don't need to check for updating
-	   image-related things */
-	if (waiting)          return;
-	if (img->err != NULL) return;
+	if (waiting) updatePartialImage(); // Progressive images are shown while they're still loading
+	/* If we're still waiting with nothing to show, or there's an error, we don't need to check for
+	   updating image-related things */
+	if (waiting && shownRows == 0) return;
+	if (img->err != NULL)          return;
 
-	if (!img->loaded) {
+	if (!waiting && !isImageLoaded(img)) {
 		/* If the image is not loaded, there's no error and it isn't currently being hidden, that
 		   means it just got unloaded, probably because the file got modified. So let's reload it */
 		if (hideTimer == 0) hideImage(startLoadingImage);
-	} else if (img->isGif) updateGif(); // We can't update the gif unless the image is loaded
+	} else if (!waiting && playPending) {
+		playPending = false;
+		startPlayback();
+	} else if (!waiting && play.on) updatePlayback();
+	else if (!waiting && img->anim != NULL) updateGif(); // We can't update the gif unless the image is loaded
+	else if (!waiting && feed != NULL && !*img->path) updateFeed(); // Only the stdin image is fed
+	if (!waiting && isImageLoaded(img)) updateOrientedImage();
 	updateCameraTransition();
 
 	/* This function must run last because it (possibly) changes the state of the image when
@@ -575,18 +912,51 @@ static bool isStdinRedirectedOrPiped(void) {
 	return !isatty(STDIN_FILENO); // Redirecting?
 }
 
-void view(const char *browsePath, const char **paths, int count) {
-	// TODO: Copying images into clipboard with CTRL+C
+void startView(const char *browsePath, const char **paths, int count, const ViewOptions *options) {
+	Error err = initImages(&imgs, browsePath);
+	// Error in initImages still leaves it in a usable state
+	if (err != NULL) error("Error while initializing images list: %s", err);
 
-	setup(browsePath);
+	/* The image starts loading right away, before the directory is scanned and the window exists,
+	   and the viewer waits for it like for any other image once it's set up */
+	opts = *options;
+	if (opts.feed) imgIdx = getOrAddImage(&imgs, IMGSTDIN);
+	else if (count > 0) imgIdx = getOrAddImage(&imgs, *paths);
+	else if (isStdinRedirectedOrPiped()) imgIdx = getOrAddImage(&imgs, IMGSTDIN);
+	playPending = opts.fps > 0 && !opts.feed;
+	if (imgs.sz) {
+		img = imgs.pinned = getImage(&imgs, imgIdx);
+		startLoadingImage();
+	}
+
+	if ((err = scanImages(&imgs)) != NULL) error("Error while scanning images directory: %s", err);
+	for (int i = 1; i < count; ++i) getOrAddImage(&imgs, paths[i]);
+	if (img != NULL) imgIdx = getImageIndex(&imgs, img);
+	else if (imgs.sz) {
+		if (opts.first > 0 && opts.first <= (int)imgs.sz) imgIdx = opts.first - 1;
+		img = imgs.pinned = getImage(&imgs, imgIdx);
+		startLoadingImage();
+	}
+}
+
+void view(void) {
+	// TODO: Copying images into clipboard with CTRL+C
 
-	if (count > 0) {
-		for (int i = 0; i < count; ++i) getOrAddImage(&imgs, paths[i]);
-		bool found = searchImageByName(&imgs, *paths, &imgIdx);
-		assert(found); // We just inserted it, so it must be there
-		unused(found);
-	} else if (isStdinRedirectedOrPiped()) imgIdx = getOrAddImage(&imgs, IMGSTDIN);
-	if (imgs.sz) prepareImage();
+	setup();
+	if (img != NULL) updateWindowTitle();
+	if (conf.win.singleInstance) {
+		Error err = listenInstance(&inst);
+		if (err != NULL) error("Failed to listen for other invocations: %s", err);
+	}
+	if (opts.replay != NULL) {
+		Error err = startReplay(&replay, opts.replay);
+		if (err != NULL) die("Failed to replay input from \"%s\": %s", opts.replay, err);
+	} else if (opts.record != NULL) {
+		int   w, h;
+		SDL_GetWindowSize(win, &w, &h);
+		Error err = startRecording(&replay, opts.record, w, h);
+		if (err != NULL) error("Failed to record input to \"%s\": %s", opts.record, err);
+	}
 
 	while (!quit) {
 		// Update delta and elapsed time
@@ -596,9 +966,26 @@ void view(const char *browsePath, const char **paths, int count) {
 		now      = SDL_GetPerformanceCounter();
 		elapsed += dt = (double)(now - last)*1000/SDL_GetPerformanceFrequency();
 
+		bool loading = isLoadingShown(), shown = isWholeImageShown();
 		render();
+		countReplayFrame(&replay, dt, loading, shown);
+
 		SDL_Event e;
-		while (SDL_PollEvent(&e)) event(&e);
+		while (SDL_PollEvent(&e)) {
+			// Live input would make the replay differ from the recording
+			if (replay.replaying && isInputEvent(&e)) {
+				if (e.type == SDL_DROPFILE) free(e.drop.file);
+				continue;
+			}
+			recordEvent(&replay, elapsed, &e);
+			event(&e);
+		}
+		while (nextReplayEvent(&replay, elapsed, &e)) {
+			// The window is resized too, the surface it's drawn to has to match
+			if (e.type == SDL_WINDOWEVENT) SDL_SetWindowSize(win, e.window.data1, e.window.data2);
+			event(&e);
+		}
+		if (isReplayOver(&replay, elapsed)) quit = true;
 		update();
 	}
 	cleanup();
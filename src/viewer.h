@@ -3,8 +3,8 @@
 
 #include <stdbool.h>      // bool, true, false
 #include <stdint.h>       // uint32_t
-#include <math.h>         // sin, floor
-#include <string.h>       // strlen, strcpy, strncmp, strcat
+#include <math.h>         // sin, floor, ceil
+#include <string.h>       // strlen, strcpy, strncmp, strcat, strrchr, memcpy
 #include <unistd.h>       // isatty, getcwd
 #include <sys/stat.h>     // fstat
 #include <linux/limits.h> // PATH_MAX
@@ -14,11 +14,25 @@
 #include "common.h"
 #include "config.h"
 #include "loader.h"
+#include "instance.h"
+#include "render.h"
+#include "replay.h"
+#include "tiles.h"
 
 #define TITLE          "tinview"
 #define TILESZ         10
 #define FILTERICONTIME 1000
 
-void view(const char *browsePath, const char **paths, int count);
+typedef struct {
+	bool        feed;           // Show a stream of images from stdin, see startFeed
+	double      fps;            // Start flipbook playback at this many frames per second, if above 0
+	int         first, last;    // Playback range as positions in the images list from 1, 0 means the end
+	bool        loop;
+	const char *record, *replay; // Input recording to write or to replay, see Replay
+} ViewOptions;
+
+// Starts loading the first image, so it decodes while the window is being created in view
+void startView(const char *browsePath, const char **paths, int count, const ViewOptions *opts);
+void view(void);
 
 #endif
@@ -0,0 +1,44 @@
+/* Bakes a PNG into an include file with its pixels as a ready to upload RGBA array, so nothing has
+   to be decoded at startup. Built and run by the makefile: bake baked/NAME.png src/baked_NAME.inc */
+
+#include <stdio.h>  // printf, fprintf, fopen, fclose, stderr
+#include <stdlib.h> // free, EXIT_FAILURE
+#include <string.h> // strrchr, strlen
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		fprintf(stderr, "Usage: bake IN.png OUT.inc\n");
+		return EXIT_FAILURE;
+	}
+
+	int      w, h;
+	uint8_t *pxs = stbi_load(argv[1], &w, &h, NULL, 4);
+	if (pxs == NULL) {
+		fprintf(stderr, "Error: Failed to load \"%s\": %s\n", argv[1], stbi_failure_reason());
+		return EXIT_FAILURE;
+	}
+
+	// The array is named after the file, baked/loading.png -> baked_loading
+	char  name[256] = "baked_";
+	char *base = strrchr(argv[1], '/');
+	strncat(name, base == NULL? argv[1] : base + 1, sizeof(name) - strlen(name) - 1);
+	char *ext = strrchr(name, '.');
+	if (ext != NULL) *ext = '\0';
+
+	FILE *f = fopen(argv[2], "w");
+	if (f == NULL) {
+		fprintf(stderr, "Error: Failed to create \"%s\"\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	fprintf(f, "// Baked from %s, don't edit\n", argv[1]);
+	fprintf(f, "#define %s_w %i\n#define %s_h %i\n", name, w, name, h);
+	fprintf(f, "static const uint8_t %s[%i] = {", name, w*h*4);
+	for (int i = 0; i < w*h*4; ++i) fprintf(f, i%16 == 0? "\n\t%i," : " %i,", pxs[i]);
+	fprintf(f, "\n};\n");
+	fclose(f);
+	free(pxs);
+	return 0;
+}